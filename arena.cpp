@@ -0,0 +1,199 @@
+#include <sys/mman.h>
+#include <string.h>
+#include <errno.h>
+#include "arena.h"
+#include "log.h"
+
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+/*
+优先使用MAP_HUGETLB的大页 (需要系统预留 vm.nr_hugepages)，失败时使用普通页并通过madvise申请透明大页
+普通页使用MAP_NORESERVE，区域只有被真正使用的部分才占用物理内存
+大页不能使用MAP_NORESERVE，否则系统预留不足时要到访问时才以SIGBUS的形式暴露出来，这里让mmap直接失败
+*/
+arena::arena( size_t capacity, bool huge_pages ) : m_base( NULL ), m_capacity( 0 ), m_top( 0 )
+{
+    memset( m_free, 0, sizeof( m_free ) );
+    memset( m_slab_cur, 0, sizeof( m_slab_cur ) );
+    memset( m_slab_end, 0, sizeof( m_slab_end ) );
+    if( capacity == 0 )
+    {
+        return;
+    }
+
+    void* base = MAP_FAILED;
+    if( huge_pages )
+    {
+        capacity = ( capacity + HUGE_PAGE_SIZE - 1 ) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        base = mmap( NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        if( base == MAP_FAILED )
+        {
+            log( LOG_INFO, __FILE__, __LINE__, "map huge pages for arena failed: %s, use transparent huge pages", strerror( errno ) );
+        }
+    }
+    if( base == MAP_FAILED )
+    {
+        base = mmap( NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+        if( base == MAP_FAILED )
+        {
+            log( LOG_ERR, __FILE__, __LINE__, "map arena failed: %s, fallback to heap", strerror( errno ) );
+            return;
+        }
+        if( huge_pages )
+        {
+            madvise( base, capacity, MADV_HUGEPAGE );
+        }
+    }
+    m_base = ( char* )base;
+    m_capacity = capacity;
+}
+
+arena::~arena()
+{
+    if( m_base )
+    {
+        munmap( m_base, m_capacity );
+    }
+}
+
+int arena::size_class( size_t size ) const
+{
+    int cls = 0;
+    size_t cls_size = ( size_t )1 << MIN_CLASS_SHIFT;
+    while( cls_size < size )
+    {
+        cls_size <<= 1;
+        ++cls;
+    }
+    return ( cls < CLASS_NUMBER ) ? cls : -1;
+}
+
+void* arena::alloc( size_t size )
+{
+    if( !m_base )
+    {
+        return NULL;
+    }
+    int cls = size_class( size );
+    if( cls < 0 )
+    {
+        return NULL;
+    }
+
+    if( m_free[ cls ] )     // 优先复用释放过的对象
+    {
+        free_node* node = m_free[ cls ];
+        m_free[ cls ] = node->m_next;
+        return node;
+    }
+
+    size_t cls_size = ( size_t )1 << ( cls + MIN_CLASS_SHIFT );
+    if( m_slab_cur[ cls ] == m_slab_end[ cls ] )    // 当前slab已用完，从区域中再切一块
+    {
+        size_t slab_size = ( cls_size < SLAB_SIZE ) ? SLAB_SIZE : cls_size;
+        if( m_capacity - m_top < slab_size )
+        {
+            return NULL;
+        }
+        m_slab_cur[ cls ] = m_base + m_top;
+        m_slab_end[ cls ] = m_base + m_top + slab_size;
+        m_top += slab_size;
+    }
+    void* ptr = m_slab_cur[ cls ];
+    m_slab_cur[ cls ] += cls_size;
+    return ptr;
+}
+
+void arena::release( void* ptr, size_t size )
+{
+    int cls = size_class( size );
+    if( !ptr || cls < 0 || !owns( ptr ) )
+    {
+        return;
+    }
+    free_node* node = ( free_node* )ptr;
+    node->m_next = m_free[ cls ];
+    m_free[ cls ] = node;
+}
+
+bool arena::owns( const void* ptr ) const
+{
+    return m_base && ( const char* )ptr >= m_base && ( const char* )ptr < m_base + m_capacity;
+}
+
+void arena_buf::reserve( size_t size )
+{
+    if( size <= m_capacity )
+    {
+        return;
+    }
+    size_t capacity = m_capacity ? m_capacity : MIN_CAPACITY;
+    while( capacity < size )
+    {
+        capacity <<= 1;
+    }
+    char* data = m_arena ? ( char* )m_arena->alloc( capacity ) : NULL;
+    if( !data )
+    {
+        data = new char[ capacity ];
+    }
+    if( m_size > 0 )
+    {
+        memcpy( data, m_data, m_size );
+    }
+    size_t size_kept = m_size;
+    clear();
+    m_data = data;
+    m_size = size_kept;
+    m_capacity = capacity;
+}
+
+void arena_buf::append( const char* data, size_t len )
+{
+    reserve( m_size + len );
+    memcpy( m_data + m_size, data, len );
+    m_size += len;
+}
+
+void arena_buf::assign( const char* data, size_t len )
+{
+    m_size = 0;
+    append( data, len );
+}
+
+void arena_buf::resize( size_t size )
+{
+    reserve( size );
+    m_size = size;
+}
+
+void arena_buf::clear()
+{
+    if( m_data )
+    {
+        if( m_arena && m_arena->owns( m_data ) )
+        {
+            m_arena->release( m_data, m_capacity );
+        }
+        else
+        {
+            delete [] m_data;
+        }
+    }
+    m_data = NULL;
+    m_size = 0;
+    m_capacity = 0;
+}
+
+void arena_buf::swap( arena_buf& other )
+{
+    char* data = m_data;
+    size_t size = m_size;
+    size_t capacity = m_capacity;
+    m_data = other.m_data;
+    m_size = other.m_size;
+    m_capacity = other.m_capacity;
+    other.m_data = data;
+    other.m_size = size;
+    other.m_capacity = capacity;
+}
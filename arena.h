@@ -0,0 +1,77 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+每个子进程一个的slab内存池：启动时mmap一整块区域，conn对象与其缓冲区都从这里分配
+对象按2的幂划分大小等级，同一等级的对象从同一块slab中连续切出，释放后挂到该等级的空闲链表上复用
+区域用尽或创建失败时alloc返回NULL，由调用者退回到普通的堆分配
+*/
+class arena
+{
+public:
+    arena( size_t capacity, bool huge_pages = false );     //capacity为区域大小(字节)，huge_pages表示尝试使用大页
+    ~arena();
+    void* alloc( size_t size );                 //分配size字节，失败返回NULL
+    void release( void* ptr, size_t size );     //归还alloc得到的内存，size须与分配时一致
+    bool owns( const void* ptr ) const;         //ptr是否来自本内存池
+    size_t used() const { return m_top; }       //已经切分出去的字节数
+    size_t capacity() const { return m_capacity; }
+
+private:
+    int size_class( size_t size ) const;        //size对应的大小等级，超出范围返回-1
+
+private:
+    struct free_node
+    {
+        free_node* m_next;
+    };
+
+    static const int MIN_CLASS_SHIFT = 6;       //最小的等级为64字节
+    static const int CLASS_NUMBER = 21;         //64B ~ 64MB
+    static const size_t SLAB_SIZE = 64 * 1024;  //小对象每次从区域中切出的slab大小
+
+    char* m_base;           //mmap得到的区域起始地址
+    size_t m_capacity;      //区域大小
+    size_t m_top;           //区域中尚未切分部分的起始偏移
+    free_node* m_free[ CLASS_NUMBER ];          //每个等级的空闲链表
+    char* m_slab_cur[ CLASS_NUMBER ];           //每个等级当前slab中下一个可用的位置
+    char* m_slab_end[ CLASS_NUMBER ];           //每个等级当前slab的末尾
+};
+
+/*
+从arena分配的可增长字节缓冲区，用于缓存的key与响应这类长度不定、只在一次请求期间存在的数据
+容量按2的幂增长，与arena的大小等级一致；clear()把内存还给arena的空闲链表，空闲的连接不占用空间
+pool为NULL或内存池用尽时退回到堆
+*/
+class arena_buf
+{
+public:
+    arena_buf( arena* pool = NULL ) : m_arena( pool ), m_data( NULL ), m_size( 0 ), m_capacity( 0 ){}
+    ~arena_buf() { clear(); }
+    void append( const char* data, size_t len );
+    void assign( const char* data, size_t len );
+    void resize( size_t size );     //改变长度，新增部分的内容未定义
+    void clear();                   //清空并归还内存
+    void swap( arena_buf& other );  //两者须使用同一个内存池
+    char* data() { return m_data; }
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+private:
+    arena_buf( const arena_buf& );
+    arena_buf& operator=( const arena_buf& );
+    void reserve( size_t size );    //容量至少为size，原有内容保留
+
+private:
+    static const size_t MIN_CAPACITY = 1024;
+
+    arena* m_arena;
+    char* m_data;
+    size_t m_size;
+    size_t m_capacity;
+};
+
+#endif
@@ -0,0 +1,297 @@
+/*
+基准测试用的后端，在回环地址上代替logical_host
+echo模式: 原样返回收到的数据
+http模式: 请求的路径是响应体的字节数，例如 "GET /1024 HTTP/1.1" 返回1024字节，请求体读取后丢弃，支持keep-alive
+
+每个线程有自己的epoll与SO_REUSEPORT监听socket，由内核在线程之间分配连接
+用法: backend [-m echo|http] [-t threads] port...
+*/
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <vector>
+
+using std::vector;
+
+enum MODE { MODE_ECHO = 0, MODE_HTTP };
+
+static const int MAX_EVENTS = 1024;
+static const int IN_BUF_SIZE = 16384;
+static const int BODY_CHUNK = 65536;
+
+static int mode = MODE_HTTP;
+static vector< int > ports;
+static char body[ BODY_CHUNK ];     // 所有响应体共用的内容
+
+class client
+{
+public:
+    client( int fd, bool listening = false ) : m_fd( fd ), m_listening( listening ), m_in_len( 0 ), m_out_off( 0 ), m_head_len( 0 ), m_head_off( 0 ),
+                                               m_body_left( 0 ), m_discard( 0 ), m_close_after( false ){}
+
+public:
+    int m_fd;
+    bool m_listening;           // 是否为监听socket
+    char m_in[ IN_BUF_SIZE ];   // 读到的数据 (echo模式下也是待写回的数据)
+    int m_in_len;
+    int m_out_off;              // echo模式下m_in中已写回的位置
+    char m_head[128];           // http响应头
+    int m_head_len;
+    int m_head_off;
+    long long m_body_left;      // 还要发送的响应体字节数
+    long long m_discard;        // 还要丢弃的请求体字节数
+    bool m_close_after;         // 响应发送完后关闭连接
+};
+
+static int open_listenfd( int port )
+{
+    int fd = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0 );
+    if( fd < 0 )
+    {
+        return -1;
+    }
+    int on = 1;
+    setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+    setsockopt( fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof( on ) );
+    struct sockaddr_in address;
+    bzero( &address, sizeof( address ) );
+    address.sin_family = AF_INET;
+    address.sin_port = htons( port );
+    inet_pton( AF_INET, "127.0.0.1", &address.sin_addr );
+    if( bind( fd, ( struct sockaddr* )&address, sizeof( address ) ) < 0 || listen( fd, 4096 ) < 0 )
+    {
+        close( fd );
+        return -1;
+    }
+    return fd;
+}
+
+// 把m_in中还没写回的数据写回，写完后继续读；返回false表示连接应关闭
+static bool handle_echo( client* c )
+{
+    while( true )
+    {
+        while( c->m_out_off < c->m_in_len )
+        {
+            int n = write( c->m_fd, c->m_in + c->m_out_off, c->m_in_len - c->m_out_off );
+            if( n < 0 )
+            {
+                return errno == EAGAIN;
+            }
+            c->m_out_off += n;
+        }
+        c->m_in_len = 0;
+        c->m_out_off = 0;
+        int n = read( c->m_fd, c->m_in, IN_BUF_SIZE );
+        if( n == 0 )
+        {
+            return false;
+        }
+        if( n < 0 )
+        {
+            return errno == EAGAIN;
+        }
+        c->m_in_len = n;
+    }
+}
+
+// 从m_in开头解析一个完整的请求头，解析出来后设置好响应；没有完整的请求头时返回false
+static bool parse_request( client* c )
+{
+    char* end = NULL;
+    for( int i = 0; i + 3 < c->m_in_len; ++i )
+    {
+        if( memcmp( c->m_in + i, "\r\n\r\n", 4 ) == 0 )
+        {
+            end = c->m_in + i + 4;
+            break;
+        }
+    }
+    if( !end )
+    {
+        return false;
+    }
+    char saved = *( end - 1 );
+    *( end - 1 ) = '\0';    // 方便用字符串函数查找头部字段
+
+    char* path = strchr( c->m_in, '/' );
+    long long size = path ? atoll( path + 1 ) : 0;
+    char* length = strcasestr( c->m_in, "\r\ncontent-length:" );
+    c->m_discard = length ? atoll( length + 17 ) : 0;
+    c->m_close_after = strcasestr( c->m_in, "\r\nconnection: close" ) != NULL || strstr( c->m_in, "HTTP/1.0" ) != NULL;
+
+    *( end - 1 ) = saved;
+    int used = end - c->m_in;
+    memmove( c->m_in, end, c->m_in_len - used );
+    c->m_in_len -= used;
+
+    c->m_head_len = snprintf( c->m_head, sizeof( c->m_head ), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\n%s\r\n",
+                              size, c->m_close_after ? "Connection: close\r\n" : "" );
+    c->m_head_off = 0;
+    c->m_body_left = size;
+    return true;
+}
+
+static bool handle_http( client* c )
+{
+    while( true )
+    {
+        // 先把当前的响应发完
+        while( c->m_head_off < c->m_head_len )
+        {
+            int n = write( c->m_fd, c->m_head + c->m_head_off, c->m_head_len - c->m_head_off );
+            if( n < 0 )
+            {
+                return errno == EAGAIN;
+            }
+            c->m_head_off += n;
+        }
+        while( c->m_body_left > 0 )
+        {
+            int n = write( c->m_fd, body, c->m_body_left < BODY_CHUNK ? c->m_body_left : BODY_CHUNK );
+            if( n < 0 )
+            {
+                return errno == EAGAIN;
+            }
+            c->m_body_left -= n;
+        }
+        if( c->m_head_len > 0 && c->m_close_after )
+        {
+            return false;
+        }
+        c->m_head_len = 0;
+        c->m_head_off = 0;
+
+        // 丢弃请求体
+        if( c->m_discard > 0 && c->m_in_len > 0 )
+        {
+            int n = c->m_discard < c->m_in_len ? ( int )c->m_discard : c->m_in_len;
+            memmove( c->m_in, c->m_in + n, c->m_in_len - n );
+            c->m_in_len -= n;
+            c->m_discard -= n;
+        }
+        if( c->m_discard == 0 && parse_request( c ) )
+        {
+            continue;
+        }
+
+        if( c->m_in_len == IN_BUF_SIZE )    // 请求头过长
+        {
+            return false;
+        }
+        int n = read( c->m_fd, c->m_in + c->m_in_len, IN_BUF_SIZE - c->m_in_len );
+        if( n == 0 )
+        {
+            return false;
+        }
+        if( n < 0 )
+        {
+            return errno == EAGAIN;
+        }
+        c->m_in_len += n;
+    }
+}
+
+static void* worker( void* arg )
+{
+    int epollfd = epoll_create1( 0 );
+    for( int i = 0; i < ( int )ports.size(); ++i )
+    {
+        int fd = open_listenfd( ports[i] );
+        if( fd < 0 )
+        {
+            fprintf( stderr, "listen on port %d failed: %s\n", ports[i], strerror( errno ) );
+            exit( 1 );
+        }
+        epoll_event event;
+        event.data.ptr = new client( fd, true );
+        event.events = EPOLLIN;
+        epoll_ctl( epollfd, EPOLL_CTL_ADD, fd, &event );
+    }
+
+    epoll_event events[ MAX_EVENTS ];
+    while( true )
+    {
+        int number = epoll_wait( epollfd, events, MAX_EVENTS, -1 );
+        for( int i = 0; i < number; ++i )
+        {
+            client* c = ( client* )events[i].data.ptr;
+            if( c->m_listening )
+            {
+                int fd;
+                while( ( fd = accept4( c->m_fd, NULL, NULL, SOCK_NONBLOCK ) ) >= 0 )
+                {
+                    int on = 1;
+                    setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+                    epoll_event event;
+                    event.data.ptr = new client( fd );
+                    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+                    epoll_ctl( epollfd, EPOLL_CTL_ADD, fd, &event );
+                }
+                continue;
+            }
+
+            bool alive = mode == MODE_ECHO ? handle_echo( c ) : handle_http( c );
+            if( !alive )
+            {
+                close( c->m_fd );
+                delete c;
+            }
+        }
+    }
+    return NULL;
+}
+
+int main( int argc, char* argv[] )
+{
+    int threads = 1;
+    int opt;
+    while( ( opt = getopt( argc, argv, "m:t:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+            case 'm':
+                mode = strcmp( optarg, "echo" ) == 0 ? MODE_ECHO : MODE_HTTP;
+                break;
+            case 't':
+                threads = atoi( optarg );
+                break;
+            default:
+                fprintf( stderr, "usage: %s [-m echo|http] [-t threads] port...\n", argv[0] );
+                return 1;
+        }
+    }
+    for( int i = optind; i < argc; ++i )
+    {
+        ports.push_back( atoi( argv[i] ) );
+    }
+    if( ports.empty() || threads <= 0 )
+    {
+        fprintf( stderr, "usage: %s [-m echo|http] [-t threads] port...\n", argv[0] );
+        return 1;
+    }
+    memset( body, 'x', sizeof( body ) );
+    signal( SIGPIPE, SIG_IGN );
+
+    vector< pthread_t > tids( threads );
+    for( int i = 0; i < threads; ++i )
+    {
+        pthread_create( &tids[i], NULL, worker, NULL );
+    }
+    for( int i = 0; i < threads; ++i )
+    {
+        pthread_join( tids[i], NULL );
+    }
+    return 0;
+}
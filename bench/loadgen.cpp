@@ -0,0 +1,446 @@
+/*
+基准测试的负载生成器：多个线程各自用一个epoll驱动一组非阻塞连接
+http模式发送 "GET /<size>" (有请求体时为POST)，按Content-Length读完响应；echo模式发送size字节并读回同样多的字节
+-k指定每个连接发送多少个请求后关闭重连 (0表示一直keep-alive，1表示每个请求一个新连接)，-r限制每秒新建的连接数
+结束时输出一行: 请求数、错误数、RPS、两个方向合计的Gbit/s以及请求延迟的p50/p99/p999
+每个连接的第一个请求的延迟包含建立连接的时间
+
+用法: loadgen [-h host] [-p port] [-m http|echo] [-c conns] [-t threads] [-d seconds] [-r conns_per_sec]
+              [-s size] [-q request_body] [-k requests_per_conn] [-n name]
+*/
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "metrics.h"
+#include "scheduler.h"
+
+using std::string;
+using std::vector;
+
+enum MODE { MODE_ECHO = 0, MODE_HTTP };
+enum SLOT_STATE { SLOT_IDLE = 0, SLOT_CONNECTING, SLOT_SENDING, SLOT_RECEIVING };
+
+static const int MAX_EVENTS = 1024;
+static const int HEAD_BUF_SIZE = 4096;
+static const int READ_CHUNK = 65536;
+
+// 命令行参数，所有线程只读
+static sockaddr_in target;
+static int mode = MODE_HTTP;
+static int concurrency = 64;
+static int threads = 1;
+static int duration = 10;
+static double conn_rate = 0;
+static long long size = 64;
+static long long request_body = 0;
+static int per_conn = 0;
+static const char* name = "bench";
+static string request;      // 每次发送的完整请求
+
+// 一个连接槽位，连接关闭后由同一个槽位重新建立
+class slot
+{
+public:
+    slot() : m_fd( -1 ), m_state( SLOT_IDLE ), m_sent( 0 ), m_head_len( 0 ), m_body_left( 0 ), m_start( 0 ), m_requests( 0 ), m_close_after( false ){}
+
+public:
+    int m_fd;
+    int m_state;                // SLOT_STATE
+    int m_sent;                 // 当前请求已发送的字节数
+    char m_head[ HEAD_BUF_SIZE ];   // http响应头
+    int m_head_len;
+    long long m_body_left;      // 还要读的响应字节数，-1表示响应头还没读完
+    long long m_start;          // 当前请求开始的时刻(微秒)
+    int m_requests;             // 该连接上已完成的请求数
+    bool m_close_after;         // 服务端要求关闭连接
+};
+
+// 每个线程的统计，结束后由主线程汇总
+class worker
+{
+public:
+    worker() : m_requests( 0 ), m_errors( 0 ), m_connects( 0 ), m_bytes_in( 0 ), m_bytes_out( 0 ), m_slots( 0 )
+    {
+        memset( &m_latency, 0, sizeof( m_latency ) );
+    }
+
+public:
+    pthread_t m_tid;
+    unsigned long long m_requests;
+    unsigned long long m_errors;
+    unsigned long long m_connects;
+    unsigned long long m_bytes_in;
+    unsigned long long m_bytes_out;
+    int m_slots;                // 该线程负责的连接数
+    latency_histogram m_latency;
+};
+
+static void close_slot( int epollfd, slot* s )
+{
+    epoll_ctl( epollfd, EPOLL_CTL_DEL, s->m_fd, NULL );
+    close( s->m_fd );
+    s->m_fd = -1;
+    s->m_state = SLOT_IDLE;
+}
+
+static bool open_slot( int epollfd, slot* s, worker* w )
+{
+    int fd = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0 );
+    if( fd < 0 )
+    {
+        ++w->m_errors;
+        return false;
+    }
+    int on = 1;
+    setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+    s->m_start = monotonic_usec();
+    if( connect( fd, ( struct sockaddr* )&target, sizeof( target ) ) < 0 && errno != EINPROGRESS )
+    {
+        close( fd );
+        ++w->m_errors;
+        return false;
+    }
+    s->m_fd = fd;
+    s->m_state = SLOT_CONNECTING;
+    s->m_requests = 0;
+    s->m_close_after = false;
+    epoll_event event;
+    event.data.ptr = s;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    epoll_ctl( epollfd, EPOLL_CTL_ADD, fd, &event );
+    ++w->m_connects;
+    return true;
+}
+
+// 从已读到的响应头中取出Content-Length，响应头不完整时返回false
+static bool parse_response( slot* s, int& extra )
+{
+    s->m_head[ s->m_head_len ] = '\0';
+    char* end = strstr( s->m_head, "\r\n\r\n" );
+    if( !end )
+    {
+        return false;
+    }
+    *end = '\0';
+    char* length = strcasestr( s->m_head, "\r\ncontent-length:" );
+    s->m_body_left = length ? atoll( length + 17 ) : 0;
+    s->m_close_after = strcasestr( s->m_head, "\r\nconnection: close" ) != NULL;
+    extra = s->m_head_len - ( int )( end + 4 - s->m_head );  // 随响应头一起读到的响应体
+    return true;
+}
+
+// 开始在该连接上发送一个新的请求
+static void start_request( slot* s )
+{
+    if( s->m_requests > 0 )     // 第一个请求从发起连接开始计时
+    {
+        s->m_start = monotonic_usec();
+    }
+    s->m_state = SLOT_SENDING;
+    s->m_sent = 0;
+    s->m_head_len = 0;
+    s->m_body_left = mode == MODE_HTTP ? -1 : size;
+}
+
+// 推进一个连接的状态机直到EAGAIN；返回false表示连接出错
+static bool drive( slot* s, worker* w )
+{
+    static __thread char buf[ READ_CHUNK ];
+    while( true )
+    {
+        switch( s->m_state )
+        {
+            case SLOT_CONNECTING:
+            {
+                int error = 0;
+                socklen_t len = sizeof( error );
+                getsockopt( s->m_fd, SOL_SOCKET, SO_ERROR, &error, &len );
+                if( error != 0 )
+                {
+                    return false;
+                }
+                sockaddr_in peer;
+                socklen_t peer_len = sizeof( peer );
+                if( getpeername( s->m_fd, ( struct sockaddr* )&peer, &peer_len ) < 0 )
+                {
+                    return true;    // 连接还没有完成
+                }
+                start_request( s );
+                break;
+            }
+            case SLOT_SENDING:
+            {
+                while( s->m_sent < ( int )request.size() )
+                {
+                    int n = send( s->m_fd, request.data() + s->m_sent, request.size() - s->m_sent, MSG_NOSIGNAL );
+                    if( n >= 0 )
+                    {
+                        s->m_sent += n;
+                        w->m_bytes_out += n;
+                        continue;
+                    }
+                    if( errno != EAGAIN )
+                    {
+                        return false;
+                    }
+                    if( mode != MODE_ECHO || s->m_body_left == 0 )
+                    {
+                        return true;
+                    }
+                    // echo模式下对端要等回显的数据被读走才会继续接收，边发边读，避免双方都阻塞在写上
+                    n = recv( s->m_fd, buf, s->m_body_left < READ_CHUNK ? s->m_body_left : READ_CHUNK, 0 );
+                    if( n < 0 )
+                    {
+                        return errno == EAGAIN;
+                    }
+                    if( n == 0 )
+                    {
+                        return false;
+                    }
+                    w->m_bytes_in += n;
+                    s->m_body_left -= n;
+                }
+                s->m_state = SLOT_RECEIVING;
+                break;
+            }
+            case SLOT_RECEIVING:
+            {
+                while( s->m_body_left != 0 )
+                {
+                    int n;
+                    if( s->m_body_left < 0 )    // 还在读响应头
+                    {
+                        n = recv( s->m_fd, s->m_head + s->m_head_len, HEAD_BUF_SIZE - 1 - s->m_head_len, 0 );
+                    }
+                    else
+                    {
+                        n = recv( s->m_fd, buf, s->m_body_left < READ_CHUNK ? s->m_body_left : READ_CHUNK, 0 );
+                    }
+                    if( n < 0 )
+                    {
+                        return errno == EAGAIN;
+                    }
+                    if( n == 0 )
+                    {
+                        return false;
+                    }
+                    w->m_bytes_in += n;
+                    if( s->m_body_left < 0 )
+                    {
+                        s->m_head_len += n;
+                        int extra = 0;
+                        if( parse_response( s, extra ) )
+                        {
+                            s->m_body_left -= extra;
+                        }
+                        else if( s->m_head_len == HEAD_BUF_SIZE - 1 )
+                        {
+                            return false;
+                        }
+                    }
+                    else
+                    {
+                        s->m_body_left -= n;
+                    }
+                }
+                w->m_latency.record( monotonic_usec() - s->m_start );
+                ++w->m_requests;
+                ++s->m_requests;
+                if( s->m_close_after || ( per_conn > 0 && s->m_requests >= per_conn ) )
+                {
+                    s->m_state = SLOT_IDLE;     // 由调用者关闭
+                    return true;
+                }
+                start_request( s );
+                break;
+            }
+            default:
+                return true;
+        }
+    }
+}
+
+static void* run_worker( void* arg )
+{
+    worker* w = ( worker* )arg;
+    int epollfd = epoll_create1( 0 );
+    vector< slot > slots( w->m_slots );
+    double tokens = 0;
+    double rate = conn_rate / threads;      // 本线程每秒可以新建的连接数
+    long long begin = monotonic_usec();
+    long long last = begin;
+    long long end = begin + ( long long )duration * 1000000;
+    epoll_event events[ MAX_EVENTS ];
+
+    while( true )
+    {
+        long long now = monotonic_usec();
+        if( now >= end )
+        {
+            break;
+        }
+        if( rate > 0 )
+        {
+            tokens += ( now - last ) * rate / 1e6;
+            if( tokens > w->m_slots )
+            {
+                tokens = w->m_slots;
+            }
+        }
+        last = now;
+
+        bool waiting = false;   // 有槽位在等待新建连接的配额
+        for( int i = 0; i < w->m_slots; ++i )
+        {
+            if( slots[i].m_state != SLOT_IDLE )
+            {
+                continue;
+            }
+            if( rate > 0 && tokens < 1 )
+            {
+                waiting = true;
+                break;
+            }
+            if( open_slot( epollfd, &slots[i], w ) )
+            {
+                tokens -= 1;
+            }
+            else
+            {
+                waiting = true;     // 稍后重试
+            }
+        }
+
+        int number = epoll_wait( epollfd, events, MAX_EVENTS, waiting ? 1 : 100 );
+        for( int i = 0; i < number; ++i )
+        {
+            slot* s = ( slot* )events[i].data.ptr;
+            if( s->m_fd < 0 )
+            {
+                continue;
+            }
+            if( !drive( s, w ) )
+            {
+                ++w->m_errors;
+                close_slot( epollfd, s );
+            }
+            else if( s->m_state == SLOT_IDLE )
+            {
+                close_slot( epollfd, s );
+            }
+        }
+    }
+    for( int i = 0; i < w->m_slots; ++i )
+    {
+        if( slots[i].m_fd >= 0 )
+        {
+            close( slots[i].m_fd );
+        }
+    }
+    close( epollfd );
+    return NULL;
+}
+
+static void usage( const char* prog )
+{
+    fprintf( stderr, "usage: %s [-h host] [-p port] [-m http|echo] [-c conns] [-t threads] [-d seconds] [-r conns_per_sec]\n"
+                     "       [-s size] [-q request_body] [-k requests_per_conn] [-n name]\n", prog );
+}
+
+int main( int argc, char* argv[] )
+{
+    const char* host = "127.0.0.1";
+    int port = 8080;
+    threads = sysconf( _SC_NPROCESSORS_ONLN );
+    int opt;
+    while( ( opt = getopt( argc, argv, "h:p:m:c:t:d:r:s:q:k:n:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi( optarg ); break;
+            case 'm': mode = strcmp( optarg, "echo" ) == 0 ? MODE_ECHO : MODE_HTTP; break;
+            case 'c': concurrency = atoi( optarg ); break;
+            case 't': threads = atoi( optarg ); break;
+            case 'd': duration = atoi( optarg ); break;
+            case 'r': conn_rate = atof( optarg ); break;
+            case 's': size = atoll( optarg ); break;
+            case 'q': request_body = atoll( optarg ); break;
+            case 'k': per_conn = atoi( optarg ); break;
+            case 'n': name = optarg; break;
+            default:
+                usage( argv[0] );
+                return 1;
+        }
+    }
+    if( concurrency <= 0 || threads <= 0 || duration <= 0 || size < 0 || request_body < 0 )
+    {
+        usage( argv[0] );
+        return 1;
+    }
+    if( threads > concurrency )
+    {
+        threads = concurrency;
+    }
+    bzero( &target, sizeof( target ) );
+    target.sin_family = AF_INET;
+    target.sin_port = htons( port );
+    if( inet_pton( AF_INET, host, &target.sin_addr ) != 1 )
+    {
+        fprintf( stderr, "invalid host: %s\n", host );
+        return 1;
+    }
+    signal( SIGPIPE, SIG_IGN );
+
+    if( mode == MODE_HTTP )
+    {
+        char head[256];
+        snprintf( head, sizeof( head ), "%s /%lld HTTP/1.1\r\nHost: bench\r\nContent-Length: %lld\r\n%s\r\n", request_body > 0 ? "POST" : "GET",
+                  size, request_body, per_conn == 1 ? "Connection: close\r\n" : "" );
+        request = head;
+        request.append( request_body, 'x' );
+    }
+    else
+    {
+        request.assign( size, 'x' );
+    }
+
+    vector< worker > workers( threads );
+    long long begin = monotonic_usec();
+    for( int i = 0; i < threads; ++i )
+    {
+        workers[i].m_slots = concurrency / threads + ( i < concurrency % threads ? 1 : 0 );
+        pthread_create( &workers[i].m_tid, NULL, run_worker, &workers[i] );
+    }
+
+    worker total;
+    for( int i = 0; i < threads; ++i )
+    {
+        pthread_join( workers[i].m_tid, NULL );
+        total.m_requests += workers[i].m_requests;
+        total.m_errors += workers[i].m_errors;
+        total.m_connects += workers[i].m_connects;
+        total.m_bytes_in += workers[i].m_bytes_in;
+        total.m_bytes_out += workers[i].m_bytes_out;
+        total.m_latency.merge( workers[i].m_latency );
+    }
+    double seconds = ( monotonic_usec() - begin ) / 1e6;
+
+    printf( "%-18s %6d %9llu %9llu %7llu %11.0f %8.3f %9.3f %9.3f %9.3f\n", name, concurrency, total.m_connects, total.m_requests, total.m_errors,
+            total.m_requests / seconds, ( total.m_bytes_in + total.m_bytes_out ) * 8 / seconds / 1e9,
+            total.m_latency.quantile( 0.5 ) / 1e3, total.m_latency.quantile( 0.99 ) / 1e3, total.m_latency.quantile( 0.999 ) / 1e3 );
+    return total.m_requests > 0 ? 0 : 1;
+}
@@ -0,0 +1,732 @@
+/*
+组件级的微基准测试，不经过网络，只测单个组件的开销
+relay_buffer/relay_splice: 在socketpair上测conn::read_clt + conn::write_srv，一次操作转发一个缓冲区大小的数据
+mgr_dispatch: 有N个活跃连接时，一次操作是客户端发来64字节后mgr::process(READ)与mgr::process(WRITE)的转发
+mgr_churn: pick_conn + free_conn (free_conn会重新发起服务端连接)，连接完成的事件与recycle_conns也计入开销
+
+每项先预热，再重复多次取中位数，输出ns/op以及系统调用次数/op:
+syscalls_per_op 来自perf_event_open的raw_syscalls:sys_enter计数 (没有权限或内核不支持时为null)
+instructions_per_op 来自perf_event_open的硬件计数器 (虚拟机中通常为null)
+io_syscalls_per_op 来自/proc/self/io的syscr+syscw，只统计读写类的系统调用，总是可用
+结果逐行以JSON写入输出文件，不同版本的输出可以直接diff
+
+用法: micro [-o output] [-r repetitions] [-s scale] [-f filter]
+*/
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/perf_event.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "log.h"
+#include "fdwrapper.h"
+#include "conn.h"
+#include "mgr.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+static const int DISPATCH_PAYLOAD = 64;     // mgr_dispatch每次转发的字节数
+
+// 一个perf_event_open计数器，config小于0或打不开时不可用，stop()返回-1
+class perf_counter
+{
+public:
+    perf_counter( unsigned int type, long long config ) : m_fd( -1 )
+    {
+        if( config < 0 )
+        {
+            return;
+        }
+        struct perf_event_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+        attr.size = sizeof( attr );
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_hv = 1;
+        m_fd = syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+    }
+    ~perf_counter()
+    {
+        if( m_fd >= 0 )
+        {
+            close( m_fd );
+        }
+    }
+    void start()
+    {
+        if( m_fd >= 0 )
+        {
+            ioctl( m_fd, PERF_EVENT_IOC_RESET, 0 );
+            ioctl( m_fd, PERF_EVENT_IOC_ENABLE, 0 );
+        }
+    }
+    long long stop()
+    {
+        if( m_fd < 0 )
+        {
+            return -1;
+        }
+        ioctl( m_fd, PERF_EVENT_IOC_DISABLE, 0 );
+        long long value = 0;
+        return read( m_fd, &value, sizeof( value ) ) == sizeof( value ) ? value : -1;
+    }
+
+private:
+    int m_fd;
+};
+
+// raw_syscalls:sys_enter的tracepoint编号，找不到时返回-1
+static long long syscall_tracepoint()
+{
+    const char* paths[] = { "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id", "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id" };
+    for( int i = 0; i < 2; ++i )
+    {
+        FILE* fp = fopen( paths[i], "r" );
+        if( fp )
+        {
+            long long id = -1;
+            if( fscanf( fp, "%lld", &id ) != 1 )
+            {
+                id = -1;
+            }
+            fclose( fp );
+            return id;
+        }
+    }
+    return -1;
+}
+
+// /proc/self/io中的syscr+syscw，不可用时返回-1
+static long long io_syscalls()
+{
+    FILE* fp = fopen( "/proc/self/io", "r" );
+    if( !fp )
+    {
+        return -1;
+    }
+    char line[128];
+    long long total = 0;
+    long long value = 0;
+    while( fgets( line, sizeof( line ), fp ) )
+    {
+        if( sscanf( line, "syscr: %lld", &value ) == 1 || sscanf( line, "syscw: %lld", &value ) == 1 )
+        {
+            total += value;
+        }
+    }
+    fclose( fp );
+    return total;
+}
+
+static string param( const char* key, int value )
+{
+    char buf[64];
+    snprintf( buf, sizeof( buf ), "%s=%d", key, value );
+    return buf;
+}
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( long long )ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+一项微基准：setup准备好环境，run执行ops次操作，teardown释放
+setup失败(例如内核不支持splice到unix socket)时跳过该项
+*/
+class micro_bench
+{
+public:
+    micro_bench( const char* name, const string& param, int ops ) : m_name( name ), m_param( param ), m_ops( ops ){}
+    virtual ~micro_bench(){}
+    virtual bool setup() = 0;
+    virtual bool run( int ops ) = 0;   // 出错时返回false
+    virtual void teardown() = 0;
+
+public:
+    const char* m_name;
+    string m_param;
+    int m_ops;                  // 每次重复执行的操作数
+};
+
+/*
+conn的转发路径：客户端写入一个缓冲区大小的数据，read_clt读入，write_srv写给服务端，再由服务端一侧读走
+*/
+class relay_bench : public micro_bench
+{
+public:
+    relay_bench( int bufsize, bool splice, int ops )
+        : micro_bench( splice ? "relay_splice" : "relay_buffer", param( "bufsize", bufsize ), ops ),
+          m_bufsize( bufsize ), m_splice( splice ), m_conn( NULL )
+    {
+        m_clt[0] = m_clt[1] = m_srv[0] = m_srv[1] = -1;
+    }
+
+    bool setup()
+    {
+        if( socketpair( AF_UNIX, SOCK_STREAM, 0, m_clt ) < 0 || socketpair( AF_UNIX, SOCK_STREAM, 0, m_srv ) < 0 )
+        {
+            return false;
+        }
+        for( int i = 0; i < 2; ++i )
+        {
+            setnonblocking( m_clt[i] );
+            setnonblocking( m_srv[i] );
+        }
+        m_conn = new conn( m_bufsize );
+        if( m_splice && !m_conn->init_splice() )
+        {
+            return false;
+        }
+        sockaddr_in address;
+        memset( &address, 0, sizeof( address ) );
+        m_conn->init_srv( m_srv[0], address );
+        m_conn->init_clt( m_clt[0], address );
+        m_payload.assign( m_conn->m_buf_size, 'x' );
+        m_drain.resize( m_conn->m_buf_size );
+        return true;
+    }
+
+    bool run( int ops )
+    {
+        for( int i = 0; i < ops; ++i )
+        {
+            if( write( m_clt[1], m_payload.data(), m_payload.size() ) != ( ssize_t )m_payload.size() )
+            {
+                return false;
+            }
+            RET_CODE res = m_conn->read_clt();
+            if( res != OK && res != BUFFER_FULL )
+            {
+                return false;
+            }
+            if( m_conn->write_srv() != BUFFER_EMPTY )
+            {
+                return false;
+            }
+            size_t got = 0;
+            while( got < m_payload.size() )
+            {
+                ssize_t n = read( m_srv[1], &m_drain[0], m_drain.size() );
+                if( n <= 0 )
+                {
+                    return false;
+                }
+                got += n;
+            }
+        }
+        return true;
+    }
+
+    void teardown()
+    {
+        delete m_conn;
+        m_conn = NULL;
+        for( int i = 0; i < 2; ++i )
+        {
+            if( m_clt[i] >= 0 )
+            {
+                close( m_clt[i] );
+            }
+            if( m_srv[i] >= 0 )
+            {
+                close( m_srv[i] );
+            }
+            m_clt[i] = m_srv[i] = -1;
+        }
+    }
+
+private:
+    int m_bufsize;
+    bool m_splice;
+    conn* m_conn;
+    int m_clt[2];   // [0]交给conn作为客户端fd，[1]模拟客户端
+    int m_srv[2];   // [0]交给conn作为服务端fd，[1]模拟服务端
+    string m_payload;
+    vector< char > m_drain;
+};
+
+/*
+在本进程内跑一个mgr：后端是127.0.0.1上的临时监听socket，由pump()完成非阻塞连接并accept
+*/
+class mgr_env
+{
+public:
+    mgr_env() : m_listenfd( -1 ), m_epollfd( -1 ), m_timerfd( -1 ), m_wheel( NULL ), m_manager( NULL ), m_latency( NULL )
+    {
+        memset( &m_stats, 0, sizeof( m_stats ) );
+    }
+
+    bool init( int conns )
+    {
+        m_listenfd = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0 );
+        sockaddr_in address;
+        memset( &address, 0, sizeof( address ) );
+        address.sin_family = AF_INET;
+        inet_pton( AF_INET, "127.0.0.1", &address.sin_addr );
+        socklen_t len = sizeof( address );
+        if( bind( m_listenfd, ( struct sockaddr* )&address, sizeof( address ) ) < 0 || listen( m_listenfd, 4096 ) < 0
+            || getsockname( m_listenfd, ( struct sockaddr* )&address, &len ) < 0 )
+        {
+            return false;
+        }
+
+        m_epollfd = epoll_create1( 0 );
+        m_wheel = new timer_wheel;
+        m_timerfd = m_wheel->init( m_epollfd );
+        host srv;
+        strcpy( srv.m_hostname, "127.0.0.1" );
+        srv.m_port = ntohs( address.sin_port );
+        srv.m_conncnt = conns;
+        vector< host > srvs( 1, srv );
+        m_latency = new backend_latency[1]();
+        m_manager = new mgr( m_epollfd, srvs, NULL, m_wheel, LB_WLC, &m_stats, m_latency, PROXY_TCP, 0, NULL );
+
+        long long deadline = now_ns() + 5000000000LL;
+        while( m_manager->get_ready_conn_cnt() < conns )
+        {
+            if( now_ns() > deadline )
+            {
+                return false;
+            }
+            pump();
+        }
+        pump();     // accept最后完成的连接
+        return true;
+    }
+
+    // 处理所有就绪的事件并accept新到的服务端连接，与run_child的事件循环相同
+    void pump()
+    {
+        epoll_event events[256];
+        int number = epoll_wait( m_epollfd, events, 256, 0 );
+        for( int i = 0; i < number; ++i )
+        {
+            int fd = events[i].data.fd;
+            if( fd == m_timerfd )
+            {
+                m_wheel->tick();
+            }
+            else if( events[i].events & EPOLLIN )
+            {
+                m_manager->process( fd, READ );
+            }
+            else if( events[i].events & EPOLLOUT )
+            {
+                m_manager->process( fd, WRITE );
+            }
+        }
+        int fd;
+        while( ( fd = accept4( m_listenfd, NULL, NULL, SOCK_NONBLOCK ) ) >= 0 )
+        {
+            sockaddr_in peer;
+            socklen_t len = sizeof( peer );
+            getpeername( fd, ( struct sockaddr* )&peer, &len );
+            map< int, int >::iterator it = m_accepted.find( ntohs( peer.sin_port ) );
+            if( it != m_accepted.end() )
+            {
+                close( it->second );    // 同一个本地端口的旧连接已经被mgr关闭了
+            }
+            m_accepted[ ntohs( peer.sin_port ) ] = fd;
+        }
+    }
+
+    // mgr一侧的服务端fd在后端对应的fd
+    int backend_fd( int srvfd )
+    {
+        sockaddr_in local;
+        socklen_t len = sizeof( local );
+        getsockname( srvfd, ( struct sockaddr* )&local, &len );
+        map< int, int >::iterator it = m_accepted.find( ntohs( local.sin_port ) );
+        return it == m_accepted.end() ? -1 : it->second;
+    }
+
+    // mgr即将关闭srvfd时，关闭后端一侧对应的fd，否则连接反复重建时fd会耗尽
+    void release_backend( int srvfd )
+    {
+        sockaddr_in local;
+        socklen_t len = sizeof( local );
+        getsockname( srvfd, ( struct sockaddr* )&local, &len );
+        map< int, int >::iterator it = m_accepted.find( ntohs( local.sin_port ) );
+        if( it != m_accepted.end() )
+        {
+            close( it->second );
+            m_accepted.erase( it );
+        }
+    }
+
+    void destroy()
+    {
+        delete m_manager;
+        delete m_wheel;
+        delete [] m_latency;
+        for( map< int, int >::iterator it = m_accepted.begin(); it != m_accepted.end(); ++it )
+        {
+            close( it->second );
+        }
+        m_accepted.clear();
+        close( m_epollfd );
+        close( m_listenfd );
+    }
+
+public:
+    int m_listenfd;
+    int m_epollfd;
+    int m_timerfd;
+    timer_wheel* m_wheel;
+    mgr* m_manager;
+    worker_metrics m_stats;
+    backend_latency* m_latency;
+    map< int, int > m_accepted;     // 本地端口 -> 后端accept到的fd
+};
+
+/*
+N个客户端都已绑定服务端连接，依次让每个客户端发来64字节，由mgr::process读入并写给服务端
+N越大，conn与fd表越难留在cache中
+*/
+class dispatch_bench : public micro_bench
+{
+public:
+    dispatch_bench( int conns, int ops ) : micro_bench( "mgr_dispatch", param( "conns", conns ), ops ), m_conns( conns ){}
+
+    bool setup()
+    {
+        if( !m_env.init( m_conns ) )
+        {
+            return false;
+        }
+        for( int i = 0; i < m_conns; ++i )
+        {
+            int pair[2];
+            if( socketpair( AF_UNIX, SOCK_STREAM, 0, pair ) < 0 )
+            {
+                return false;
+            }
+            setnonblocking( pair[0] );
+            conn* connection = m_env.m_manager->pick_conn( pair[0] );
+            if( !connection )
+            {
+                return false;
+            }
+            sockaddr_in address;
+            memset( &address, 0, sizeof( address ) );
+            connection->init_clt( pair[0], address );
+            m_peers.push_back( pair[1] );
+            m_cltfds.push_back( pair[0] );
+            m_srvfds.push_back( connection->m_srvfd );
+            m_backends.push_back( m_env.backend_fd( connection->m_srvfd ) );
+            if( m_backends.back() < 0 )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool run( int ops )
+    {
+        char payload[ DISPATCH_PAYLOAD ];
+        memset( payload, 'x', sizeof( payload ) );
+        for( int i = 0; i < ops; ++i )
+        {
+            int idx = i % m_conns;
+            if( write( m_peers[idx], payload, sizeof( payload ) ) != sizeof( payload ) )
+            {
+                return false;
+            }
+            if( m_env.m_manager->process( m_cltfds[idx], READ ) != OK || m_env.m_manager->process( m_srvfds[idx], WRITE ) != OK )
+            {
+                return false;
+            }
+            if( read( m_backends[idx], payload, sizeof( payload ) ) != sizeof( payload ) )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void teardown()
+    {
+        m_env.destroy();    // mgr关闭客户端fd与服务端fd
+        for( int i = 0; i < ( int )m_peers.size(); ++i )
+        {
+            close( m_peers[i] );
+        }
+    }
+
+private:
+    int m_conns;
+    mgr_env m_env;
+    vector< int > m_peers;      // 模拟客户端
+    vector< int > m_cltfds;
+    vector< int > m_srvfds;
+    vector< int > m_backends;   // 模拟服务端
+};
+
+/*
+客户端到来又立即离开：pick_conn绑定一个空闲连接，free_conn关闭后立即重新发起连接
+连接完成需要事件循环处理，每次操作后pump一次，每64次调用一次recycle_conns
+*/
+class churn_bench : public micro_bench
+{
+public:
+    churn_bench( int conns, int ops ) : micro_bench( "mgr_churn", param( "conns", conns ), ops ), m_conns( conns ){}
+
+    bool setup()
+    {
+        return m_env.init( m_conns );
+    }
+
+    bool run( int ops )
+    {
+        for( int i = 0; i < ops; ++i )
+        {
+            int fd = eventfd( 0, EFD_NONBLOCK );
+            if( fd < 0 )
+            {
+                return false;
+            }
+            conn* connection = NULL;
+            long long deadline = now_ns() + 5000000000LL;
+            while( !( connection = m_env.m_manager->pick_conn( fd ) ) )
+            {
+                if( now_ns() > deadline )
+                {
+                    close( fd );
+                    return false;
+                }
+                m_env.pump();
+            }
+            sockaddr_in address;
+            memset( &address, 0, sizeof( address ) );
+            connection->init_clt( fd, address );    // 与serve_conn相同，free_conn关闭的是m_cltfd
+            m_env.release_backend( connection->m_srvfd );
+            m_env.m_manager->free_conn( connection );
+            m_env.pump();
+            if( i % 64 == 63 )
+            {
+                m_env.m_manager->recycle_conns();
+            }
+        }
+        return true;
+    }
+
+    void teardown()
+    {
+        m_env.destroy();
+    }
+
+private:
+    int m_conns;
+    mgr_env m_env;
+};
+
+class result
+{
+public:
+    double m_ns_per_op;
+    double m_syscalls_per_op;       // <0表示不可用
+    double m_instructions_per_op;
+    double m_io_syscalls_per_op;
+};
+
+static double median( vector< double > values )
+{
+    if( values.empty() )
+    {
+        return -1;
+    }
+    std::sort( values.begin(), values.end() );
+    return values[ values.size() / 2 ];
+}
+
+static void print_value( FILE* fp, const char* key, double value )
+{
+    if( value < 0 )
+    {
+        fprintf( fp, ",\"%s\":null", key );
+    }
+    else
+    {
+        fprintf( fp, ",\"%s\":%.3f", key, value );
+    }
+}
+
+// 表格中的一列，不可用时显示为-
+static string column( double value, const char* format )
+{
+    char buf[32];
+    if( value < 0 )
+    {
+        return "-";
+    }
+    snprintf( buf, sizeof( buf ), format, value );
+    return buf;
+}
+
+// 预热后重复reps次，每次都重新计数，各项分别取中位数
+static bool measure( micro_bench* bench, int reps, perf_counter& syscalls, perf_counter& instructions, FILE* out )
+{
+    if( !bench->setup() )
+    {
+        fprintf( stderr, "%s %s: setup failed, skipped\n", bench->m_name, bench->m_param.c_str() );
+        bench->teardown();
+        return false;
+    }
+    bool ok = bench->run( bench->m_ops / 10 + 1 );
+    vector< double > ns, sys, ins, io;
+    for( int i = 0; ok && i < reps; ++i )
+    {
+        long long io_begin = io_syscalls();
+        syscalls.start();
+        instructions.start();
+        long long begin = now_ns();
+        ok = bench->run( bench->m_ops );
+        long long end = now_ns();
+        long long instruction_cnt = instructions.stop();
+        long long syscall_cnt = syscalls.stop();
+        long long io_end = io_syscalls();
+
+        ns.push_back( ( double )( end - begin ) / bench->m_ops );
+        if( syscall_cnt >= 0 )
+        {
+            sys.push_back( ( double )syscall_cnt / bench->m_ops );
+        }
+        if( instruction_cnt >= 0 )
+        {
+            ins.push_back( ( double )instruction_cnt / bench->m_ops );
+        }
+        if( io_begin >= 0 && io_end >= 0 )
+        {
+            io.push_back( ( double )( io_end - io_begin - 2 ) / bench->m_ops );  // 减去读/proc/self/io本身
+        }
+    }
+    bench->teardown();
+    if( !ok )
+    {
+        fprintf( stderr, "%s %s: run failed\n", bench->m_name, bench->m_param.c_str() );
+        return false;
+    }
+
+    result res;
+    res.m_ns_per_op = median( ns );
+    res.m_syscalls_per_op = median( sys );
+    res.m_instructions_per_op = median( ins );
+    res.m_io_syscalls_per_op = median( io );
+    double best = *std::min_element( ns.begin(), ns.end() );
+
+    printf( "%-14s %-14s %10.1f %10.1f %12s %12s %12s\n", bench->m_name, bench->m_param.c_str(), res.m_ns_per_op, best,
+            column( res.m_syscalls_per_op, "%.2f" ).c_str(), column( res.m_instructions_per_op, "%.1f" ).c_str(),
+            column( res.m_io_syscalls_per_op, "%.2f" ).c_str() );
+    fprintf( out, "{\"name\":\"%s\",\"param\":\"%s\",\"ops\":%d,\"reps\":%d", bench->m_name, bench->m_param.c_str(), bench->m_ops, reps );
+    print_value( out, "ns_per_op", res.m_ns_per_op );
+    print_value( out, "ns_per_op_min", best );
+    print_value( out, "syscalls_per_op", res.m_syscalls_per_op );
+    print_value( out, "instructions_per_op", res.m_instructions_per_op );
+    print_value( out, "io_syscalls_per_op", res.m_io_syscalls_per_op );
+    fprintf( out, "}\n" );
+    return true;
+}
+
+int main( int argc, char* argv[] )
+{
+    const char* output = "micro.jsonl";
+    const char* filter = NULL;
+    int reps = 5;
+    double scale = 1;
+    int opt;
+    while( ( opt = getopt( argc, argv, "o:r:s:f:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+            case 'o': output = optarg; break;
+            case 'r': reps = atoi( optarg ); break;
+            case 's': scale = atof( optarg ); break;
+            case 'f': filter = optarg; break;
+            default:
+                fprintf( stderr, "usage: %s [-o output] [-r repetitions] [-s scale] [-f filter]\n", argv[0] );
+                return 1;
+        }
+    }
+    if( reps <= 0 || scale <= 0 )
+    {
+        fprintf( stderr, "usage: %s [-o output] [-r repetitions] [-s scale] [-f filter]\n", argv[0] );
+        return 1;
+    }
+    set_loglevel( LOG_CRIT );   // mgr的info日志会干扰计时
+    signal( SIGPIPE, SIG_IGN );
+
+    // mgr_dispatch每个连接占用3个fd
+    struct rlimit limit;
+    if( getrlimit( RLIMIT_NOFILE, &limit ) == 0 && limit.rlim_cur < limit.rlim_max )
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit( RLIMIT_NOFILE, &limit );
+    }
+    int max_conns = getrlimit( RLIMIT_NOFILE, &limit ) == 0 ? ( int )( ( limit.rlim_cur - 64 ) / 3 ) : 256;
+
+    FILE* out = fopen( output, "w" );
+    if( !out )
+    {
+        fprintf( stderr, "open %s failed: %s\n", output, strerror( errno ) );
+        return 1;
+    }
+
+    perf_counter syscalls( PERF_TYPE_TRACEPOINT, syscall_tracepoint() );
+    perf_counter instructions( PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS );
+
+    vector< micro_bench* > benches;
+    int sizes[] = { 2048, 16384, 65536 };
+    for( int i = 0; i < 3; ++i )
+    {
+        benches.push_back( new relay_bench( sizes[i], false, 20000 * scale ) );
+    }
+    for( int i = 0; i < 3; ++i )
+    {
+        benches.push_back( new relay_bench( sizes[i], true, 20000 * scale ) );
+    }
+    int conns[] = { 16, 256, 4096 };
+    for( int i = 0; i < 3; ++i )
+    {
+        if( conns[i] <= max_conns )
+        {
+            benches.push_back( new dispatch_bench( conns[i], 50000 * scale ) );
+        }
+    }
+    benches.push_back( new churn_bench( 64, 5000 * scale ) );
+
+    printf( "%-14s %-14s %10s %10s %12s %12s %12s\n", "name", "param", "ns/op", "min_ns/op", "syscalls/op", "instr/op", "io_sys/op" );
+    for( int i = 0; i < ( int )benches.size(); ++i )
+    {
+        if( !filter || strstr( benches[i]->m_name, filter ) )
+        {
+            measure( benches[i], reps, syscalls, instructions, out );
+        }
+        delete benches[i];
+    }
+    fclose( out );
+    printf( "results written to %s\n", output );
+    return 0;
+}
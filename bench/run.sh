@@ -0,0 +1,84 @@
+#!/bin/sh
+# 在回环地址上运行基准测试的场景矩阵，输出可以直接对比的报告
+# 用法: bench/run.sh [每个场景的秒数]    (make bench 会先编译再调用)
+# 环境变量: WORKERS 子进程数 (默认与CPU核数相同)，CONNS 每个子进程到每个后端的连接数 (默认256)，
+#           THREADS 负载生成器的线程数 (默认与CPU核数相同)，DIRECT=1 同时直连后端测一遍作为基线，KEEPALIVE=on 开启后端连接复用，
+#           MODE=http 按请求转发，ENGINE=uring 使用io_uring事件引擎
+set -e
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$DIR")
+DURATION=${1:-10}
+WORKERS=${WORKERS:-0}
+CONNS=${CONNS:-256}
+THREADS=${THREADS:-$(getconf _NPROCESSORS_ONLN)}
+KEEPALIVE=${KEEPALIVE:-off}
+MODE=${MODE:-tcp}
+ENGINE=${ENGINE:-epoll}
+
+PORT=18480
+BACKEND1=18481
+BACKEND2=18482
+ADMIN=18489
+TMP=$(mktemp -d)
+
+cleanup()
+{
+    [ -n "$PROXY" ] && kill "$PROXY" 2>/dev/null && wait "$PROXY" 2>/dev/null
+    [ -n "$BACKEND" ] && kill "$BACKEND" 2>/dev/null
+    rm -rf "$TMP"
+}
+trap cleanup EXIT INT TERM
+
+cat > "$TMP/config.xml" <<EOF
+Listen 127.0.0.1:$PORT
+<workers>$WORKERS</workers>
+<mode>$MODE</mode>
+<engine>$ENGINE</engine>
+<admin>127.0.0.1:$ADMIN</admin>
+<logical_host>
+  <name>127.0.0.1</name>
+  <port>$BACKEND1</port>
+  <conns>$CONNS</conns>
+  <bufsize>65536</bufsize>
+  <keepalive>$KEEPALIVE</keepalive>
+</logical_host>
+<logical_host>
+  <name>127.0.0.1</name>
+  <port>$BACKEND2</port>
+  <conns>$CONNS</conns>
+  <bufsize>65536</bufsize>
+  <keepalive>$KEEPALIVE</keepalive>
+</logical_host>
+EOF
+
+"$DIR/backend" -m http -t "$THREADS" $BACKEND1 $BACKEND2 &
+BACKEND=$!
+"$ROOT/springsnail" -f "$TMP/config.xml" -l "$TMP/springsnail.log" &
+PROXY=$!
+sleep 1
+
+echo "springsnail $(git -C "$ROOT" rev-parse --short HEAD 2>/dev/null || echo unknown), $(getconf _NPROCESSORS_ONLN) cpus, ${DURATION}s per scenario"
+printf "%-18s %6s %9s %9s %7s %11s %8s %9s %9s %9s\n" scenario conns connects requests errors rps gbit/s p50_ms p99_ms p999_ms
+
+# 场景: 名称 负载生成器参数
+run()
+{
+    name=$1
+    shift
+    "$DIR/loadgen" -n "$name" -p $PORT -t "$THREADS" -d "$DURATION" "$@" || true
+    if [ -n "$DIRECT" ]; then
+        "$DIR/loadgen" -n "$name-direct" -p $BACKEND1 -t "$THREADS" -d "$DURATION" "$@" || true
+    fi
+}
+
+run small       -c 64  -s 64      -k 0                 # 小请求，长连接
+run small-post  -c 64  -s 64      -q 4096 -k 0         # 带4KB请求体的小请求
+run bulk        -c 8   -s 1048576 -k 0                 # 1MB下载
+run bulk-many   -c 128 -s 65536   -k 0                 # 大量并发的64KB下载
+run storm       -c 128 -s 64      -k 1                 # 每个请求一个新连接
+run storm-rate  -c 128 -s 64      -k 1 -r 2000         # 新建连接限速2000/s，看尾延迟
+
+if command -v curl > /dev/null 2>&1; then
+    curl -s "http://127.0.0.1:$ADMIN/metrics" | grep -E '^springsnail_(pick_failures|backend_connect_failures|backend_reuses)_total' | awk '{ sum[$1 ~ /pick/ ? "pick_failures" : $1 ~ /reuses/ ? "backend_reuses" : "connect_failures"] += $2 } END { for( k in sum ) printf "%s %d\n", k, sum[k] }'
+fi
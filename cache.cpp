@@ -0,0 +1,349 @@
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "cache.h"
+#include "arena.h"
+#include "log.h"
+
+using std::string;
+
+static long long monotonic_msec()
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );     // 所有进程共用同一个时钟
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// FNV-1a
+static unsigned int hash_key( const char* key, int len )
+{
+    unsigned int hash = 2166136261u;
+    for( int i = 0; i < len; ++i )
+    {
+        hash = ( hash ^ ( unsigned char )key[i] ) * 16777619u;
+    }
+    return hash;
+}
+
+http_cache::~http_cache()
+{
+    if( m_header )
+    {
+        munmap( m_header, m_size );
+    }
+}
+
+/*
+每个块连同它的条目、块链接与最多两个桶一起计算，块数由budget决定
+匿名映射只有写入过的页才分配物理内存，块区域按实际缓存的数据量增长
+*/
+bool http_cache::init( size_t budget, int max_object )
+{
+    size_t per_chunk = CHUNK + sizeof( cache_entry ) + sizeof( int ) + 2 * sizeof( int );
+    if( budget < sizeof( cache_header ) + per_chunk * 16 )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "cache size %lu is too small", ( unsigned long )budget );
+        return false;
+    }
+    int chunks = ( budget - sizeof( cache_header ) ) / per_chunk;
+    int buckets = 1;
+    while( buckets < chunks )
+    {
+        buckets <<= 1;
+    }
+    size_t size = sizeof( cache_header ) + sizeof( int ) * buckets + sizeof( cache_entry ) * chunks + sizeof( int ) * chunks
+                  + ( size_t )CHUNK * chunks;
+    void* mem = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if( mem == MAP_FAILED )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "create http cache failed: %s", strerror( errno ) );
+        return false;
+    }
+    m_header = ( cache_header* )mem;
+    m_buckets = ( int* )( m_header + 1 );
+    m_entries = ( cache_entry* )( m_buckets + buckets );
+    m_chunk_next = ( int* )( m_entries + chunks );
+    m_data = ( char* )( m_chunk_next + chunks );
+    m_size = size;
+    m_max_object = max_object;
+    m_header->m_buckets = buckets;
+    m_header->m_chunks = chunks;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_setpshared( &attr, PTHREAD_PROCESS_SHARED );
+    pthread_mutexattr_setrobust( &attr, PTHREAD_MUTEX_ROBUST );
+    int ret = pthread_mutex_init( &m_header->m_lock, &attr );
+    pthread_mutexattr_destroy( &attr );
+    if( ret != 0 )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "init http cache lock failed: %s", strerror( ret ) );
+        munmap( mem, size );
+        m_header = NULL;
+        return false;
+    }
+    clear();
+    return true;
+}
+
+bool http_cache::lock()
+{
+    int ret = pthread_mutex_lock( &m_header->m_lock );
+    if( ret == EOWNERDEAD )
+    {
+        // 上一个持有者在修改索引的中途退出，索引可能不完整，整个丢弃
+        log( LOG_ERR, __FILE__, __LINE__, "%s", "http cache lock owner died, cache cleared" );
+        clear();
+        pthread_mutex_consistent( &m_header->m_lock );
+        return true;
+    }
+    return ret == 0;
+}
+
+void http_cache::unlock()
+{
+    pthread_mutex_unlock( &m_header->m_lock );
+}
+
+void http_cache::clear()
+{
+    int chunks = m_header->m_chunks;
+    memset( m_buckets, -1, sizeof( int ) * m_header->m_buckets );
+    for( int i = 0; i < chunks; ++i )
+    {
+        m_entries[i].m_hash_next = i + 1 < chunks ? i + 1 : -1;
+        m_chunk_next[i] = i + 1 < chunks ? i + 1 : -1;
+    }
+    m_header->m_free_chunk = 0;
+    m_header->m_free_chunks = chunks;
+    m_header->m_free_entry = 0;
+    m_header->m_entries = 0;
+    m_header->m_lru_head = -1;
+    m_header->m_lru_tail = -1;
+    m_header->m_bytes = 0;
+}
+
+int http_cache::find( unsigned int hash, const char* key, int key_len )
+{
+    int idx = m_buckets[ hash & ( m_header->m_buckets - 1 ) ];
+    while( idx >= 0 )
+    {
+        const cache_entry& entry = m_entries[ idx ];
+        if( entry.m_hash == hash && entry.m_key_len == key_len && memcmp( chunk( entry.m_chunk ), key, key_len ) == 0 )
+        {
+            return idx;
+        }
+        idx = entry.m_hash_next;
+    }
+    return -1;
+}
+
+// 从桶与LRU链表中摘除，块与条目放回空闲链表
+void http_cache::remove( int idx )
+{
+    cache_entry& entry = m_entries[ idx ];
+    int* link = &m_buckets[ entry.m_hash & ( m_header->m_buckets - 1 ) ];
+    while( *link != idx )
+    {
+        link = &m_entries[ *link ].m_hash_next;
+    }
+    *link = entry.m_hash_next;
+
+    if( entry.m_lru_prev >= 0 )
+    {
+        m_entries[ entry.m_lru_prev ].m_lru_next = entry.m_lru_next;
+    }
+    else
+    {
+        m_header->m_lru_head = entry.m_lru_next;
+    }
+    if( entry.m_lru_next >= 0 )
+    {
+        m_entries[ entry.m_lru_next ].m_lru_prev = entry.m_lru_prev;
+    }
+    else
+    {
+        m_header->m_lru_tail = entry.m_lru_prev;
+    }
+
+    int last = entry.m_chunk;
+    int count = 1;
+    while( m_chunk_next[ last ] >= 0 )
+    {
+        last = m_chunk_next[ last ];
+        ++count;
+    }
+    m_chunk_next[ last ] = m_header->m_free_chunk;
+    m_header->m_free_chunk = entry.m_chunk;
+    m_header->m_free_chunks += count;
+
+    entry.m_hash_next = m_header->m_free_entry;
+    m_header->m_free_entry = idx;
+    --m_header->m_entries;
+    m_header->m_bytes -= entry.m_len;
+}
+
+void http_cache::copy( int idx, int offset, char* dst, const char* src, int len )
+{
+    while( offset >= CHUNK )
+    {
+        idx = m_chunk_next[ idx ];
+        offset -= CHUNK;
+    }
+    while( len > 0 )
+    {
+        int n = CHUNK - offset < len ? CHUNK - offset : len;
+        if( src )
+        {
+            memcpy( chunk( idx ) + offset, src, n );
+            src += n;
+        }
+        else
+        {
+            memcpy( dst, chunk( idx ) + offset, n );
+            dst += n;
+        }
+        len -= n;
+        offset = 0;
+        idx = m_chunk_next[ idx ];
+    }
+}
+
+/*
+锁只在查找与复制期间持有，复制到调用者的缓冲区之后再写给客户端，客户端写得慢不会阻塞其它子进程
+过期的条目在查找时顺便删除
+*/
+bool http_cache::lookup( const char* key, int key_len, arena_buf& out )
+{
+    unsigned int hash = hash_key( key, key_len );
+    if( !lock() )
+    {
+        return false;
+    }
+    int idx = find( hash, key, key_len );
+    if( idx >= 0 && m_entries[ idx ].m_expires <= monotonic_msec() )
+    {
+        remove( idx );
+        idx = -1;
+    }
+    if( idx < 0 )
+    {
+        ++m_header->m_misses;
+        unlock();
+        return false;
+    }
+
+    cache_entry& entry = m_entries[ idx ];
+    if( m_header->m_lru_head != idx )   // 移到LRU链表头
+    {
+        m_entries[ entry.m_lru_prev ].m_lru_next = entry.m_lru_next;
+        if( entry.m_lru_next >= 0 )
+        {
+            m_entries[ entry.m_lru_next ].m_lru_prev = entry.m_lru_prev;
+        }
+        else
+        {
+            m_header->m_lru_tail = entry.m_lru_prev;
+        }
+        entry.m_lru_prev = -1;
+        entry.m_lru_next = m_header->m_lru_head;
+        m_entries[ m_header->m_lru_head ].m_lru_prev = idx;
+        m_header->m_lru_head = idx;
+    }
+    out.resize( entry.m_len );
+    copy( entry.m_chunk, entry.m_key_len, out.data(), NULL, entry.m_len );
+    ++m_header->m_hits;
+    unlock();
+    return true;
+}
+
+void http_cache::store( const char* key, int key_len, const char* data, int len, int ttl )
+{
+    int need = ( key_len + len + CHUNK - 1 ) / CHUNK;
+    if( ttl <= 0 || len > m_max_object || key_len >= CHUNK || need > m_header->m_chunks / 2 )
+    {
+        return;     // 单个响应最多占一半空间，避免一次存入清空整个缓存
+    }
+    unsigned int hash = hash_key( key, key_len );
+    if( !lock() )
+    {
+        return;
+    }
+    int old = find( hash, key, key_len );
+    if( old >= 0 )
+    {
+        remove( old );
+    }
+    while( m_header->m_free_chunks < need || m_header->m_free_entry < 0 )
+    {
+        remove( m_header->m_lru_tail );
+        ++m_header->m_evictions;
+    }
+
+    int idx = m_header->m_free_entry;
+    cache_entry& entry = m_entries[ idx ];
+    m_header->m_free_entry = entry.m_hash_next;
+    int first = m_header->m_free_chunk;
+    int last = first;
+    for( int i = 1; i < need; ++i )
+    {
+        last = m_chunk_next[ last ];
+    }
+    m_header->m_free_chunk = m_chunk_next[ last ];
+    m_header->m_free_chunks -= need;
+    m_chunk_next[ last ] = -1;
+
+    entry.m_hash = hash;
+    entry.m_key_len = key_len;
+    entry.m_len = len;
+    entry.m_chunk = first;
+    entry.m_expires = monotonic_msec() + ttl * 1000LL;
+    memcpy( chunk( first ), key, key_len );
+    copy( first, key_len, NULL, data, len );
+
+    int* bucket = &m_buckets[ hash & ( m_header->m_buckets - 1 ) ];
+    entry.m_hash_next = *bucket;
+    *bucket = idx;
+    entry.m_lru_prev = -1;
+    entry.m_lru_next = m_header->m_lru_head;
+    if( m_header->m_lru_head >= 0 )
+    {
+        m_entries[ m_header->m_lru_head ].m_lru_prev = idx;
+    }
+    else
+    {
+        m_header->m_lru_tail = idx;
+    }
+    m_header->m_lru_head = idx;
+    ++m_header->m_entries;
+    m_header->m_bytes += len;
+    ++m_header->m_stores;
+    unlock();
+}
+
+// 整个缓存是一份，不按子进程区分
+void http_cache::render( string& out )
+{
+    if( !lock() )
+    {
+        return;
+    }
+    unsigned long long values[] = { m_header->m_hits, m_header->m_misses, m_header->m_stores, m_header->m_evictions,
+                                    ( unsigned long long )m_header->m_entries, m_header->m_bytes };
+    unlock();
+
+    static const char* names[] = { "springsnail_cache_hits_total", "springsnail_cache_misses_total", "springsnail_cache_stores_total",
+                                   "springsnail_cache_evictions_total", "springsnail_cache_entries", "springsnail_cache_bytes" };
+    static const char* helps[] = { "Requests answered from the shared response cache.", "Cacheable requests that were not in the cache or had expired.",
+                                   "Responses stored into the cache.", "Cached responses evicted to make room for new ones.",
+                                   "Responses currently cached.", "Bytes of responses currently cached." };
+    for( int i = 0; i < ( int )( sizeof( values ) / sizeof( values[0] ) ); ++i )
+    {
+        char line[256];
+        snprintf( line, sizeof( line ), "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", names[i], helps[i], names[i], i < 4 ? "counter" : "gauge",
+                  names[i], values[i] );
+        out += line;
+    }
+}
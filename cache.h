@@ -0,0 +1,89 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <string>
+
+class arena_buf;
+
+/*
+缓存中的一个响应，在共享内存的条目表中
+所有链接都是下标(-1表示没有)而不是指针；key与响应的原始字节依次放在一串slab块中，key不会超过第一个块
+*/
+class cache_entry
+{
+public:
+    unsigned int m_hash;
+    int m_key_len;
+    int m_len;              // 响应的字节数
+    int m_chunk;            // 第一个块
+    long long m_expires;    // 过期的时刻(CLOCK_MONOTONIC，毫秒)
+    int m_hash_next;        // 同一个桶中的下一项，空闲时为空闲链表中的下一项
+    int m_lru_prev;         // 更近使用的一项
+    int m_lru_next;         // 更久未使用的一项
+};
+
+// 共享内存的开头，之后依次是桶数组、条目表、块的链接表与块
+class cache_header
+{
+public:
+    pthread_mutex_t m_lock;     // 进程间共享的robust锁
+    int m_buckets;          // 桶的个数 (2的幂)
+    int m_chunks;           // 块的个数，也是条目的个数
+    int m_free_chunk;       // 空闲块链表
+    int m_free_chunks;      // 空闲块的个数
+    int m_free_entry;       // 空闲条目链表
+    int m_entries;          // 缓存的响应个数
+    int m_lru_head;         // 最近使用的一项
+    int m_lru_tail;         // 最久未使用的一项，空间不足时从这里淘汰
+    unsigned long long m_bytes;     // 缓存的响应的总字节数
+    unsigned long long m_hits;
+    unsigned long long m_misses;
+    unsigned long long m_stores;
+    unsigned long long m_evictions;
+};
+
+/*
+PROXY_HTTP模式下所有子进程共享的HTTP响应缓存，与load_table一样在fork之前mmap(MAP_SHARED)，一个子进程存入的响应其它子进程都能命中
+按key(请求目标与Host)的哈希分桶，条目按使用顺序串成LRU链表；响应按块(CHUNK字节)分配，整块区域在启动时一次划分好，运行中不再分配内存
+子进程是不同的进程，索引由一把PTHREAD_PROCESS_SHARED的robust锁保护；持有锁的进程中途退出后，下一个加锁者清空缓存，不会读到改了一半的索引
+*/
+class http_cache
+{
+public:
+    http_cache() : m_header( NULL ), m_size( 0 ), m_max_object( 0 ){}
+    ~http_cache();
+    bool init( size_t budget, int max_object );     // 在fork之前调用，budget为共享内存的总字节数，max_object为单个响应的上限
+    bool enabled() const { return m_header != NULL; }
+
+    // 子进程调用，key为http_parser::m_key
+    bool lookup( const char* key, int key_len, arena_buf& out );    // 命中且没有过期时把响应复制到out
+    void store( const char* key, int key_len, const char* data, int len, int ttl );     // 存入ttl秒内有效的响应，替换同一个key的旧响应
+    int max_object() const { return m_max_object; }
+
+    void render( std::string& out );    // 以Prometheus文本格式输出命中率等计数 (父进程的admin端口)
+
+public:
+    static const int CHUNK = 1024;      // 块的大小，必须大于http_parser::MAX_KEY
+
+private:
+    bool lock();
+    void unlock();
+    void clear();           // 清空所有条目，重建空闲链表
+    int find( unsigned int hash, const char* key, int key_len );
+    void remove( int idx );
+    void copy( int first, int offset, char* dst, const char* src, int len );    // src不为NULL时写入块链，否则从块链读出到dst
+    char* chunk( int idx ) { return m_data + ( size_t )idx * CHUNK; }
+
+private:
+    cache_header* m_header;
+    int* m_buckets;
+    cache_entry* m_entries;
+    int* m_chunk_next;      // 每个块在块链(或空闲链表)中的下一块
+    char* m_data;
+    size_t m_size;          // 共享内存的字节数
+    int m_max_object;
+};
+
+#endif
@@ -1,6 +1,10 @@
 #include <exception>
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
 #include "conn.h"
 #include "log.h"
 #include "fdwrapper.h"
@@ -9,15 +13,37 @@
 首先谁是客户端与服务端：
 理论上：整个环节应该是主机服务器即负载均衡服务器与逻辑服务器连接，然后再使用客户端 (nc localhost 8080) 进行连接
 */
-conn::conn()
+conn::conn( int buf_size, arena* pool ) : m_arena( pool ), m_cache_key( pool ), m_cache_data( pool )
 {
+    m_buf_size = MIN_BUF_SIZE;
+    while( m_buf_size < buf_size )  // 环形缓冲区按2的幂取整，下标取模只需要一次与运算
+    {
+        m_buf_size <<= 1;
+    }
     m_srvfd = -1;
-    m_clt_buf = new char[ BUF_SIZE ];				// 客户端缓冲区
+    m_state = CONN_FREED;
+    m_retry_delay = 0;
+    m_last_active = 0;
+    m_splice = false;
+    m_http = false;
+    m_cache_limit = 0;
+    m_pipe_size = 0;
+    m_clt_pipe[0] = m_clt_pipe[1] = -1;
+    m_srv_pipe[0] = m_srv_pipe[1] = -1;
+    m_clt_pipe_bytes = 0;
+    m_srv_pipe_bytes = 0;
+    m_backend = NULL;
+    m_bytes_read = 0;
+    m_connect_start = 0;
+    m_clt_start = 0;
+    m_prev = NULL;
+    m_next = NULL;
+    m_clt_buf = alloc_buf();				// 客户端缓冲区
     if( !m_clt_buf )
     {
         throw std::exception();
     }
-    m_srv_buf = new char[ BUF_SIZE ];				// 服务端缓冲区
+    m_srv_buf = alloc_buf();				// 服务端缓冲区
     if( !m_srv_buf )
     {
         throw std::exception();
@@ -27,8 +53,84 @@ conn::conn()
 
 conn::~conn()
 {
-    delete [] m_clt_buf;
-    delete [] m_srv_buf;
+    close_pipes();
+    free_buf( m_clt_buf );
+    free_buf( m_srv_buf );
+}
+
+// 优先从内存池分配，内存池用尽时退回到堆
+char* conn::alloc_buf()
+{
+    char* buf = m_arena ? ( char* )m_arena->alloc( m_buf_size ) : NULL;
+    if( !buf )
+    {
+        buf = new char[ m_buf_size ];
+    }
+    return buf;
+}
+
+void conn::free_buf( char* buf )
+{
+    if( m_arena && m_arena->owns( buf ) )
+    {
+        m_arena->release( buf, m_buf_size );
+    }
+    else
+    {
+        delete [] buf;
+    }
+}
+
+/*
+splice转发：数据按 socket -> 管道 -> socket 的路径在内核中移动，不再经过用户态缓冲区
+管道创建失败时保持缓冲区转发
+*/
+bool conn::init_splice()
+{
+    if( !open_pipes() )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "create splice pipes failed, %s, fallback to buffer relay", strerror( errno ) );
+        m_splice = false;
+        return false;
+    }
+    m_splice = true;
+    return true;
+}
+
+bool conn::open_pipes()
+{
+    if( pipe2( m_clt_pipe, O_NONBLOCK ) < 0 )
+    {
+        return false;
+    }
+    if( pipe2( m_srv_pipe, O_NONBLOCK ) < 0 )
+    {
+        close( m_clt_pipe[0] );
+        close( m_clt_pipe[1] );
+        m_clt_pipe[0] = m_clt_pipe[1] = -1;
+        return false;
+    }
+    m_pipe_size = fcntl( m_clt_pipe[1], F_GETPIPE_SZ );
+    m_clt_pipe_bytes = 0;
+    m_srv_pipe_bytes = 0;
+    return true;
+}
+
+void conn::close_pipes()
+{
+    for( int i = 0; i < 2; ++i )
+    {
+        if( m_clt_pipe[i] >= 0 )
+        {
+            close( m_clt_pipe[i] );
+            m_clt_pipe[i] = -1;
+        }
+        if( m_srv_pipe[i] >= 0 )
+        {
+            close( m_srv_pipe[i] );
+            m_srv_pipe[i] = -1;
+        }
+    }
 }
 
 //初始化客户端地址 
@@ -53,107 +155,163 @@ void conn::reset()
     m_srv_read_idx = 0;
     m_srv_write_idx = 0;
     m_srv_closed = false;
-    m_cltfd = -1;
-    memset( m_clt_buf, '\0', BUF_SIZE );    // 重置缓冲区
-    memset( m_srv_buf, '\0', BUF_SIZE );
+    m_req_start = 0;
+    m_http_state.reset();
+    m_cache_key.clear();
+    m_cache_data.clear();
+    m_cltfd = -1;   // 只需重置下标，缓冲区中的旧数据会被后续读入覆盖，不必清零
+    if( m_splice && ( m_clt_pipe_bytes > 0 || m_srv_pipe_bytes > 0 ) )  // 管道中残留的数据属于上一个客户端，直接重建管道丢弃
+    {
+        close_pipes();
+        if( !open_pipes() )
+        {
+            log( LOG_ERR, __FILE__, __LINE__, "recreate splice pipes failed, %s, fallback to buffer relay", strerror( errno ) );
+            m_splice = false;
+        }
+    }
 }
 
-//从客户端读入的信息写入m_clt_buf
-RET_CODE conn::read_clt()
+// 从sockfd搬运数据到管道，返回值与read_clt/read_srv一致
+RET_CODE conn::splice_read( int sockfd, int pipefd, int& pipe_bytes )
 {
     int bytes_read = 0;
     while( true )
     {
-        if( m_clt_read_idx >= BUF_SIZE )			   //如果读入的数据大于BUF_SIZE    	
+        if( pipe_bytes >= m_pipe_size )
         {
-            log( LOG_ERR, __FILE__, __LINE__, "%s", "the client read buffer is full, let server write" );
-            // 信息满了，需要将信息写入服务端
-            // 把从客户端读入m_clt_buf的内容写入服务端 (正常情况)
             return BUFFER_FULL;
         }
 
-        bytes_read = recv( m_cltfd, m_clt_buf + m_clt_read_idx, BUF_SIZE - m_clt_read_idx, 0 );			//因为存在分包的问题（recv所读入的并非是size的大小），因此我们根据recv的返回值进行循环读入，直到读满m_clt_buf或者recv的返回值为0（数据被读完）
+        bytes_read = splice( sockfd, NULL, pipefd, NULL, m_pipe_size - pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
         if ( bytes_read == -1 )
         {
-            if( errno == EAGAIN || errno == EWOULDBLOCK )					// 非阻塞情况下： EAGAIN表示没有数据可读，请尝试再次调用,而在阻塞情况下，如果被中断，则返回EINTR;  EWOULDBLOCK等同于EAGAIN
+            // 管道写满时同样返回EAGAIN，写端清空后modfd重新触发ET事件即可继续读
+            if( errno == EAGAIN || errno == EWOULDBLOCK )
             {
                 break;
             }
             return IOERR;
         }
-        else if ( bytes_read == 0 )  //连接被关闭
+        else if ( bytes_read == 0 )
         {
             return CLOSED;
         }
 
-        m_clt_read_idx += bytes_read;   //移动读下标
+        pipe_bytes += bytes_read;
+        m_bytes_read += bytes_read;
     }
-    return ( ( m_clt_read_idx - m_clt_write_idx ) > 0 ) ? OK : NOTHING;     //当读下标大于写下标时代表正常
+    return ( pipe_bytes > 0 ) ? OK : NOTHING;
 }
 
-//从服务端读入的信息写入m_srv_buf
-RET_CODE conn::read_srv()
+// 把管道中的数据搬运到sockfd，返回值与write_clt/write_srv一致
+RET_CODE conn::splice_write( int pipefd, int sockfd, int& pipe_bytes )
+{
+    int bytes_write = 0;
+    while( true )
+    {
+        if( pipe_bytes <= 0 )
+        {
+            pipe_bytes = 0;
+            return BUFFER_EMPTY;
+        }
+
+        bytes_write = splice( pipefd, NULL, sockfd, NULL, pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+        if ( bytes_write == -1 )
+        {
+            if( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                return TRY_AGAIN;
+            }
+            log( LOG_ERR, __FILE__, __LINE__, "splice to socket failed, %s", strerror( errno ) );
+            return IOERR;
+        }
+        else if ( bytes_write == 0 )
+        {
+            return CLOSED;
+        }
+
+        pipe_bytes -= bytes_write;
+    }
+}
+
+/*
+从sockfd读入环形缓冲区buf，返回值含义与read_clt/read_srv一致
+read_idx与write_idx是只增不减的计数，实际位置为对m_buf_size取模 (m_buf_size为2的幂，计数溢出回绕后依然正确)
+空闲空间跨越缓冲区末尾时用readv一次读入两段，不需要额外的系统调用
+*/
+RET_CODE conn::ring_read( int sockfd, char* buf, unsigned int& read_idx, unsigned int write_idx )
 {
     int bytes_read = 0;
     while( true )
     {
-        if( m_srv_read_idx >= BUF_SIZE )
+        unsigned int used = read_idx - write_idx;
+        if( used >= ( unsigned int )m_buf_size )
         {
-            log( LOG_ERR, __FILE__, __LINE__, "%s", "the server read buffer is full, let client write" );
-            // 信息满了
-            // 服务端读入m_srv_buf的内容写入客户端 (正常情况)
             return BUFFER_FULL;
         }
 
-        /*
-        //因为存在分包的问题（recv所读入的并非是size的大小），
-        因此我们根据recv的返回值进行循环读入，直到读满m_clt_buf或者recv的返回值为0（数据被读完）
-        */
-        bytes_read = recv( m_srvfd, m_srv_buf + m_srv_read_idx, BUF_SIZE - m_srv_read_idx, 0 );
+        unsigned int pos = read_idx & ( m_buf_size - 1 );
+        unsigned int space = m_buf_size - used;
+        unsigned int tail = m_buf_size - pos;
+        struct iovec iov[2];
+        iov[0].iov_base = buf + pos;
+        iov[0].iov_len = ( space < tail ) ? space : tail;
+        iov[1].iov_base = buf;
+        iov[1].iov_len = space - iov[0].iov_len;
+
+        //因为存在分包的问题（readv所读入的并非是space的大小），因此我们根据readv的返回值进行循环读入，直到读满缓冲区或者readv的返回值为0（数据被读完）
+        bytes_read = readv( sockfd, iov, iov[1].iov_len > 0 ? 2 : 1 );
         if ( bytes_read == -1 )
         {
-            if( errno == EAGAIN || errno == EWOULDBLOCK )
+            if( errno == EAGAIN || errno == EWOULDBLOCK )					// 非阻塞情况下： EAGAIN表示没有数据可读，请尝试再次调用,而在阻塞情况下，如果被中断，则返回EINTR;  EWOULDBLOCK等同于EAGAIN
             {
                 break;
             }
             return IOERR;
         }
-        else if ( bytes_read == 0 )
+        else if ( bytes_read == 0 )  //连接被关闭
         {
-            log( LOG_ERR, __FILE__, __LINE__, "%s", "the server should not close the persist connection" );
             return CLOSED;
         }
 
-        m_srv_read_idx += bytes_read;
+        read_idx += bytes_read;   //移动读下标
+        m_bytes_read += bytes_read;
     }
-    return ( ( m_srv_read_idx - m_srv_write_idx ) > 0 ) ? OK : NOTHING;
+    return ( ( read_idx - write_idx ) > 0 ) ? OK : NOTHING;     //当读下标大于写下标时代表正常
 }
 
-// 客户端读入m_clt_buf的内容写入服务端
-RET_CODE conn::write_srv()
+/*
+把环形缓冲区buf中的内容写入sockfd，返回值含义与write_clt/write_srv一致
+*/
+RET_CODE conn::ring_write( int sockfd, char* buf, unsigned int& read_idx, unsigned int& write_idx )
 {
     int bytes_write = 0;
     while( true )
     {
-        /*
-        正常情况下，缓冲区写满才会进行发送，因此应该是read_idx >= wirte_idx，结合send函数中第三个参数理解
-        当 read_idx <= write_idx 代表缓冲区为空了
-        */
-        if( m_clt_read_idx <= m_clt_write_idx )
+        //当 read_idx == write_idx 代表缓冲区为空了，此时把下标拉回0，让后续的数据尽量不跨越缓冲区末尾
+        unsigned int used = read_idx - write_idx;
+        if( used == 0 )
         {
-            m_clt_read_idx = 0;
-            m_clt_write_idx = 0;
+            read_idx = 0;
+            write_idx = 0;
             return BUFFER_EMPTY;    
         }
 
-        bytes_write = send( m_srvfd, m_clt_buf + m_clt_write_idx, m_clt_read_idx - m_clt_write_idx, 0 );
+        unsigned int pos = write_idx & ( m_buf_size - 1 );
+        unsigned int tail = m_buf_size - pos;
+        struct iovec iov[2];
+        iov[0].iov_base = buf + pos;
+        iov[0].iov_len = ( used < tail ) ? used : tail;
+        iov[1].iov_base = buf;
+        iov[1].iov_len = used - iov[0].iov_len;
+
+        bytes_write = writev( sockfd, iov, iov[1].iov_len > 0 ? 2 : 1 );
         if ( bytes_write == -1 )    // 发送过程出现错误
         {
             if( errno == EAGAIN || errno == EWOULDBLOCK )
             {
                 return TRY_AGAIN;
             }
-            log( LOG_ERR, __FILE__, __LINE__, "write server socket failed, %s", strerror( errno ) );
             return IOERR;
         }
         else if ( bytes_write == 0 )
@@ -161,40 +319,156 @@ RET_CODE conn::write_srv()
             return CLOSED;  // 发送完毕
         }
 
-        m_clt_write_idx += bytes_write;
+        write_idx += bytes_write;
     }
 }
 
-//把从服务端读入m_srv_buf的内容写入客户端
-RET_CODE conn::write_clt()
+// 新读入的数据可能跨越缓冲区末尾，分成两段在原地解析，不拷贝
+void conn::track( const char* buf, unsigned int begin, unsigned int end, bool request )
 {
-    int bytes_write = 0;
-    while( true )
+    while( begin != end )
     {
-        /*
-        //此处为一个循环写入,防止分包引起的问题,当写指针>读指针的时候说明已经将buffer内的数据完全写入sockfd当中
-        */
-        if( m_srv_read_idx <= m_srv_write_idx )  
+        unsigned int pos = begin & ( m_buf_size - 1 );
+        unsigned int len = end - begin;
+        if( len > m_buf_size - pos )
         {
-            m_srv_read_idx = 0;
-            m_srv_write_idx = 0;
-            return BUFFER_EMPTY;
+            len = m_buf_size - pos;
         }
-
-        bytes_write = send( m_cltfd, m_srv_buf + m_srv_write_idx, m_srv_read_idx - m_srv_write_idx, 0 );
-        if ( bytes_write == -1 )
+        if( request )
         {
-            if( errno == EAGAIN || errno == EWOULDBLOCK )
+            m_http_state.on_request( buf + pos, len );
+        }
+        else
+        {
+            m_http_state.on_response( buf + pos, len );
+            if( !m_cache_key.empty() )
             {
-                return TRY_AGAIN;
+                if( m_cache_data.size() + len > ( size_t )m_cache_limit )
+                {
+                    m_cache_key.clear();
+                    m_cache_data.clear();
+                }
+                else
+                {
+                    m_cache_data.append( buf + pos, len );
+                }
             }
-            log( LOG_ERR, __FILE__, __LINE__, "write client socket failed, %s", strerror( errno ) );
-            return IOERR;
         }
-        else if ( bytes_write == 0 )
+        begin += len;
+    }
+}
+
+//从客户端读入的信息写入m_clt_buf
+RET_CODE conn::read_clt()
+{
+    if( m_splice )
+    {
+        return splice_read( m_cltfd, m_clt_pipe[1], m_clt_pipe_bytes );
+    }
+
+    unsigned int begin = m_clt_read_idx;
+    RET_CODE res = ring_read( m_cltfd, m_clt_buf, m_clt_read_idx, m_clt_write_idx );
+    if( m_http )
+    {
+        track( m_clt_buf, begin, m_clt_read_idx, true );
+    }
+    if( res == BUFFER_FULL )
+    {
+        // 信息满了，需要将信息写入服务端
+        // 把从客户端读入m_clt_buf的内容写入服务端 (正常情况)
+        log_debug( "%s", "the client read buffer is full, let server write" );
+    }
+    return res;
+}
+
+//从服务端读入的信息写入m_srv_buf
+RET_CODE conn::read_srv()
+{
+    if( m_splice )
+    {
+        RET_CODE res = splice_read( m_srvfd, m_srv_pipe[1], m_srv_pipe_bytes );
+        if( res == CLOSED )
         {
-            return CLOSED;
+            log( LOG_ERR, __FILE__, __LINE__, "%s", "the server should not close the persist connection" );
         }
-        m_srv_write_idx += bytes_write;
+        return res;
+    }
+
+    unsigned int begin = m_srv_read_idx;
+    RET_CODE res = ring_read( m_srvfd, m_srv_buf, m_srv_read_idx, m_srv_write_idx );
+    if( m_http )
+    {
+        track( m_srv_buf, begin, m_srv_read_idx, false );
+    }
+    if( res == BUFFER_FULL )
+    {
+        // 信息满了
+        // 服务端读入m_srv_buf的内容写入客户端 (正常情况)
+        log_debug( "%s", "the server read buffer is full, let client write" );
+    }
+    else if( res == CLOSED )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "%s", "the server should not close the persist connection" );
+    }
+    return res;
+}
+
+// 客户端读入m_clt_buf的内容写入服务端
+RET_CODE conn::write_srv()
+{
+    if( m_splice )
+    {
+        return splice_write( m_clt_pipe[0], m_srvfd, m_clt_pipe_bytes );
+    }
+
+    RET_CODE res = ring_write( m_srvfd, m_clt_buf, m_clt_read_idx, m_clt_write_idx );
+    if( res == IOERR )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "write server socket failed, %s", strerror( errno ) );
+    }
+    return res;
+}
+
+//把从服务端读入m_srv_buf的内容写入客户端
+RET_CODE conn::write_clt()
+{
+    if( m_splice )
+    {
+        return splice_write( m_srv_pipe[0], m_cltfd, m_srv_pipe_bytes );
+    }
+
+    RET_CODE res = ring_write( m_cltfd, m_srv_buf, m_srv_read_idx, m_srv_write_idx );
+    if( res == IOERR )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "write client socket failed, %s", strerror( errno ) );
+    }
+    return res;
+}
+
+// 客户端缓冲区(或管道)中尚未写入服务端的字节数
+int conn::clt_pending() const
+{
+    return m_splice ? m_clt_pipe_bytes : ( int )( m_clt_read_idx - m_clt_write_idx );
+}
+
+// 服务端缓冲区(或管道)中尚未写入客户端的字节数
+int conn::srv_pending() const
+{
+    return m_splice ? m_srv_pipe_bytes : ( int )( m_srv_read_idx - m_srv_write_idx );
+}
+
+/*
+服务端连接可以复用的条件：客户端的请求都已写给服务端并收到了完整的响应，服务端没有关闭连接，
+双方都没有要求关闭，socket中也没有多余的数据 (MSG_PEEK不会取走数据)
+缓冲区中还没写给客户端的响应属于已经离开的客户端，复用时直接丢弃
+*/
+bool conn::srv_reusable() const
+{
+    if( !m_http || m_srv_closed || clt_pending() > 0 || !m_http_state.idle() )
+    {
+        return false;
     }
+    char byte;
+    int ret = recv( m_srvfd, &byte, 1, MSG_PEEK | MSG_DONTWAIT );
+    return ret < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK );
 }
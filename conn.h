@@ -3,6 +3,20 @@
 
 #include <arpa/inet.h>
 #include "fdwrapper.h"
+#include "arena.h"
+#include "timer.h"
+#include "http.h"
+
+/*
+conn在mgr中的状态，同时决定它所在的链表以及m_timer的含义
+CONN_FREED: 服务端连接已关闭，在m_freed中等待重新连接
+CONN_CONNECTING: 正在与服务端建立连接，在m_connecting中
+CONN_READY: 与服务端的连接已建立，在m_conns中等待分配给客户端
+CONN_USED: 已与客户端绑定，在m_used中
+*/
+enum CONN_STATE { CONN_FREED = 0, CONN_CONNECTING, CONN_READY, CONN_USED };
+
+class backend;
 
 /*
 这个类主要负责连接好之后对客户端和服务端的读写操作，以及返回服务端的状态
@@ -10,7 +24,7 @@
 class conn
 {
 public:
-    conn();
+    conn( int buf_size = BUF_SIZE, arena* pool = NULL );    //buf_size为每个方向环形缓冲区的大小，pool不为空时缓冲区从pool中分配
     ~conn();
     void init_clt( int sockfd, const sockaddr_in& client_addr );			//初始化客户端地址 
     void init_srv( int sockfd, const sockaddr_in& server_addr );			//初始化服务器端地址
@@ -19,23 +33,66 @@ public:
     RET_CODE write_clt();   //把从服务端读入m_srv_buf的内容写入客户端
     RET_CODE read_srv();    //从服务端读入的信息写入m_srv_buf
     RET_CODE write_srv();   //把从客户端读入m_clt_buf的内容写入服务端
+    bool init_splice();     //创建splice转发所需的管道，失败时退回到缓冲区转发
+    int clt_pending() const;    //客户端发来但尚未写入服务端的字节数
+    int srv_pending() const;    //服务端发来但尚未写入客户端的字节数
+    bool srv_reusable() const;  //服务端连接是否停在两次HTTP交互之间，可以交给下一个客户端
+
+private:
+    char* alloc_buf();      //分配一个m_buf_size大小的缓冲区
+    void free_buf( char* buf );
+    bool open_pipes();      //创建两个方向的管道
+    void close_pipes();     //关闭两个方向的管道
+    RET_CODE splice_read( int sockfd, int pipefd, int& pipe_bytes );     //socket -> 管道
+    RET_CODE splice_write( int pipefd, int sockfd, int& pipe_bytes );    //管道 -> socket
+    RET_CODE ring_read( int sockfd, char* buf, unsigned int& read_idx, unsigned int write_idx );     //socket -> 环形缓冲区
+    RET_CODE ring_write( int sockfd, char* buf, unsigned int& read_idx, unsigned int& write_idx );   //环形缓冲区 -> socket
+    void track( const char* buf, unsigned int begin, unsigned int end, bool request );  //把环形缓冲区中新读入的[begin, end)交给m_http_state
 
 public:
-    static const int BUF_SIZE = 2048;  //缓冲区大小
+    static const int BUF_SIZE = 2048;  //默认缓冲区大小，可由config.xml中的<bufsize>指定
+    static const int MIN_BUF_SIZE = 1024;  //缓冲区大小的下限
 
-    char* m_clt_buf;    //客户端文件缓冲区
-    int m_clt_read_idx; //客户端读下标
-    int m_clt_write_idx;    //客户端写下标
+    arena* m_arena;     //缓冲区所在的内存池，为NULL时使用堆
+    int m_buf_size;     //每个环形缓冲区的大小 (2的幂)
+    char* m_clt_buf;    //客户端环形缓冲区
+    unsigned int m_clt_read_idx; //客户端读下标
+    unsigned int m_clt_write_idx;    //客户端写下标
     sockaddr_in m_clt_address;				//客户端地址
     int m_cltfd;    //客户端fd
 
-    char* m_srv_buf;        //服务端文件缓冲区
-    int m_srv_read_idx;     //服务端读下标
-    int m_srv_write_idx;    //服务端写下标
+    char* m_srv_buf;        //服务端环形缓冲区
+    unsigned int m_srv_read_idx;     //服务端读下标
+    unsigned int m_srv_write_idx;    //服务端写下标
     sockaddr_in m_srv_address;      //服务端地址
     int m_srvfd;            //服务端fd
 
     bool m_srv_closed;
+    int m_state;            //CONN_STATE
+    timer m_timer;          //连接超时、重连退避、空闲超时共用的定时器
+    int m_retry_delay;      //上一次重连的退避时间(毫秒)，连接成功后清零
+    unsigned long long m_last_active;   //最近一次有数据的时刻(时间轮tick)
+    unsigned int m_bytes_read;  //两个方向读入的字节数，由mgr取走后清零
+    long long m_req_start;  //请求写入服务端、还没等到服务端响应的时刻(微秒)，0表示没有等待中的请求
+    long long m_connect_start;  //发起服务端连接的时刻(微秒)
+    long long m_clt_start;  //客户端分配到该连接的时刻(微秒)
+
+    bool m_splice;          //是否使用splice零拷贝转发
+    int m_pipe_size;        //每个管道的容量
+    int m_clt_pipe[2];      //客户端 -> 服务端方向的管道
+    int m_clt_pipe_bytes;   //m_clt_pipe中尚未写入服务端的字节数
+    int m_srv_pipe[2];      //服务端 -> 客户端方向的管道
+    int m_srv_pipe_bytes;   //m_srv_pipe中尚未写入客户端的字节数
+
+    bool m_http;            //是否解析HTTP消息边界 (keep-alive复用服务端连接时需要，只支持缓冲区转发)
+    http_tracker m_http_state;  //两个方向上请求与响应的边界
+    arena_buf m_cache_key;      //PROXY_HTTP模式下本次请求可以缓存时为缓存的key，同时从服务端读入的响应被复制到m_cache_data
+    arena_buf m_cache_data;     //收集中的响应，超过m_cache_limit时放弃 (都从m_arena分配)
+    int m_cache_limit;          //可以缓存的响应的上限 (http_cache::max_object)
+
+    backend* m_backend;     //所属的逻辑服务器
+    conn* m_prev;           //mgr中所在链表(m_conns/m_used/m_freed)的前一个节点
+    conn* m_next;           //mgr中所在链表的后一个节点
 };
 
 #endif
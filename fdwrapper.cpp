@@ -4,6 +4,39 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include "uring.h"
+
+static uring* s_uring = NULL;  // 本进程的io_uring引擎，只接管它所属的epollfd
+
+/*
+io_uring引擎接管epollfd时，epoll_ctl排队到下一次wait_events一起提交，否则直接调用
+closefd的close同样排队，在DEL之后执行，fd号在此之前不会被新连接重新使用
+*/
+void epoll_control( int epollfd, int op, int fd, epoll_event* event )
+{
+    if( s_uring && s_uring->epollfd() == epollfd )
+    {
+        s_uring->ctl( op, fd, event ? event->events : 0 );
+        return;
+    }
+    epoll_ctl( epollfd, op, fd, event );
+}
+
+bool attach_uring( int epollfd )
+{
+    delete s_uring;     // fork之前父进程的引擎，子进程中不再使用
+    s_uring = uring::create( epollfd );
+    return s_uring != NULL;
+}
+
+int wait_events( int epollfd, epoll_event* events, int max, int timeout )
+{
+    if( s_uring && s_uring->epollfd() == epollfd )
+    {
+        return s_uring->wait( events, max, timeout );
+    }
+    return epoll_wait( epollfd, events, max, timeout );
+}
 
 /*
 此处设置非堵塞的原因：每一个使用ET模式的文件描述符都应该是非堵塞的，
@@ -25,7 +58,7 @@ void add_read_fd( int epollfd, int fd )
     epoll_event event;
     event.data.fd = fd;
     event.events = EPOLLIN | EPOLLET;   // 读与ET模式
-    epoll_ctl( epollfd, EPOLL_CTL_ADD, fd, &event );
+    epoll_control( epollfd, EPOLL_CTL_ADD, fd, &event );
     setnonblocking( fd );
 }
 
@@ -37,21 +70,37 @@ void add_write_fd( int epollfd, int fd )
     epoll_event event;
     event.data.fd = fd;
     event.events = EPOLLOUT | EPOLLET;  // 写与ET模式
-    epoll_ctl( epollfd, EPOLL_CTL_ADD, fd, &event );
+    epoll_control( epollfd, EPOLL_CTL_ADD, fd, &event );
     setnonblocking( fd );
 }
 
 // 删除fd上的注册事件，并关闭fd
 void closefd( int epollfd, int fd )
 {
-    epoll_ctl( epollfd, EPOLL_CTL_DEL, fd, 0 );
+    if( s_uring && s_uring->epollfd() == epollfd )
+    {
+        s_uring->del_close( fd );
+        return;
+    }
+    epoll_control( epollfd, EPOLL_CTL_DEL, fd, 0 );
+    close( fd );
+}
+
+// removefd排队的DEL还没有提交时直接close，DEL会失败或落在重新分配了同一个号的fd上
+void close_queued( int epollfd, int fd )
+{
+    if( s_uring && s_uring->epollfd() == epollfd )
+    {
+        s_uring->queue_close( fd );
+        return;
+    }
     close( fd );
 }
 
 // 删除fd上的注册事件，但不关闭fd
 void removefd( int epollfd, int fd )
 {
-    epoll_ctl( epollfd, EPOLL_CTL_DEL, fd, 0 );
+    epoll_control( epollfd, EPOLL_CTL_DEL, fd, 0 );
 }
 
 // 修改fd上的注册事件ev
@@ -60,7 +109,7 @@ void modfd( int epollfd, int fd, int ev )
     epoll_event event;
     event.data.fd = fd;
     event.events = ev | EPOLLET;
-    epoll_ctl( epollfd, EPOLL_CTL_MOD, fd, &event );
+    epoll_control( epollfd, EPOLL_CTL_MOD, fd, &event );
 }
 
 #endif
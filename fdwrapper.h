@@ -4,11 +4,17 @@
 enum RET_CODE { OK = 0, NOTHING = 1, IOERR = -1, CLOSED = -2, BUFFER_FULL = -3, BUFFER_EMPTY = -4, TRY_AGAIN };
 enum OP_TYPE { READ = 0, WRITE, ERROR };    // 三种操作
 
+struct epoll_event;
+
 int setnonblocking( int fd );
 void add_read_fd( int epollfd, int fd );
 void add_write_fd( int epollfd, int fd );
 void removefd( int epollfd, int fd );
 void closefd( int epollfd, int fd );
+void close_queued( int epollfd, int fd );   // 关闭已经removefd的fd，使用io_uring引擎时排在之前排队的EPOLL_CTL_DEL之后
 void modfd( int epollfd, int fd, int ev );
+void epoll_control( int epollfd, int op, int fd, epoll_event* event );  // epoll_ctl，使用io_uring引擎时排队
+bool attach_uring( int epollfd );   // 之后epollfd上的注册与等待都经过io_uring，内核不支持时返回false，继续使用epoll
+int wait_events( int epollfd, epoll_event* events, int max, int timeout );  // 与epoll_wait相同
 
 #endif
@@ -0,0 +1,208 @@
+#include <sys/socket.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "health.h"
+#include "log.h"
+
+bool health_conf::same( const health_conf& other ) const
+{
+    return m_check == other.m_check && strcmp( m_path, other.m_path ) == 0 && m_interval == other.m_interval && m_timeout == other.m_timeout
+           && m_fall == other.m_fall && m_rise == other.m_rise && m_eject_time == other.m_eject_time && m_slow_start == other.m_slow_start;
+}
+
+host_health::host_health( int epollfd, timer_wheel* wheel, const health_conf& conf, const char* hostname, const sockaddr_in& address )
+    : m_epollfd( epollfd ), m_wheel( wheel ), m_conf( conf ), m_hostname( hostname ), m_address( address ),
+      m_state( HEALTH_UP ), m_fails( 0 ), m_successes( 0 ), m_slow_starting( false ), m_up_since( 0 ), m_probefd( -1 ), m_probe_sent( false ), m_probe_read( 0 )
+{
+    m_probe_timer.m_handler = this;
+    m_eject_timer.m_handler = this;
+    if( m_conf.m_check != CHECK_NONE )
+    {
+        m_wheel->add( &m_probe_timer, m_conf.m_interval );
+    }
+}
+
+host_health::~host_health()
+{
+    m_wheel->del( &m_probe_timer );
+    m_wheel->del( &m_eject_timer );
+    if( m_probefd >= 0 )
+    {
+        closefd( m_epollfd, m_probefd );
+    }
+}
+
+void host_health::on_success()
+{
+    m_fails = 0;
+}
+
+void host_health::on_failure()
+{
+    if( ++m_fails >= m_conf.m_fall && m_state == HEALTH_UP )
+    {
+        mark_down();
+    }
+}
+
+int host_health::weight_percent() const
+{
+    if( m_state != HEALTH_UP )
+    {
+        return 0;
+    }
+    if( !m_slow_starting || m_conf.m_slow_start <= 0 )     // 启动时直接承担全部流量，只有摘除后恢复才慢启动
+    {
+        return 100;
+    }
+    unsigned long long elapsed = ( m_wheel->now() - m_up_since ) * timer_wheel::TICK_MS;
+    if( elapsed >= ( unsigned long long )m_conf.m_slow_start )
+    {
+        return 100;
+    }
+    int percent = elapsed * 10 / m_conf.m_slow_start * 10;
+    return ( percent < 10 ) ? 10 : percent;
+}
+
+void host_health::mark_down()
+{
+    log( LOG_ERR, __FILE__, __LINE__, "server %s:%d is unhealthy after %d failures, eject it", m_hostname, ntohs( m_address.sin_port ), m_fails );
+    m_state = HEALTH_DOWN;
+    m_successes = 0;
+    if( m_conf.m_check == CHECK_NONE )
+    {
+        m_wheel->add( &m_eject_timer, m_conf.m_eject_time );
+    }
+}
+
+void host_health::mark_up()
+{
+    log( LOG_INFO, __FILE__, __LINE__, "server %s:%d is healthy again, slow start in %d ms", m_hostname, ntohs( m_address.sin_port ), m_conf.m_slow_start );
+    m_state = HEALTH_UP;
+    m_fails = 0;
+    m_slow_starting = true;
+    m_up_since = m_wheel->now();
+}
+
+void host_health::on_timer( timer* t )
+{
+    if( t == &m_eject_timer )
+    {
+        mark_up();
+        return;
+    }
+    if( m_probefd >= 0 )    // 检查超时
+    {
+        finish_probe( false );
+        return;
+    }
+    start_probe();
+}
+
+void host_health::start_probe()
+{
+    m_probefd = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0 );
+    if( m_probefd < 0 )
+    {
+        m_wheel->add( &m_probe_timer, m_conf.m_interval );
+        return;
+    }
+    if( connect( m_probefd, ( struct sockaddr* )&m_address, sizeof( m_address ) ) != 0 && errno != EINPROGRESS )
+    {
+        close( m_probefd );
+        m_probefd = -1;
+        finish_probe( false );
+        return;
+    }
+    m_probe_sent = false;
+    m_probe_read = 0;
+    add_write_fd( m_epollfd, m_probefd );
+    m_wheel->add( &m_probe_timer, m_conf.m_timeout );
+}
+
+void host_health::process( int fd, OP_TYPE type )
+{
+    if( !m_probe_sent )     // 连接有了结果
+    {
+        int error = 0;
+        socklen_t len = sizeof( error );
+        if( getsockopt( fd, SOL_SOCKET, SO_ERROR, &error, &len ) < 0 || error != 0 )
+        {
+            finish_probe( false );
+            return;
+        }
+        if( m_conf.m_check == CHECK_TCP )
+        {
+            finish_probe( true );
+            return;
+        }
+        char request[512];
+        int len_req = snprintf( request, sizeof( request ), "GET %s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                                m_conf.m_path[0] ? m_conf.m_path : "/", m_hostname );
+        if( send( fd, request, len_req, 0 ) != len_req )
+        {
+            finish_probe( false );
+            return;
+        }
+        m_probe_sent = true;
+        modfd( m_epollfd, fd, EPOLLIN );
+        return;
+    }
+
+    // 读取状态行 "HTTP/1.x 200 ..."，2xx与3xx视为健康
+    bool eof = false;
+    while( m_probe_read < ( int )sizeof( m_probe_buf ) - 1 )
+    {
+        int ret = recv( fd, m_probe_buf + m_probe_read, sizeof( m_probe_buf ) - 1 - m_probe_read, 0 );
+        if( ret < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+        {
+            break;
+        }
+        if( ret < 0 )
+        {
+            finish_probe( false );
+            return;
+        }
+        if( ret == 0 )
+        {
+            eof = true;
+            break;
+        }
+        m_probe_read += ret;
+    }
+    m_probe_buf[ m_probe_read ] = '\0';
+    if( !eof && !strchr( m_probe_buf, '\n' ) && m_probe_read < ( int )sizeof( m_probe_buf ) - 1 )
+    {
+        return;     // 状态行还不完整
+    }
+    int status = 0;
+    bool ok = ( sscanf( m_probe_buf, "HTTP/1.%*d %d", &status ) == 1 ) && status >= 200 && status < 400;
+    finish_probe( ok );
+}
+
+void host_health::finish_probe( bool ok )
+{
+    if( m_probefd >= 0 )
+    {
+        closefd( m_epollfd, m_probefd );
+        m_probefd = -1;
+    }
+    if( ok )
+    {
+        m_fails = 0;
+        if( m_state == HEALTH_DOWN && ++m_successes >= m_conf.m_rise )
+        {
+            mark_up();
+        }
+    }
+    else
+    {
+        m_successes = 0;
+        log( LOG_ERR, __FILE__, __LINE__, "health check of server %s:%d failed", m_hostname, ntohs( m_address.sin_port ) );
+        on_failure();
+    }
+    m_wheel->add( &m_probe_timer, m_conf.m_interval );
+}
@@ -0,0 +1,77 @@
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <arpa/inet.h>
+#include "fdwrapper.h"
+#include "timer.h"
+
+enum CHECK_TYPE { CHECK_NONE = 0, CHECK_TCP, CHECK_HTTP };   // 主动检查的方式
+enum HEALTH_STATE { HEALTH_UP = 0, HEALTH_DOWN };
+
+// 健康检查的配置 (config.xml中logical_host内的标签)
+class health_conf
+{
+public:
+    health_conf() : m_check( CHECK_NONE ), m_interval( 5000 ), m_timeout( 2000 ), m_fall( 3 ), m_rise( 2 ),
+                    m_eject_time( 10000 ), m_slow_start( 10000 )
+    {
+        m_path[0] = '\0';
+    }
+    bool same( const health_conf& other ) const;    // 两份配置是否相同 (重新加载配置时判断是否需要重新开始检查)
+
+public:
+    int m_check;            // <check>none|tcp|http</check>
+    char m_path[256];       // <check_path>，HTTP检查请求的路径
+    int m_interval;         // <check_interval>，主动检查的间隔(毫秒)
+    int m_timeout;          // <check_timeout>，单次主动检查的超时(毫秒)
+    int m_fall;             // <max_fails>，连续失败多少次后摘除
+    int m_rise;             // <rise>，摘除后主动检查连续成功多少次才恢复
+    int m_eject_time;       // <eject_time>，没有主动检查时摘除多久后恢复(毫秒)
+    int m_slow_start;       // <slow_start>，恢复后流量从0增长到100%所用的时间(毫秒)
+};
+
+/*
+一个logical_host的健康状态，运行在子进程的事件循环中
+被动检查: mgr在连接、读、写服务端失败时调用on_failure，成功时调用on_success，连续失败m_fall次后摘除
+主动检查: 每隔m_interval发起一次非阻塞TCP连接(或再发送一个HTTP请求并检查状态码)
+摘除后由主动检查连续成功m_rise次恢复，没有主动检查时m_eject_time后恢复，恢复后经过m_slow_start逐步放开流量
+*/
+class host_health : public timer_handler
+{
+public:
+    host_health( int epollfd, timer_wheel* wheel, const health_conf& conf, const char* hostname, const sockaddr_in& address );
+    ~host_health();
+    void on_success();
+    void on_failure();
+    bool owns( int fd ) const { return fd >= 0 && fd == m_probefd; }  // fd是否是主动检查的socket
+    void process( int fd, OP_TYPE type );   // 主动检查socket上的事件
+    bool is_up() const { return m_state == HEALTH_UP; }
+    int weight_percent() const;     // 当前应承担的流量比例(0~100)，慢启动期间按10%的粒度增长
+    void on_timer( timer* t );
+
+private:
+    void start_probe();
+    void finish_probe( bool ok );
+    void mark_down();
+    void mark_up();
+
+private:
+    int m_epollfd;
+    timer_wheel* m_wheel;
+    health_conf m_conf;
+    const char* m_hostname;
+    sockaddr_in m_address;
+    int m_state;                // HEALTH_STATE
+    int m_fails;                // 连续失败次数
+    int m_successes;            // 摘除后主动检查连续成功的次数
+    bool m_slow_starting;       // 是否经历过摘除与恢复
+    unsigned long long m_up_since;  // 最近一次恢复的时刻(时间轮tick)
+    int m_probefd;              // 正在进行的主动检查socket，没有时为-1
+    bool m_probe_sent;          // HTTP检查请求是否已发送
+    int m_probe_read;           // 已读入的响应字节数
+    char m_probe_buf[128];      // 只需要响应的状态行
+    timer m_probe_timer;        // 检查间隔 / 单次检查超时
+    timer m_eject_timer;        // 没有主动检查时的恢复时间
+};
+
+#endif
@@ -0,0 +1,555 @@
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <time.h>
+#include <limits.h>
+#include "http.h"
+
+http_parser::http_parser( int type ) : m_type( type ), m_keys( false )
+{
+    reset();
+}
+
+void http_parser::reset()
+{
+    m_state = HTTP_START;
+    m_done = false;
+    m_keepalive = true;
+    m_head = false;
+    m_connect = false;
+    m_status = 0;
+    m_head_request = false;
+    m_line_len = 0;
+    m_length = -1;
+    m_chunked = false;
+    m_other_coding = false;
+    m_remaining = 0;
+    m_key_len = -1;
+    m_no_cache = false;
+    m_ttl = 0;
+}
+
+/*
+按行解析的状态下用memchr找换行符，消息体只做计数，都不逐字节处理
+每行的前MAX_LINE-1个字符放进m_line，最后TAIL个字符放进m_tail (请求行的协议版本在行尾，URL很长时也能取到)
+*/
+int http_parser::parse( const char* data, int len )
+{
+    m_done = false;
+    int i = 0;
+    while( i < len )
+    {
+        if( m_state == HTTP_BODY || m_state == HTTP_CHUNK_DATA )
+        {
+            long long n = len - i < m_remaining ? len - i : m_remaining;
+            i += n;
+            m_remaining -= n;
+            if( m_remaining == 0 )
+            {
+                if( m_state == HTTP_BODY )
+                {
+                    finish();
+                    return i;
+                }
+                m_state = HTTP_CHUNK_END;
+            }
+            continue;
+        }
+        if( m_state == HTTP_UNTIL_CLOSE || m_state == HTTP_ERROR )
+        {
+            return len;
+        }
+
+        const char* newline = ( const char* )memchr( data + i, '\n', len - i );
+        int end = newline ? newline - data : len;
+        int n = end - i;
+        if( m_line_len < MAX_LINE - 1 )
+        {
+            int room = MAX_LINE - 1 - m_line_len;
+            memcpy( m_line + m_line_len, data + i, n < room ? n : room );
+        }
+        if( n >= TAIL )
+        {
+            memcpy( m_tail, data + end - TAIL, TAIL );
+        }
+        else
+        {
+            memmove( m_tail, m_tail + n, TAIL - n );
+            memcpy( m_tail + TAIL - n, data + i, n );
+        }
+        m_line_len += n;
+        i = end;
+        if( !newline )
+        {
+            break;
+        }
+        ++i;
+
+        // 一行结束，去掉行尾的\r
+        int line_len = m_line_len;
+        if( line_len > 0 && m_tail[ TAIL - 1 ] == '\r' )
+        {
+            --line_len;
+        }
+        m_line[ line_len < MAX_LINE - 1 ? line_len : MAX_LINE - 1 ] = '\0';
+        m_line_len = 0;
+        if( !on_line( line_len ) )
+        {
+            m_state = HTTP_ERROR;
+            return len;
+        }
+        if( m_done )
+        {
+            return i;
+        }
+    }
+    return i;
+}
+
+bool http_parser::on_line( int line_len )
+{
+    switch( m_state )
+    {
+        case HTTP_START:
+        {
+            if( line_len == 0 )     // 消息之间多余的空行
+            {
+                return true;
+            }
+            m_keepalive = true;
+            m_head = false;
+            m_connect = false;
+            m_status = 0;
+            m_length = -1;
+            m_chunked = false;
+            m_other_coding = false;
+            m_key_len = -1;
+            m_no_cache = false;
+            m_ttl = 0;
+            m_no_store = false;
+            m_max_age = -1;
+            m_s_maxage = -1;
+            m_expires = -1;
+            m_date = -1;
+            m_age = 0;
+            m_state = HTTP_HEADER;
+            return start_line( line_len );
+        }
+        case HTTP_HEADER:
+        {
+            if( line_len == 0 )
+            {
+                return end_headers();
+            }
+            return header_line( line_len );
+        }
+        case HTTP_CHUNK_SIZE:
+        {
+            char* end = NULL;
+            m_remaining = strtoll( m_line, &end, 16 );     // 忽略chunk扩展
+            if( end == m_line || m_remaining < 0 )
+            {
+                return false;
+            }
+            m_state = m_remaining > 0 ? HTTP_CHUNK_DATA : HTTP_TRAILER;
+            return true;
+        }
+        case HTTP_CHUNK_END:
+        {
+            m_state = HTTP_CHUNK_SIZE;
+            return line_len == 0;
+        }
+        case HTTP_TRAILER:
+        {
+            if( line_len == 0 )
+            {
+                finish();
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// 请求行 "METHOD target HTTP/1.x" 或状态行 "HTTP/1.x code reason"，不支持HTTP/0.9
+bool http_parser::start_line( int line_len )
+{
+    if( m_type == HTTP_RESPONSE )
+    {
+        if( strncmp( m_line, "HTTP/1.", 7 ) != 0 || m_line[8] != ' ' )
+        {
+            return false;
+        }
+        m_keepalive = m_line[7] != '0';
+        m_status = atoi( m_line + 9 );
+        return m_status >= 100 && m_status < 1000;
+    }
+
+    const char* space = strchr( m_line, ' ' );
+    if( !space || line_len < 8 + 2 )
+    {
+        return false;
+    }
+    const char* version = m_tail + TAIL - 8;   // 行尾的8个字符，line_len不小于10保证m_tail中都是本行的内容
+    if( m_tail[ TAIL - 1 ] == '\r' )
+    {
+        --version;
+    }
+    if( strncmp( version, "HTTP/1.", 7 ) != 0 )
+    {
+        return false;
+    }
+    m_keepalive = version[7] != '0';
+    m_head = space - m_line == 4 && strncmp( m_line, "HEAD", 4 ) == 0;
+    m_connect = space - m_line == 7 && strncmp( m_line, "CONNECT", 7 ) == 0;
+    if( m_keys && space - m_line == 3 && strncmp( m_line, "GET", 3 ) == 0 && line_len < MAX_LINE - 1 )
+    {
+        const char* target_end = strrchr( m_line, ' ' );    // 协议版本前的空格
+        if( target_end > space + 1 )
+        {
+            m_key_len = target_end - space - 1;
+            memcpy( m_key, space + 1, m_key_len );
+        }
+    }
+    return true;
+}
+
+// HTTP-date (RFC 7231 7.1.1.1)，只接受IMF-fixdate格式，无法解析时返回-1
+static long long parse_date( const char* value )
+{
+    while( *value == ' ' || *value == '\t' )
+    {
+        ++value;
+    }
+    struct tm tm;
+    memset( &tm, 0, sizeof( tm ) );
+    if( !strptime( value, "%a, %d %b %Y %H:%M:%S", &tm ) )
+    {
+        return -1;
+    }
+    return timegm( &tm );
+}
+
+/*
+只关心决定消息长度与连接是否保持的字段，以及共享缓存需要的字段
+按首字母分派，转发路径上的每个头部行最多比较两三次
+*/
+bool http_parser::header_line( int line_len )
+{
+    bool truncated = line_len >= MAX_LINE - 1;      // m_line中只有这一行的开头
+    switch( m_line[0] | 0x20 )
+    {
+        case 'a':
+        {
+            if( strncasecmp( m_line, "authorization:", 14 ) == 0 )
+            {
+                m_key_len = -1;     // 不同用户的响应不能共享
+            }
+            else if( strncasecmp( m_line, "age:", 4 ) == 0 )
+            {
+                m_age = atoll( m_line + 4 );
+            }
+            break;
+        }
+        case 'c':
+        {
+            if( strncasecmp( m_line, "content-length:", 15 ) == 0 )
+            {
+                char* end = NULL;
+                long long length = strtoll( m_line + 15, &end, 10 );
+                if( end == m_line + 15 || length < 0 || ( m_length >= 0 && m_length != length ) )
+                {
+                    return false;   // 多个不一致的Content-Length无法确定边界
+                }
+                m_length = length;
+            }
+            else if( strncasecmp( m_line, "connection:", 11 ) == 0 )
+            {
+                if( strcasestr( m_line + 11, "close" ) )
+                {
+                    m_keepalive = false;
+                }
+                else if( strcasestr( m_line + 11, "keep-alive" ) )
+                {
+                    m_keepalive = true;
+                }
+            }
+            else if( strncasecmp( m_line, "cache-control:", 14 ) == 0 )
+            {
+                const char* value = m_line + 14;
+                if( m_type == HTTP_REQUEST )
+                {
+                    if( strcasestr( value, "no-cache" ) || strcasestr( value, "no-store" ) || strcasestr( value, "max-age=0" ) )
+                    {
+                        m_no_cache = true;
+                    }
+                    break;
+                }
+                if( truncated || strcasestr( value, "no-store" ) || strcasestr( value, "no-cache" ) || strcasestr( value, "private" ) )
+                {
+                    m_no_store = true;  // 看不到完整的指令时按不能缓存处理
+                }
+                const char* directive = strcasestr( value, "s-maxage=" );
+                if( directive )
+                {
+                    m_s_maxage = atoll( directive + 9 );
+                }
+                directive = strcasestr( value, "max-age=" );
+                if( directive )
+                {
+                    m_max_age = atoll( directive + 8 );
+                }
+            }
+            break;
+        }
+        case 'd':
+        {
+            if( strncasecmp( m_line, "date:", 5 ) == 0 )
+            {
+                m_date = parse_date( m_line + 5 );
+            }
+            break;
+        }
+        case 'e':
+        {
+            if( strncasecmp( m_line, "expires:", 8 ) == 0 )
+            {
+                m_expires = parse_date( m_line + 8 );
+                if( m_expires < 0 )
+                {
+                    m_expires = 0;  // 无法解析的Expires表示已经过期
+                }
+            }
+            break;
+        }
+        case 'h':
+        {
+            if( m_key_len >= 0 && strncasecmp( m_line, "host:", 5 ) == 0 )
+            {
+                const char* value = m_line + 5;
+                while( *value == ' ' || *value == '\t' )
+                {
+                    ++value;
+                }
+                int len = strlen( value );
+                if( truncated || m_key_len + 1 + len > MAX_KEY )
+                {
+                    m_key_len = -1;
+                    break;
+                }
+                m_key[ m_key_len++ ] = ' ';
+                memcpy( m_key + m_key_len, value, len );
+                m_key_len += len;
+            }
+            break;
+        }
+        case 'p':
+        {
+            if( strncasecmp( m_line, "pragma:", 7 ) == 0 && strcasestr( m_line + 7, "no-cache" ) )
+            {
+                m_no_cache = true;
+            }
+            break;
+        }
+        case 's':
+        {
+            if( strncasecmp( m_line, "set-cookie:", 11 ) == 0 )
+            {
+                m_no_store = true;
+            }
+            break;
+        }
+        case 't':
+        {
+            if( strncasecmp( m_line, "transfer-encoding:", 18 ) == 0 )
+            {
+                if( strcasestr( m_line + 18, "chunked" ) )
+                {
+                    m_chunked = true;
+                }
+                else
+                {
+                    m_other_coding = true;
+                }
+            }
+            break;
+        }
+        case 'v':
+        {
+            if( strncasecmp( m_line, "vary:", 5 ) == 0 )
+            {
+                m_no_store = true;  // key中没有Vary列出的请求头，同一个key可能对应不同的响应
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return true;
+}
+
+// RFC 7230 3.3.3 决定消息体长度的规则
+bool http_parser::end_headers()
+{
+    if( m_type == HTTP_REQUEST && ( m_length > 0 || m_chunked ) )
+    {
+        m_key_len = -1;
+    }
+    if( m_type == HTTP_RESPONSE )
+    {
+        m_ttl = freshness();
+    }
+    if( m_chunked && m_length >= 0 )
+    {
+        m_keepalive = false;    // 同时带有两种长度信息的消息，之后的边界不可信
+    }
+    if( m_type == HTTP_RESPONSE
+        && ( m_head_request || m_status / 100 == 1 || m_status == 204 || m_status == 304 ) )
+    {
+        finish();
+        return true;
+    }
+    if( m_chunked )
+    {
+        m_state = HTTP_CHUNK_SIZE;
+        return true;
+    }
+    if( m_type == HTTP_REQUEST && m_other_coding )
+    {
+        return false;
+    }
+    if( m_length > 0 )
+    {
+        m_state = HTTP_BODY;
+        m_remaining = m_length;
+    }
+    else if( m_length == 0 || m_type == HTTP_REQUEST )
+    {
+        finish();
+    }
+    else
+    {
+        m_state = HTTP_UNTIL_CLOSE;     // 响应一直持续到服务端关闭连接
+        m_keepalive = false;
+    }
+    return true;
+}
+
+void http_parser::finish()
+{
+    m_done = true;
+    m_state = HTTP_START;
+}
+
+// 只缓存带有明确新鲜期的200响应，不做启发式缓存；s-maxage优先于max-age，两者都优先于Expires
+int http_parser::freshness() const
+{
+    if( m_status != 200 || m_no_store || m_head_request )
+    {
+        return 0;
+    }
+    long long ttl;
+    if( m_s_maxage >= 0 )
+    {
+        ttl = m_s_maxage;
+    }
+    else if( m_max_age >= 0 )
+    {
+        ttl = m_max_age;
+    }
+    else if( m_expires >= 0 )
+    {
+        ttl = m_expires - ( m_date >= 0 ? m_date : time( NULL ) );
+    }
+    else
+    {
+        return 0;
+    }
+    ttl -= m_age;
+    if( ttl <= 0 )
+    {
+        return 0;
+    }
+    return ttl < INT_MAX ? ttl : INT_MAX;
+}
+
+void http_tracker::reset()
+{
+    m_req.reset();
+    m_resp.reset();
+    m_inflight = 0;
+    m_head_mask = 0;
+    m_reusable = true;
+    m_responses = 0;
+}
+
+// 不能复用之后就不再解析，节省转发路径上的开销
+void http_tracker::on_request( const char* data, int len )
+{
+    while( len > 0 && m_reusable )
+    {
+        int n = m_req.parse( data, len );
+        data += n;
+        len -= n;
+        if( m_req.failed() )
+        {
+            m_reusable = false;
+        }
+        else if( m_req.m_done )
+        {
+            if( !m_req.m_keepalive || m_req.m_connect || m_inflight >= MAX_INFLIGHT )
+            {
+                m_reusable = false;
+            }
+            else
+            {
+                if( m_req.m_head )
+                {
+                    m_head_mask |= 1u << m_inflight;
+                }
+                ++m_inflight;
+            }
+        }
+    }
+}
+
+void http_tracker::on_response( const char* data, int len )
+{
+    while( len > 0 && m_reusable )
+    {
+        m_resp.m_head_request = ( m_head_mask & 1 ) != 0;
+        int n = m_resp.parse( data, len );
+        data += n;
+        len -= n;
+        if( m_resp.failed() )
+        {
+            m_reusable = false;
+        }
+        else if( m_resp.m_done )
+        {
+            ++m_responses;
+            if( m_resp.m_status == 101 )    // 协议升级后不再是HTTP
+            {
+                m_reusable = false;
+            }
+            else if( m_resp.m_status >= 200 )   // 1xx是中间响应，后面还有最终响应
+            {
+                if( m_inflight == 0 || !m_resp.m_keepalive )
+                {
+                    m_reusable = false;
+                }
+                else
+                {
+                    --m_inflight;
+                    m_head_mask >>= 1;
+                }
+            }
+        }
+    }
+}
+
+bool http_tracker::idle() const
+{
+    return m_reusable && m_inflight == 0 && m_req.at_start() && m_resp.at_start();
+}
@@ -0,0 +1,103 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+/*
+转发的粒度 (config.xml中 <mode>)
+PROXY_TCP: 客户端在整个生命周期内独占一个服务端连接
+PROXY_HTTP: 按HTTP/1.x请求转发，每个请求从连接池中取任意空闲的服务端连接，响应完整写给客户端后连接放回连接池
+*/
+enum PROXY_MODE { PROXY_TCP = 0, PROXY_HTTP };
+
+enum HTTP_TYPE { HTTP_REQUEST = 0, HTTP_RESPONSE };
+
+/*
+http_parser的状态
+HTTP_START: 等待下一条消息的起始行    HTTP_HEADER: 正在读头部
+HTTP_BODY: Content-Length指定长度的消息体    HTTP_CHUNK_*: chunked编码的消息体
+HTTP_UNTIL_CLOSE: 没有长度信息的响应，一直到服务端关闭连接    HTTP_ERROR: 无法解析，之后的数据全部忽略
+*/
+enum HTTP_STATE { HTTP_START = 0, HTTP_HEADER, HTTP_BODY, HTTP_CHUNK_SIZE, HTTP_CHUNK_DATA, HTTP_CHUNK_END, HTTP_TRAILER, HTTP_UNTIL_CLOSE, HTTP_ERROR };
+
+/*
+一个方向上HTTP/1.x消息边界的增量解析器，只找出每条消息在哪里结束，不保存消息内容
+数据可以按任意方式分段传入，直接在调用者的缓冲区中扫描：消息体只做计数，
+头部只在m_line中保留每行的前MAX_LINE个字符，用来识别决定消息长度的几个字段
+共享缓存需要的字段(请求的key、响应的新鲜期)也在这里顺便识别
+*/
+class http_parser
+{
+public:
+    http_parser( int type );
+    void reset();
+    int parse( const char* data, int len );     // 解析data，返回消耗的字节数；一条消息结束时立即返回，并设置m_done
+    bool at_start() const { return m_state == HTTP_START && m_line_len == 0; }  // 停在两条消息之间
+    bool failed() const { return m_state == HTTP_ERROR; }
+
+private:
+    bool on_line( int line_len );   // 处理m_line中完整的一行(line_len不含\r\n)，出错时返回false
+    bool start_line( int line_len );
+    bool header_line( int line_len );
+    bool end_headers();         // 头部结束，决定消息体的长度
+    void finish();              // 一条消息结束
+    int freshness() const;      // 响应在共享缓存中的新鲜期(秒)
+
+public:
+    static const int MAX_LINE = 256;
+    static const int MAX_KEY = 2 * MAX_LINE;    // 请求目标与Host都来自m_line
+    static const int TAIL = 9;      // 协议版本"HTTP/1.x"加上\r
+
+    int m_type;                 // HTTP_TYPE
+    int m_state;                // HTTP_STATE
+    bool m_done;                // 最近一次parse()是否刚好解析完一条消息，以下字段描述这条消息
+    bool m_keepalive;           // 发送方是否愿意在这条消息之后继续使用该连接
+    bool m_head;                // 请求: 方法为HEAD
+    bool m_connect;             // 请求: 方法为CONNECT
+    int m_status;               // 响应: 状态码
+    bool m_head_request;        // 响应: 对应的请求是否为HEAD (由调用者在解析每条响应前设置)
+    bool m_keys;                // 请求: 是否记录m_key (由调用者设置，只有查缓存时需要)
+    char m_key[ MAX_KEY ];      // 请求: 缓存的key，"请求目标 Host"
+    int m_key_len;              // 请求: m_key的长度，-1表示这个请求不能使用缓存 (不是GET、带有消息体或Authorization、行太长)
+    bool m_no_cache;            // 请求: Cache-Control或Pragma要求不使用缓存中的响应
+    int m_ttl;                  // 响应: 按Cache-Control/Expires在共享缓存中的新鲜期(秒)，0表示不能缓存
+
+private:
+    char m_line[ MAX_LINE ];    // 当前行的前MAX_LINE-1个字符
+    char m_tail[ TAIL ];        // 当前行的最后TAIL个字符
+    int m_line_len;             // 当前行已读到的字符数 (可能超过MAX_LINE)
+    long long m_length;         // Content-Length，-1表示没有
+    bool m_chunked;             // Transfer-Encoding以chunked结尾
+    bool m_other_coding;        // Transfer-Encoding中有chunked以外的编码
+    long long m_remaining;      // 当前消息体或chunk还剩的字节数
+    bool m_no_store;            // 响应: no-store、no-cache、private、Vary或Set-Cookie，共享缓存不能保存
+    long long m_max_age;        // 响应: Cache-Control的max-age，-1表示没有
+    long long m_s_maxage;       // 响应: Cache-Control的s-maxage，优先于max-age
+    long long m_expires;        // 响应: Expires，-1表示没有，无法解析时为0(已经过期)
+    long long m_date;           // 响应: Date，-1表示没有
+    long long m_age;            // 响应: 上游缓存报告的Age
+};
+
+/*
+一对客户端/服务端连接上的请求与响应，用来判断服务端连接此刻是否停在两次交互之间，可以交给下一个客户端
+请求在从客户端读入时解析，响应在从服务端读入时解析，按到达顺序一一对应 (支持pipeline)
+*/
+class http_tracker
+{
+public:
+    http_tracker() : m_req( HTTP_REQUEST ), m_resp( HTTP_RESPONSE ), m_inflight( 0 ), m_head_mask( 0 ), m_reusable( true ), m_responses( 0 ){}
+    void reset();
+    void on_request( const char* data, int len );
+    void on_response( const char* data, int len );
+    bool idle() const;      // 所有请求都有了完整的响应，双方都停在消息边界，并且都愿意保持连接
+
+public:
+    static const int MAX_INFLIGHT = 32;
+
+    http_parser m_req;
+    http_parser m_resp;
+    int m_inflight;             // 已读入完整请求、还没读到完整响应的个数
+    unsigned int m_head_mask;   // m_inflight个请求中哪些是HEAD，第0位是最早的请求
+    bool m_reusable;            // 出现Connection: close、协议升级、解析错误等情况后为false，直到reset
+    int m_responses;            // reset以来完整读到的响应条数 (包括1xx)
+};
+
+#endif
@@ -0,0 +1,31 @@
+#include <sys/mman.h>
+#include <string.h>
+#include <errno.h>
+#include "loadtable.h"
+#include "log.h"
+
+load_table::~load_table()
+{
+    if( m_loads )
+    {
+        munmap( m_loads, sizeof( worker_load ) * m_number );
+    }
+}
+
+bool load_table::init( int number )
+{
+    void* mem = mmap( NULL, sizeof( worker_load ) * number, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if( mem == MAP_FAILED )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "create load table failed: %s", strerror( errno ) );
+        return false;
+    }
+    m_loads = ( worker_load* )mem;     // 匿名映射的内容全为0
+    m_number = number;
+    return true;
+}
+
+void load_table::reset( int idx )
+{
+    memset( &m_loads[idx], 0, sizeof( worker_load ) );
+}
@@ -0,0 +1,58 @@
+#ifndef LOADTABLE_H
+#define LOADTABLE_H
+
+#include <stddef.h>
+
+/*
+一个子进程的负载，独占一个cache line，不同子进程的更新不会使彼此的cache line失效
+m_active/m_ready/m_running/m_bytes_per_sec只由对应的子进程写，m_pending由父进程加、子进程减
+*/
+class worker_load
+{
+public:
+    int m_active;           // 正在转发的客户端数 (所有服务端都被摘除时为mgr::EJECTED_BUSY_RATIO)
+    int m_ready;            // 连接池中空闲的服务端连接数
+    int m_pending;          // 父进程已分配、子进程还没有accept的连接数
+    int m_running;          // 子进程建好连接池、进入事件循环后置1，重新启动前由父进程清零
+    unsigned long long m_bytes_per_sec;     // 最近一秒转发的字节数
+} __attribute__( ( aligned( 64 ) ) );
+
+/*
+父子进程共享的负载表，在父进程fork子进程之前mmap(MAP_SHARED)，子进程直接写入自己的一项
+父进程选择子进程时直接读取，不需要任何系统调用，也不会像管道消息那样截断或错误分帧
+*/
+class load_table
+{
+public:
+    load_table() : m_loads( NULL ), m_number( 0 ){}
+    ~load_table();
+    bool init( int number );    // 在fork之前调用，number为子进程数量
+
+    // 子进程调用
+    void publish( int idx, int active, int ready )
+    {
+        __atomic_store_n( &m_loads[idx].m_active, active, __ATOMIC_RELAXED );
+        __atomic_store_n( &m_loads[idx].m_ready, ready, __ATOMIC_RELAXED );
+    }
+    void mark_running( int idx ) { __atomic_store_n( &m_loads[idx].m_running, 1, __ATOMIC_RELEASE ); }
+    void publish_rate( int idx, unsigned long long bytes_per_sec )
+    {
+        __atomic_store_n( &m_loads[idx].m_bytes_per_sec, bytes_per_sec, __ATOMIC_RELAXED );
+    }
+
+    // 父进程分配连接时加1，子进程取出一个分配通知时减1
+    void add_pending( int idx, int delta ) { __atomic_add_fetch( &m_loads[idx].m_pending, delta, __ATOMIC_RELAXED ); }
+
+    int active( int idx ) const { return __atomic_load_n( &m_loads[idx].m_active, __ATOMIC_RELAXED ); }
+    int ready( int idx ) const { return __atomic_load_n( &m_loads[idx].m_ready, __ATOMIC_RELAXED ); }
+    int pending( int idx ) const { return __atomic_load_n( &m_loads[idx].m_pending, __ATOMIC_RELAXED ); }
+    bool running( int idx ) const { return __atomic_load_n( &m_loads[idx].m_running, __ATOMIC_ACQUIRE ) != 0; }
+    unsigned long long bytes_per_sec( int idx ) const { return __atomic_load_n( &m_loads[idx].m_bytes_per_sec, __ATOMIC_RELAXED ); }
+    void reset( int idx );      // 子进程重新启动前清零它的一项
+
+private:
+    worker_load* m_loads;
+    int m_number;
+};
+
+#endif
@@ -1,20 +1,175 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
 #include "log.h"
 
 static int level = LOG_INFO;
-static int LOG_BUFFER_SIZE = 2048;
+static const int LOG_BUFFER_SIZE = 2048;
 static const char* loglevels[] =
 {
     "emerge!", "alert!", "critical!", "error!", "warn!", "notice:", "info:", "debug:"
 };
 
+/*
+单生产者单消费者的环形缓冲区：生产者是进程的事件循环(log)，消费者是后台的flusher线程
+下标只增不减，对LOG_RING_SIZE取模得到位置；生产者只写ring_head，消费者只写ring_tail，不需要加锁
+*/
+static const unsigned int LOG_RING_SIZE = 1 << 20;     // 2的幂
+static const int FLUSH_INTERVAL_US = 10000;             // 缓冲区为空时flusher的休眠时间
+static char ring[ LOG_RING_SIZE ];
+static unsigned int ring_head = 0;      // 下一条日志写入的位置
+static unsigned int ring_tail = 0;      // 下一次writev开始的位置
+static unsigned int dropped = 0;        // 缓冲区满而丢弃的日志条数
+
+static int log_fd = STDOUT_FILENO;
+static bool registered = false;         // 是否已注册atexit与pthread_atfork
+static bool flusher_started = false;
+static bool flusher_stop = false;
+static bool sync_mode = false;          // flusher不可用或进程正在退出时直接写
+static pthread_t flusher;
+
+// 时间戳字符串每秒只格式化一次
+static time_t cached_sec = 0;
+static char cached_time[64];
+static int cached_time_len = 0;
+
 void set_loglevel( int log_level )
 {
     level = log_level;
 }
 
+bool set_logfile( const char* path )
+{
+    int fd = open( path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+    if( fd < 0 )
+    {
+        return false;
+    }
+    flush_log();    // 之前的日志仍写到原来的位置
+    log_fd = fd;
+    sync_mode = false;
+    return true;
+}
+
+// 把[ring_tail, ring_head)的内容用一次writev写出 (跨越末尾时分两段)，返回写出的字节数
+static int drain()
+{
+    unsigned int lost = __atomic_exchange_n( &dropped, 0, __ATOMIC_RELAXED );
+    if( lost > 0 )
+    {
+        char msg[64];
+        int len = snprintf( msg, sizeof( msg ), "%u log records dropped\n", lost );
+        write( log_fd, msg, len );
+    }
+
+    unsigned int head = __atomic_load_n( &ring_head, __ATOMIC_ACQUIRE );
+    unsigned int tail = ring_tail;
+    unsigned int len = head - tail;
+    if( len == 0 )
+    {
+        return 0;
+    }
+    unsigned int start = tail & ( LOG_RING_SIZE - 1 );
+    struct iovec iov[2];
+    iov[0].iov_base = ring + start;
+    iov[0].iov_len = len < LOG_RING_SIZE - start ? len : LOG_RING_SIZE - start;
+    iov[1].iov_base = ring;
+    iov[1].iov_len = len - iov[0].iov_len;
+    ssize_t ret = writev( log_fd, iov, iov[1].iov_len > 0 ? 2 : 1 );
+    if( ret < 0 )
+    {
+        if( errno == EINTR )
+        {
+            return 0;
+        }
+        ret = len;      // 文件不可写时丢弃，避免缓冲区永远满
+    }
+    __atomic_store_n( &ring_tail, tail + ( unsigned int )ret, __ATOMIC_RELEASE );
+    return ret;
+}
+
+static void* flush_routine( void* arg )
+{
+    while( !__atomic_load_n( &flusher_stop, __ATOMIC_ACQUIRE ) )
+    {
+        if( drain() == 0 )
+        {
+            usleep( FLUSH_INTERVAL_US );
+        }
+    }
+    return NULL;
+}
+
+// fork出的子进程没有flusher线程，缓冲区中父进程的日志由父进程负责写出
+static void reset_in_child()
+{
+    ring_head = 0;
+    ring_tail = 0;
+    dropped = 0;
+    flusher_started = false;
+    flusher_stop = false;
+}
+
+void flush_log()
+{
+    if( flusher_started )
+    {
+        __atomic_store_n( &flusher_stop, true, __ATOMIC_RELEASE );
+        pthread_join( flusher, NULL );
+        flusher_started = false;
+        flusher_stop = false;
+    }
+    while( drain() > 0 )
+    {
+    }
+}
+
+static void exit_flush()
+{
+    flush_log();
+    sync_mode = true;   // atexit之后的日志直接写
+}
+
+static void start_flusher()
+{
+    if( !registered )
+    {
+        registered = true;
+        atexit( exit_flush );
+        pthread_atfork( NULL, NULL, reset_in_child );
+    }
+    if( pthread_create( &flusher, NULL, flush_routine, NULL ) == 0 )
+    {
+        flusher_started = true;
+    }
+    else
+    {
+        sync_mode = true;
+    }
+}
+
+static void push( const char* data, unsigned int len )
+{
+    unsigned int head = ring_head;
+    unsigned int tail = __atomic_load_n( &ring_tail, __ATOMIC_ACQUIRE );
+    if( LOG_RING_SIZE - ( head - tail ) < len )
+    {
+        __atomic_add_fetch( &dropped, 1, __ATOMIC_RELAXED );
+        return;
+    }
+    unsigned int start = head & ( LOG_RING_SIZE - 1 );
+    unsigned int first = len < LOG_RING_SIZE - start ? len : LOG_RING_SIZE - start;
+    memcpy( ring + start, data, first );
+    memcpy( ring, data + first, len - first );
+    __atomic_store_n( &ring_head, head + len, __ATOMIC_RELEASE );
+}
+
 void log( int log_level,  const char* file_name, int line_num, const char* format, ... )
 {
     if ( log_level > level )
@@ -22,25 +177,44 @@ void log( int log_level,  const char* file_name, int line_num, const char* forma
         return;
     }
 
-    time_t tmp = time( NULL );						//获得机器时间
-    struct tm* cur_time = localtime( &tmp );		//返回一个以tm结构表达的机器时间信息
-    if ( ! cur_time )
+    time_t now = time( NULL );						//获得机器时间 (vDSO，不进入内核)
+    if( now != cached_sec || cached_time_len == 0 )
     {
-        return;
-    }    
+        struct tm cur_time;
+        if( !localtime_r( &now, &cur_time ) )
+        {
+            return;
+        }
+        cached_time_len = strftime( cached_time, sizeof( cached_time ), "[ %x %X ] ", &cur_time );			//%x 标准的日期串，%X 标准的时间串
+        cached_sec = now;
+    }
 
     char arg_buffer[ LOG_BUFFER_SIZE ];
-    memset( arg_buffer, '\0', LOG_BUFFER_SIZE );
-    strftime( arg_buffer, LOG_BUFFER_SIZE - 1, "[ %x %X ] ", cur_time );			//函数格式化一个时间字符串，%x 标准的日期串，%X 标准的时间串
-    printf( "%s", arg_buffer );
-    printf( "%s:%04d ", file_name, line_num );
-    printf( "%s ", loglevels[ log_level - LOG_EMERG ] );
+    int len = cached_time_len;
+    memcpy( arg_buffer, cached_time, len );
+    len += snprintf( arg_buffer + len, LOG_BUFFER_SIZE - len, "%s:%04d %s ", file_name, line_num, loglevels[ log_level - LOG_EMERG ] );
 
     va_list arg_list;						// 定义一个va_list型的变量，这个变量指向参数的指针
     va_start( arg_list, format );			//用va_start宏初始化变量，这个宏的第二个参数是第一个可变参数的前一个参数，是一个固定的参数
-    memset( arg_buffer, '\0', LOG_BUFFER_SIZE );		
-    vsnprintf( arg_buffer, LOG_BUFFER_SIZE - 1, format, arg_list );
-    printf( "%s\n", arg_buffer );
-    fflush( stdout );		
+    if( len < LOG_BUFFER_SIZE - 1 )
+    {
+        len += vsnprintf( arg_buffer + len, LOG_BUFFER_SIZE - 1 - len, format, arg_list );
+    }
     va_end( arg_list );
+    if( len > LOG_BUFFER_SIZE - 2 )     // 过长的日志被截断
+    {
+        len = LOG_BUFFER_SIZE - 2;
+    }
+    arg_buffer[ len++ ] = '\n';
+
+    if( !flusher_started && !sync_mode )
+    {
+        start_flusher();
+    }
+    if( sync_mode )
+    {
+        write( log_fd, arg_buffer, len );
+        return;
+    }
+    push( arg_buffer, len );
 }
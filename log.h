@@ -8,9 +8,29 @@
 设置日志的级别
 宏定义：LOG_DEBUG 来自头文件 syslog.h
 */
-void set_loglevel( int log_level = LOG_DEBUG );  
+void set_loglevel( int log_level = LOG_DEBUG );
 
-// printf: 输出日志信息
+// 日志输出到文件 (追加)，默认输出到标准输出；失败返回false
+bool set_logfile( const char* path );
+
+/*
+输出日志信息
+日志先格式化后放入本进程的环形缓冲区，由后台线程批量writev到文件，调用者不会阻塞在IO上
+缓冲区满时丢弃该条日志并计数
+*/
 void log( int log_level, const char* file_name, int line_num, const char* format, ... );
 
+// 把缓冲区中的日志全部写出 (进程退出时自动调用)
+void flush_log();
+
+/*
+debug级别的日志在编译期过滤：只有定义了LOG_ENABLE_DEBUG (make LOG_DEBUG=1) 时才会编译进来
+每个连接都会触发的日志应使用log_debug
+*/
+#ifdef LOG_ENABLE_DEBUG
+#define log_debug( ... ) log( LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__ )
+#else
+#define log_debug( ... ) do {} while( 0 )
+#endif
+
 #endif
@@ -23,92 +23,56 @@
 using std::vector;
 
 static const char* version = "1.0"; // 静态变量就是唯一的，防止多次创建
+static char cfg_file[1024];						//配置文件，SIGHUP时重新读取
 
 static void usage( const char* prog )
 {
-    log( LOG_INFO, __FILE__, __LINE__,  "usage: %s [-h] [-v] [-f config_file]", prog );				
+    log( LOG_INFO, __FILE__, __LINE__,  "usage: %s [-h] [-v] [-x] [-l log_file] [-f config_file]", prog );				
 }
-//ANSI C标准中几个标准预定义宏
-// __FILE__ :在源文件中插入当前原文件名
-// __LINE__ ：在源文件中插入当前源代码行号
-// _DATE_: 在源文件插入当前的编译日期
-// _TIME_: 在源文件中插入的编译时间
-// _STDC_ : 当要求程序严格遵循ANSI C 标准时刻标示被赋值为1
-// _cplusplus: 当编写C++程序时该标识符被定义
-int main( int argc, char* argv[] )
-{
-    char cfg_file[1024];						//配置文件
-    memset( cfg_file, '\0', 100 );              // 将cfd_file的前100个字节初始化为 \0
-    int option;
-    // xvf是可选参数
-    while ( ( option = getopt( argc, argv, "f:xvh" ) ) != -1 )					//getopt函数用来分析命令行参数
-    {
-        switch ( option )
-        {
-            case 'x':
-            {
-                set_loglevel( LOG_DEBUG );										//log.cpp
-                break;
-            }
-            case 'v':  //版本信息
-            {
-                log( LOG_INFO, __FILE__, __LINE__, "%s %s", argv[0], version );
-                return 0;
-            }
-            case 'h':  //帮助 help
-            {
-                usage( basename( argv[ 0 ] ) ); // basename 返回文件名，而不是argv[0]整个文件的绝对路径
-                return 0;
-            }
-            case 'f':
-            {   
-                // optarg 是 -f 后边的 config_file
-                memcpy( cfg_file, optarg, strlen( optarg ) );		// cfg_file  此时的内容是 config.xml  比如运行时：./main -f config.xml
-                break;
-            }
-            case '?':  //无效的参数或者缺少参数的选项值
-            {
-                log( LOG_ERR, __FILE__, __LINE__, "un-recognized option %c", option );
-                usage( basename( argv[ 0 ] ) );
-                return 1;
-            }
-        }
-    }    
 
-    // // cfg_file = config.xml
-    if( cfg_file[0] == '\0' ) 
-    {
-        log( LOG_ERR, __FILE__, __LINE__, "%s", "please specifiy the config file" );
-        return 1;
-    }
-    int cfg_fd = open( cfg_file, O_RDONLY );			//打开配置文件 config.xml， cfg_fd是config.xml文件的文件描述符
-    if( !cfg_fd )
+/*
+解析配置文件: balance_srv为Listen的地址，logical_srv为所有logical_host，conf与workers为全局配置
+启动时由main调用，SIGHUP时父进程再次调用以重新加载logical_host，因此出错时只返回false，不退出进程
+*/
+static bool parse_config( const char* file, vector< host >& balance_srv, vector< host >& logical_srv, pool_conf& conf, int& workers )
+{
+    int cfg_fd = open( file, O_RDONLY );			//打开配置文件 config.xml， cfg_fd是config.xml文件的文件描述符
+    if( cfg_fd < 0 )
     {
         // strerror(errno) 可以解析出errro的具体错误类型
         log( LOG_ERR, __FILE__, __LINE__, "read config file met error: %s", strerror( errno ) );
-        return 1;
+        return false;
     }
     struct stat ret_stat;   // stat 展示文件状况  man stat
     if( fstat( cfg_fd, &ret_stat ) < 0 )            // fstat()用来将参数fildes 所指的文件状态
     {
         log( LOG_ERR, __FILE__, __LINE__, "read config file met error: %s", strerror( errno ) );
-        return 1;
+        close( cfg_fd );
+        return false;
     }
-    char* buf = new char [ret_stat.st_size + 1];        
-    memset( buf, '\0', ret_stat.st_size + 1 );
+    vector< char > content( ret_stat.st_size + 1, '\0' );     // 重新加载时会再次解析，内容随函数返回释放
+    char* buf = &content[0];
     ssize_t read_sz = read( cfg_fd, buf, ret_stat.st_size );			//buf此时的内容是config.xml文件的内容, 
+    close( cfg_fd );
     if ( read_sz < 0 )
     {
         log( LOG_ERR, __FILE__, __LINE__, "read config file met error: %s", strerror( errno ) );
-        return 1;
+        return false;
     }
-    vector< host > balance_srv;							//host在前面的mgr.h文件中定义   一个是负载均衡服务器
-    vector< host > logical_srv;                         //一个是逻辑服务器
     host tmp_host;
     memset( tmp_host.m_hostname, '\0', 1024 );          
     char* tmp_hostname;
     char* tmp_port;
     char* tmp_conncnt;
+    char* tmp_relay;
+    char* tmp_bufsize;
+    char* tmp_timeout;
+    char* tmp_accept;
+    char* tmp_arena;
+    char* tmp_check;
+    char* tmp_workers;
+    char* tmp_balance;
+    char* tmp_admin;
     bool opentag = false;
     char* tmp = buf;				//此时tem指向config.xml文件的内容
     char* tmp2 = NULL;
@@ -129,7 +93,7 @@ int main( int argc, char* argv[] )
             if( opentag )
             {
                 log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
-                return 1;
+                return false;
             }
             opentag = true;         // 开始读一个host
         }
@@ -138,11 +102,19 @@ int main( int argc, char* argv[] )
             if( !opentag )
             {
                 log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
-                return 1;
+                return false;
             }
             // tmp_host.m_hostname = 115.236.121.4
             logical_srv.push_back( tmp_host );
             memset( tmp_host.m_hostname, '\0', 1024 );
+            tmp_host.m_splice = false;
+            tmp_host.m_bufsize = conn::BUF_SIZE;
+            tmp_host.m_connect_timeout = host::DEFAULT_CONNECT_TIMEOUT;
+            tmp_host.m_clt_idle_timeout = 0;
+            tmp_host.m_srv_idle_timeout = 0;
+            tmp_host.m_keepalive = false;
+            tmp_host.m_weight = 1;
+            tmp_host.m_health = health_conf();
             opentag = false;        // 结束读一个host
         }
         else if( tmp3 = strstr( tmp, "<name>" ) )  
@@ -152,7 +124,7 @@ int main( int argc, char* argv[] )
             if( !tmp4 )
             {
                 log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
-                return 1;
+                return false;
             }
             *tmp4 = '\0';                           // 将字符串手动结束
             memcpy( tmp_host.m_hostname, tmp_hostname, strlen( tmp_hostname ) );
@@ -164,7 +136,7 @@ int main( int argc, char* argv[] )
             if( !tmp4 )
             {
                 log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
-                return 1;
+                return false;
             }
             *tmp4 = '\0';                           // 将字符串手动结束
             tmp_host.m_port = atoi( tmp_port );
@@ -176,11 +148,546 @@ int main( int argc, char* argv[] )
             if( !tmp4 )
             {
                 log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
-                return 1;
+                return false;
             }
             *tmp4 = '\0';
             tmp_host.m_conncnt = atoi( tmp_conncnt );
         }
+        else if( tmp3 = strstr( tmp, "<weight>" ) )      // 负载均衡的权重，默认1
+        {
+            tmp_balance = tmp3 + 8;
+            tmp4 = strstr( tmp_balance, "</weight>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            tmp_host.m_weight = atoi( tmp_balance );
+            if( tmp_host.m_weight <= 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid weight: %s", tmp_balance );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<bufsize>" ) )     // 每个连接每个方向的缓冲区大小(字节)，向上取整到2的幂
+        {
+            tmp_bufsize = tmp3 + 9;
+            tmp4 = strstr( tmp_bufsize, "</bufsize>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            tmp_host.m_bufsize = atoi( tmp_bufsize );
+            if( tmp_host.m_bufsize <= 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid bufsize: %s", tmp_bufsize );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<connect_timeout>" ) )     // 连接服务端的超时时间(毫秒)
+        {
+            tmp_timeout = tmp3 + 17;
+            tmp4 = strstr( tmp_timeout, "</connect_timeout>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            tmp_host.m_connect_timeout = atoi( tmp_timeout );
+            if( tmp_host.m_connect_timeout <= 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid connect_timeout: %s", tmp_timeout );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<backend_idle_timeout>" ) )    // 连接池中的服务端连接空闲多久后重新建立(毫秒)
+        {
+            tmp_timeout = tmp3 + 22;
+            tmp4 = strstr( tmp_timeout, "</backend_idle_timeout>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            tmp_host.m_srv_idle_timeout = atoi( tmp_timeout );
+            if( tmp_host.m_srv_idle_timeout < 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid backend_idle_timeout: %s", tmp_timeout );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<idle_timeout>" ) )    // 客户端与服务端之间没有数据多久后关闭(毫秒)
+        {
+            tmp_timeout = tmp3 + 14;
+            tmp4 = strstr( tmp_timeout, "</idle_timeout>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            tmp_host.m_clt_idle_timeout = atoi( tmp_timeout );
+            if( tmp_host.m_clt_idle_timeout < 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid idle_timeout: %s", tmp_timeout );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<check>" ) )      // 主动健康检查方式: none (默认)、tcp 或 http
+        {
+            tmp_check = tmp3 + 7;
+            tmp4 = strstr( tmp_check, "</check>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            if( strcmp( tmp_check, "tcp" ) == 0 )
+            {
+                tmp_host.m_health.m_check = CHECK_TCP;
+            }
+            else if( strcmp( tmp_check, "http" ) == 0 )
+            {
+                tmp_host.m_health.m_check = CHECK_HTTP;
+            }
+            else if( strcmp( tmp_check, "none" ) == 0 )
+            {
+                tmp_host.m_health.m_check = CHECK_NONE;
+            }
+            else
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "unknown check type: %s", tmp_check );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<check_path>" ) )     // http检查请求的路径
+        {
+            tmp_check = tmp3 + 12;
+            tmp4 = strstr( tmp_check, "</check_path>" );
+            if( !tmp4 || tmp4 - tmp_check >= ( int )sizeof( tmp_host.m_health.m_path ) )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            strcpy( tmp_host.m_health.m_path, tmp_check );
+        }
+        else if( tmp3 = strstr( tmp, "<check_interval>" ) )    // 主动检查的间隔(毫秒)
+        {
+            tmp_check = tmp3 + 16;
+            tmp4 = strstr( tmp_check, "</check_interval>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            tmp_host.m_health.m_interval = atoi( tmp_check );
+            if( tmp_host.m_health.m_interval < 1 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid check_interval: %s", tmp_check );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<check_timeout>" ) )     // 一次主动检查的超时时间(毫秒)
+        {
+            tmp_check = tmp3 + 15;
+            tmp4 = strstr( tmp_check, "</check_timeout>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            tmp_host.m_health.m_timeout = atoi( tmp_check );
+            if( tmp_host.m_health.m_timeout < 1 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid check_timeout: %s", tmp_check );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<max_fails>" ) )         // 连续失败多少次后摘除服务端
+        {
+            tmp_check = tmp3 + 11;
+            tmp4 = strstr( tmp_check, "</max_fails>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            tmp_host.m_health.m_fall = atoi( tmp_check );
+            if( tmp_host.m_health.m_fall < 1 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid max_fails: %s", tmp_check );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<rise>" ) )              // 摘除后连续成功多少次才恢复
+        {
+            tmp_check = tmp3 + 6;
+            tmp4 = strstr( tmp_check, "</rise>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            tmp_host.m_health.m_rise = atoi( tmp_check );
+            if( tmp_host.m_health.m_rise < 1 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid rise: %s", tmp_check );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<eject_time>" ) )        // 没有主动检查时，摘除多久后恢复(毫秒)
+        {
+            tmp_check = tmp3 + 12;
+            tmp4 = strstr( tmp_check, "</eject_time>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            tmp_host.m_health.m_eject_time = atoi( tmp_check );
+            if( tmp_host.m_health.m_eject_time < 1 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid eject_time: %s", tmp_check );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<slow_start>" ) )        // 恢复后流量逐渐增加到正常的时间(毫秒)，0表示不慢启动
+        {
+            tmp_check = tmp3 + 12;
+            tmp4 = strstr( tmp_check, "</slow_start>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            tmp_host.m_health.m_slow_start = atoi( tmp_check );
+            if( tmp_host.m_health.m_slow_start < 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid slow_start: %s", tmp_check );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<relay>" ) )       // 转发方式: buffer (默认) 或 splice
+        {
+            tmp_relay = tmp3 + 7;
+            tmp4 = strstr( tmp_relay, "</relay>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            if( strcmp( tmp_relay, "splice" ) == 0 )
+            {
+                tmp_host.m_splice = true;
+            }
+            else if( strcmp( tmp_relay, "buffer" ) == 0 )
+            {
+                tmp_host.m_splice = false;
+            }
+            else
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "unknown relay mode: %s", tmp_relay );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<keepalive>" ) )   // 客户端离开后是否复用停在HTTP消息边界的服务端连接: on 或 off (默认)
+        {
+            tmp_relay = tmp3 + 11;
+            tmp4 = strstr( tmp_relay, "</keepalive>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            tmp_host.m_keepalive = ( strcmp( tmp_relay, "on" ) == 0 );
+        }
+        else if( tmp3 = strstr( tmp, "<accept>" ) )     // accept方式: parent (默认)、reuseport 或 passfd
+        {
+            tmp_accept = tmp3 + 8;
+            tmp4 = strstr( tmp_accept, "</accept>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            if( strcmp( tmp_accept, "reuseport" ) == 0 )
+            {
+                conf.m_accept_mode = ACCEPT_REUSEPORT;
+            }
+            else if( strcmp( tmp_accept, "parent" ) == 0 )
+            {
+                conf.m_accept_mode = ACCEPT_PARENT;
+            }
+            else if( strcmp( tmp_accept, "passfd" ) == 0 )
+            {
+                conf.m_accept_mode = ACCEPT_PASSFD;
+            }
+            else
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "unknown accept mode: %s", tmp_accept );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<backlog>" ) )    // listen的backlog
+        {
+            tmp_accept = tmp3 + 9;
+            tmp4 = strstr( tmp_accept, "</backlog>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            conf.m_backlog = atoi( tmp_accept );
+            if( conf.m_backlog <= 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid backlog: %s", tmp_accept );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<accept_batch>" ) )   // 父进程一次最多让一个子进程accept多少个连接
+        {
+            tmp_accept = tmp3 + 14;
+            tmp4 = strstr( tmp_accept, "</accept_batch>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            conf.m_accept_batch = atoi( tmp_accept );
+            if( conf.m_accept_batch <= 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid accept_batch: %s", tmp_accept );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<arena>" ) )      // 每个子进程内存池的大小(MB)，0表示不使用内存池
+        {
+            tmp_arena = tmp3 + 7;
+            tmp4 = strstr( tmp_arena, "</arena>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            int arena_mb = atoi( tmp_arena );
+            if( arena_mb < 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid arena: %s", tmp_arena );
+                return false;
+            }
+            conf.m_arena_size = ( size_t )arena_mb * 1024 * 1024;
+        }
+        else if( tmp3 = strstr( tmp, "<hugepages>" ) )  // 内存池是否使用大页: on 或 off (默认)
+        {
+            tmp_arena = tmp3 + 11;
+            tmp4 = strstr( tmp_arena, "</hugepages>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            conf.m_huge_pages = ( strcmp( tmp_arena, "on" ) == 0 );
+        }
+        else if( tmp3 = strstr( tmp, "<balance>" ) )    // 负载均衡策略: wlc (默认)、wrr、p2c 或 ewma
+        {
+            tmp_balance = tmp3 + 9;
+            tmp4 = strstr( tmp_balance, "</balance>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            conf.m_balance = scheduler::parse_policy( tmp_balance );
+            if( conf.m_balance < 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "unknown balance policy: %s", tmp_balance );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<mode>" ) )   // 转发的粒度: tcp (默认，客户端独占服务端连接) 或 http (按请求从连接池中分配)
+        {
+            tmp_balance = tmp3 + 6;
+            tmp4 = strstr( tmp_balance, "</mode>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            if( strcmp( tmp_balance, "http" ) == 0 )
+            {
+                conf.m_mode = PROXY_HTTP;
+            }
+            else if( strcmp( tmp_balance, "tcp" ) == 0 )
+            {
+                conf.m_mode = PROXY_TCP;
+            }
+            else
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "unknown mode: %s", tmp_balance );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<keepalive_timeout>" ) )  // http模式下客户端两次请求之间的空闲超时(毫秒)，0表示不限制
+        {
+            tmp_timeout = tmp3 + 19;
+            tmp4 = strstr( tmp_timeout, "</keepalive_timeout>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            conf.m_keepalive_timeout = atoi( tmp_timeout );
+            if( conf.m_keepalive_timeout < 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid keepalive_timeout: %s", tmp_timeout );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<cache>" ) )      // http模式下所有子进程共享的响应缓存的大小(MB)，0表示不开启(默认)
+        {
+            tmp_arena = tmp3 + 7;
+            tmp4 = strstr( tmp_arena, "</cache>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            int cache_mb = atoi( tmp_arena );
+            if( cache_mb < 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid cache: %s", tmp_arena );
+                return false;
+            }
+            conf.m_cache_size = ( size_t )cache_mb * 1024 * 1024;
+        }
+        else if( tmp3 = strstr( tmp, "<cache_max_object>" ) )   // 可以缓存的单个响应的上限(字节)，默认1MB
+        {
+            tmp_arena = tmp3 + 18;
+            tmp4 = strstr( tmp_arena, "</cache_max_object>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            conf.m_cache_max_object = atoi( tmp_arena );
+            if( conf.m_cache_max_object <= 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid cache_max_object: %s", tmp_arena );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<engine>" ) )     // 事件引擎: epoll (默认) 或 uring (epoll_ctl与等待批量经过io_uring提交)
+        {
+            tmp_balance = tmp3 + 8;
+            tmp4 = strstr( tmp_balance, "</engine>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            if( strcmp( tmp_balance, "uring" ) == 0 )
+            {
+                conf.m_engine = ENGINE_URING;
+            }
+            else if( strcmp( tmp_balance, "epoll" ) == 0 )
+            {
+                conf.m_engine = ENGINE_EPOLL;
+            }
+            else
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "unknown engine: %s", tmp_balance );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<drain_timeout>" ) )  // SIGTERM后等待正在转发的连接结束的最长时间(毫秒)，默认10000，0表示立即退出
+        {
+            tmp_arena = tmp3 + 15;
+            tmp4 = strstr( tmp_arena, "</drain_timeout>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            conf.m_drain_timeout = atoi( tmp_arena );
+            if( conf.m_drain_timeout < 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid drain_timeout: %s", tmp_arena );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<workers>" ) )    // 子进程数量，与logical_host的数量无关，默认与CPU核数相同
+        {
+            tmp_workers = tmp3 + 9;
+            tmp4 = strstr( tmp_workers, "</workers>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            workers = atoi( tmp_workers );
+            if( workers < 0 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid workers: %s", tmp_workers );
+                return false;
+            }
+        }
+        else if( tmp3 = strstr( tmp, "<admin>" ) )      // 父进程提供/metrics的地址: ip:port 或只写port (监听127.0.0.1)
+        {
+            tmp_admin = tmp3 + 7;
+            tmp4 = strstr( tmp_admin, "</admin>" );
+            if( !tmp4 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+                return false;
+            }
+            *tmp4 = '\0';
+            char* colon = strchr( tmp_admin, ':' );
+            if( colon )
+            {
+                *colon++ = '\0';
+                if( strlen( tmp_admin ) >= sizeof( conf.m_admin_host ) )
+                {
+                    log( LOG_ERR, __FILE__, __LINE__, "invalid admin address: %s", tmp_admin );
+                    return false;
+                }
+                strcpy( conf.m_admin_host, tmp_admin );
+                tmp_admin = colon;
+            }
+            conf.m_admin_port = atoi( tmp_admin );
+            if( conf.m_admin_port <= 0 || conf.m_admin_port > 65535 )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "invalid admin port: %s", tmp_admin );
+                return false;
+            }
+        }
         else if( tmp3 = strstr( tmp, "Listen" ) )       // 对于第一行 Listen 127.0.0.1:8080
         {
             tmp_hostname = tmp3 + 6;
@@ -188,7 +695,7 @@ int main( int argc, char* argv[] )
             if( !tmp4 )
             {
                 log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
-                return 1;
+                return false;
             }
             *tmp4++ = '\0';
             tmp_host.m_port = atoi( tmp4 );
@@ -203,8 +710,104 @@ int main( int argc, char* argv[] )
     if( balance_srv.size() == 0 || logical_srv.size() == 0 )
     {
         log( LOG_ERR, __FILE__, __LINE__, "%s", "parse config file failed" );
+        return false;
+    }
+    return true;
+}
+
+// SIGHUP时父进程调用: 只取出logical_host，全局配置与Listen需要重启才能生效
+static bool reload_config( vector< host >& logical_srv )
+{
+    vector< host > balance_srv;
+    pool_conf conf;
+    int workers = 0;
+    return parse_config( cfg_file, balance_srv, logical_srv, conf, workers );
+}
+
+//ANSI C标准中几个标准预定义宏
+// __FILE__ :在源文件中插入当前原文件名
+// __LINE__ ：在源文件中插入当前源代码行号
+// _DATE_: 在源文件插入当前的编译日期
+// _TIME_: 在源文件中插入的编译时间
+// _STDC_ : 当要求程序严格遵循ANSI C 标准时刻标示被赋值为1
+// _cplusplus: 当编写C++程序时该标识符被定义
+int main( int argc, char* argv[] )
+{
+    int option;
+    // xvf是可选参数
+    while ( ( option = getopt( argc, argv, "f:l:xvh" ) ) != -1 )					//getopt函数用来分析命令行参数
+    {
+        switch ( option )
+        {
+            case 'x':
+            {
+                set_loglevel( LOG_DEBUG );										//log.cpp
+                break;
+            }
+            case 'l':  //日志文件，默认输出到标准输出
+            {
+                if( !set_logfile( optarg ) )
+                {
+                    log( LOG_ERR, __FILE__, __LINE__, "open log file %s failed: %s", optarg, strerror( errno ) );
+                    return 1;
+                }
+                break;
+            }
+            case 'v':  //版本信息
+            {
+                log( LOG_INFO, __FILE__, __LINE__, "%s %s", argv[0], version );
+                return 0;
+            }
+            case 'h':  //帮助 help
+            {
+                usage( basename( argv[ 0 ] ) ); // basename 返回文件名，而不是argv[0]整个文件的绝对路径
+                return 0;
+            }
+            case 'f':
+            {   
+                // optarg 是 -f 后边的 config_file
+                memcpy( cfg_file, optarg, strlen( optarg ) );		// cfg_file  此时的内容是 config.xml  比如运行时：./main -f config.xml
+                break;
+            }
+            case '?':  //无效的参数或者缺少参数的选项值
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "un-recognized option %c", option );
+                usage( basename( argv[ 0 ] ) );
+                return 1;
+            }
+        }
+    }    
+
+    // // cfg_file = config.xml
+    if( cfg_file[0] == '\0' ) 
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "%s", "please specifiy the config file" );
         return 1;
     }
+    vector< host > balance_srv;							//host在前面的mgr.h文件中定义   一个是负载均衡服务器
+    vector< host > logical_srv;                         //一个是逻辑服务器
+    int workers = 0;                                    //子进程数量，0表示与CPU核数相同
+    pool_conf conf;                                     //进程池的全局配置
+    if( !parse_config( cfg_file, balance_srv, logical_srv, conf, workers ) )
+    {
+        return 1;
+    }
+
+    // 每个子进程都连接所有的logical_host，子进程数量只由CPU核数(或<workers>)决定
+    if( workers == 0 )
+    {
+        workers = sysconf( _SC_NPROCESSORS_ONLN );
+    }
+    if( workers <= 0 )
+    {
+        workers = 1;
+    }
+    else if( workers > processpool< conn, host, mgr >::MAX_PROCESS_NUMBER )
+    {
+        workers = processpool< conn, host, mgr >::MAX_PROCESS_NUMBER;
+    }
+    log( LOG_INFO, __FILE__, __LINE__, "start %d workers for %d logical hosts", workers, ( int )logical_srv.size() );
+    conf.m_backends = logical_srv.size();
 
     // 只有一个主机地址即负载均衡服务器
     const char* ip = balance_srv[0].m_hostname;			//balance_srv数组里只有一个元素
@@ -224,17 +827,23 @@ int main( int argc, char* argv[] )
     int reuse = 1;
     ret = setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));    // 开启端口复用即主动断开连接时避免等待2MSL时间
     assert(ret != -1);
+    if( conf.m_accept_mode == ACCEPT_REUSEPORT )
+    {
+        // 子进程会在同一地址上打开各自的SO_REUSEPORT监听socket，组内所有socket都必须设置该选项
+        ret = setsockopt( listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof( reuse ) );
+        assert( ret != -1 );
+    }
 
     ret = bind( listenfd, ( struct sockaddr* )&address, sizeof( address ) );
     assert( ret != -1 );
 
-    ret = listen( listenfd, 5 );
+    ret = listen( listenfd, conf.m_backlog );
     assert( ret != -1 );
 
     /*
-    使用网易云的两个服务器的host (IP+Port+Conn) 创建一个进程池 
+    创建workers个子进程的进程池，每个子进程都与网易云的所有服务器 (IP+Port+Conn) 建立连接
     */
-    processpool< conn, host, mgr >* pool = processpool< conn, host, mgr >::create( listenfd, logical_srv.size() );
+    processpool< conn, host, mgr >* pool = processpool< conn, host, mgr >::create( listenfd, workers, conf );
     if( pool )
     {   
         // logical_src是一个vector数组，里边保存的是网易云网站的两个服务器
@@ -242,7 +851,7 @@ int main( int argc, char* argv[] )
         /*
         从这里开始，父进程与子进程都会执行下列的代码
         */
-        pool->run( logical_srv ); 
+        pool->run( logical_srv, reload_config );     // SIGHUP时父进程调用reload_config重新加载logical_host
         delete pool;
     }
 
@@ -0,0 +1,274 @@
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "metrics.h"
+#include "log.h"
+
+using std::string;
+using std::vector;
+
+// 计数器的名称、说明与在worker_metrics中的偏移
+struct counter_desc
+{
+    const char* m_name;
+    const char* m_help;
+    size_t m_offset;
+};
+
+static const counter_desc counters[] =
+{
+    { "springsnail_accepts_total", "Client connections handed to the worker.", offsetof( worker_metrics, m_accepts ) },
+    { "springsnail_pick_failures_total", "Clients refused because no backend connection was available.", offsetof( worker_metrics, m_pick_failures ) },
+    { "springsnail_client_bytes_total", "Bytes read from clients.", offsetof( worker_metrics, m_clt_bytes ) },
+    { "springsnail_server_bytes_total", "Bytes read from backends.", offsetof( worker_metrics, m_srv_bytes ) },
+    { "springsnail_backend_connects_total", "Backend connections established.", offsetof( worker_metrics, m_connects ) },
+    { "springsnail_backend_connect_failures_total", "Backend connections that failed or timed out.", offsetof( worker_metrics, m_connect_failures ) },
+    { "springsnail_backend_reconnects_total", "Backend connections re-established after release, failure or idle expiry.", offsetof( worker_metrics, m_reconnects ) },
+    { "springsnail_client_buffer_full_total", "Client reads that filled the relay buffer.", offsetof( worker_metrics, m_clt_buffer_full ) },
+    { "springsnail_server_buffer_full_total", "Backend reads that filled the relay buffer.", offsetof( worker_metrics, m_srv_buffer_full ) },
+    { "springsnail_idle_timeouts_total", "Client connections closed by the idle timeout.", offsetof( worker_metrics, m_idle_timeouts ) },
+    { "springsnail_backend_reuses_total", "Backend connections returned to the pool by keep-alive instead of reconnecting.", offsetof( worker_metrics, m_backend_reuses ) },
+    { "springsnail_http_dispatches_total", "Requests bound to a pooled backend connection in http mode.", offsetof( worker_metrics, m_http_dispatches ) },
+    { "springsnail_http_waits_total", "Requests queued in http mode because no backend connection was free.", offsetof( worker_metrics, m_http_waits ) },
+};
+
+// 三种延迟的名称、说明与在backend_latency中的偏移
+struct latency_desc
+{
+    const char* m_name;
+    const char* m_label;
+    const char* m_help;
+    size_t m_offset;
+};
+
+static const latency_desc latencies[] =
+{
+    { "springsnail_backend_connect_seconds", "connect", "Time to establish a backend connection.", offsetof( backend_latency, m_connect ) },
+    { "springsnail_backend_first_byte_seconds", "first_byte", "Time from writing a request to the backend until its first response bytes arrive.", offsetof( backend_latency, m_first_byte ) },
+    { "springsnail_connection_lifetime_seconds", "lifetime", "Time a client stays bound to a backend connection.", offsetof( backend_latency, m_lifetime ) },
+};
+
+static const double QUANTILES[] = { 0.5, 0.99, 0.999 };
+
+static const latency_histogram& latency_of( const backend_latency& latency, int kind )
+{
+    return *( const latency_histogram* )( ( const char* )&latency + latencies[kind].m_offset );
+}
+
+unsigned long long latency_histogram::bucket_upper( int idx )
+{
+    if( idx < 2 * SUB_BUCKETS )
+    {
+        return idx;
+    }
+    int shift = idx / SUB_BUCKETS - 1;
+    unsigned long long lower = ( unsigned long long )( idx - shift * SUB_BUCKETS ) << shift;
+    return lower + ( 1ULL << shift ) - 1;
+}
+
+void latency_histogram::merge( const latency_histogram& other )
+{
+    m_count += __atomic_load_n( &other.m_count, __ATOMIC_RELAXED );
+    m_sum += __atomic_load_n( &other.m_sum, __ATOMIC_RELAXED );
+    for( int i = 0; i < BUCKETS; ++i )
+    {
+        m_buckets[i] += __atomic_load_n( &other.m_buckets[i], __ATOMIC_RELAXED );
+    }
+}
+
+// 按桶中的计数求分位数，不依赖m_count，子进程正在写入时读到的结果也是自洽的
+unsigned long long latency_histogram::quantile( double q ) const
+{
+    unsigned long long total = 0;
+    for( int i = 0; i < BUCKETS; ++i )
+    {
+        total += m_buckets[i];
+    }
+    if( total == 0 )
+    {
+        return 0;
+    }
+    unsigned long long rank = ( unsigned long long )( q * total );     // 向上取整
+    if( rank < q * total )
+    {
+        ++rank;
+    }
+    if( rank < 1 )
+    {
+        rank = 1;
+    }
+    unsigned long long seen = 0;
+    for( int i = 0; i < BUCKETS; ++i )
+    {
+        seen += m_buckets[i];
+        if( seen >= rank )
+        {
+            return bucket_upper( i );
+        }
+    }
+    return bucket_upper( BUCKETS - 1 );
+}
+
+metrics_table::~metrics_table()
+{
+    if( m_metrics )
+    {
+        munmap( m_metrics, sizeof( worker_metrics ) * m_number );
+    }
+    if( m_latency )
+    {
+        munmap( m_latency, sizeof( backend_latency ) * m_number * m_backends );
+    }
+}
+
+bool metrics_table::init( int number, int backends )
+{
+    void* mem = mmap( NULL, sizeof( worker_metrics ) * number, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if( mem == MAP_FAILED )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "create metrics table failed: %s", strerror( errno ) );
+        return false;
+    }
+    m_metrics = ( worker_metrics* )mem;     // 匿名映射的内容全为0
+    m_number = number;
+
+    if( backends > 0 )
+    {
+        // 只有写入过的页才会分配物理内存，没有流量的logical_host几乎不占内存
+        mem = mmap( NULL, sizeof( backend_latency ) * number * backends, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+        if( mem == MAP_FAILED )
+        {
+            log( LOG_ERR, __FILE__, __LINE__, "create latency table failed: %s", strerror( errno ) );
+            return false;
+        }
+        m_latency = ( backend_latency* )mem;
+        m_backends = backends;
+    }
+    return true;
+}
+
+void metrics_table::reset( int idx )
+{
+    memset( &m_metrics[idx], 0, sizeof( worker_metrics ) );
+    if( m_backends > 0 )
+    {
+        memset( latency( idx ), 0, sizeof( backend_latency ) * m_backends );
+    }
+}
+
+void metrics_table::merge_latency( int backend, backend_latency& total ) const
+{
+    memset( &total, 0, sizeof( total ) );
+    for( int i = 0; i < m_number; ++i )
+    {
+        const backend_latency& latency = m_latency[ i * m_backends + backend ];
+        total.m_connect.merge( latency.m_connect );
+        total.m_first_byte.merge( latency.m_first_byte );
+        total.m_lifetime.merge( latency.m_lifetime );
+    }
+}
+
+void metrics_table::dump_latency( const vector< string >& names ) const
+{
+    backend_latency total;
+    for( int i = 0; i < m_backends && i < ( int )names.size(); ++i )
+    {
+        merge_latency( i, total );
+        for( int kind = 0; kind < ( int )( sizeof( latencies ) / sizeof( latencies[0] ) ); ++kind )
+        {
+            const latency_histogram& histogram = latency_of( total, kind );
+            log( LOG_INFO, __FILE__, __LINE__, "latency %s %s: count %llu, p50 %lluus, p99 %lluus, p999 %lluus", names[i].c_str(), latencies[kind].m_label,
+                 histogram.m_count, histogram.quantile( 0.5 ), histogram.quantile( 0.99 ), histogram.quantile( 0.999 ) );
+        }
+    }
+}
+
+static void append_header( string& out, const char* name, const char* help, const char* type )
+{
+    char line[256];
+    snprintf( line, sizeof( line ), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type );
+    out += line;
+}
+
+static void append_sample( string& out, const char* name, int worker, unsigned long long value )
+{
+    char line[128];
+    snprintf( line, sizeof( line ), "%s{worker=\"%d\"} %llu\n", name, worker, value );
+    out += line;
+}
+
+void metrics_table::render( string& out, const load_table& load, const bool* alive, int ejected_load, const vector< string >& names ) const
+{
+    for( int i = 0; i < ( int )( sizeof( counters ) / sizeof( counters[0] ) ); ++i )
+    {
+        append_header( out, counters[i].m_name, counters[i].m_help, "counter" );
+        for( int j = 0; j < m_number; ++j )
+        {
+            const unsigned long long* value = ( const unsigned long long* )( ( const char* )&m_metrics[j] + counters[i].m_offset );
+            append_sample( out, counters[i].m_name, j, __atomic_load_n( value, __ATOMIC_RELAXED ) );
+        }
+    }
+
+    append_header( out, "springsnail_worker_up", "Whether the worker process is running.", "gauge" );
+    for( int j = 0; j < m_number; ++j )
+    {
+        append_sample( out, "springsnail_worker_up", j, alive[j] ? 1 : 0 );
+    }
+    append_header( out, "springsnail_backends_available", "Whether the worker has at least one backend that is not ejected.", "gauge" );
+    for( int j = 0; j < m_number; ++j )
+    {
+        append_sample( out, "springsnail_backends_available", j, load.active( j ) < ejected_load ? 1 : 0 );
+    }
+    // 服务端都被摘除时负载表中没有真实的活跃连接数，不输出这一项
+    append_header( out, "springsnail_active_clients", "Clients currently relayed by the worker.", "gauge" );
+    for( int j = 0; j < m_number; ++j )
+    {
+        if( load.active( j ) < ejected_load )
+        {
+            append_sample( out, "springsnail_active_clients", j, load.active( j ) );
+        }
+    }
+    append_header( out, "springsnail_ready_backend_conns", "Idle backend connections in the worker's pools.", "gauge" );
+    for( int j = 0; j < m_number; ++j )
+    {
+        append_sample( out, "springsnail_ready_backend_conns", j, load.ready( j ) );
+    }
+    append_header( out, "springsnail_pending_accepts", "Connections assigned by the parent but not yet accepted.", "gauge" );
+    for( int j = 0; j < m_number; ++j )
+    {
+        int pending = load.pending( j );
+        append_sample( out, "springsnail_pending_accepts", j, pending > 0 ? pending : 0 );
+    }
+    append_header( out, "springsnail_relay_bytes_per_second", "Bytes relayed by the worker during the last second.", "gauge" );
+    for( int j = 0; j < m_number; ++j )
+    {
+        append_sample( out, "springsnail_relay_bytes_per_second", j, load.bytes_per_sec( j ) );
+    }
+
+    // 延迟按logical_host汇总所有子进程，以summary的形式输出
+    backend_latency* totals = new backend_latency[ m_backends ];
+    for( int i = 0; i < m_backends; ++i )
+    {
+        merge_latency( i, totals[i] );
+    }
+    for( int kind = 0; kind < ( int )( sizeof( latencies ) / sizeof( latencies[0] ) ); ++kind )
+    {
+        append_header( out, latencies[kind].m_name, latencies[kind].m_help, "summary" );
+        for( int i = 0; i < m_backends && i < ( int )names.size(); ++i )
+        {
+            const latency_histogram& histogram = latency_of( totals[i], kind );
+            char line[256];
+            for( int j = 0; j < ( int )( sizeof( QUANTILES ) / sizeof( QUANTILES[0] ) ); ++j )
+            {
+                snprintf( line, sizeof( line ), "%s{backend=\"%s\",quantile=\"%g\"} %.6f\n", latencies[kind].m_name, names[i].c_str(),
+                          QUANTILES[j], histogram.quantile( QUANTILES[j] ) / 1e6 );
+                out += line;
+            }
+            snprintf( line, sizeof( line ), "%s_sum{backend=\"%s\"} %.6f\n%s_count{backend=\"%s\"} %llu\n", latencies[kind].m_name, names[i].c_str(),
+                      histogram.m_sum / 1e6, latencies[kind].m_name, names[i].c_str(), histogram.m_count );
+            out += line;
+        }
+    }
+    delete [] totals;
+}
@@ -0,0 +1,120 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "loadtable.h"
+
+/*
+一个子进程的计数器，只由该子进程写入，独占cache line
+全部是只增不减的计数，gauge (活跃连接数、空闲连接数等) 直接取自负载表
+*/
+class worker_metrics
+{
+public:
+    unsigned long long m_accepts;           // 交给该子进程的客户端连接数
+    unsigned long long m_pick_failures;     // 没有可用的服务端连接而被拒绝的客户端数
+    unsigned long long m_clt_bytes;         // 从客户端读到的字节数
+    unsigned long long m_srv_bytes;         // 从服务端读到的字节数
+    unsigned long long m_connects;          // 建立成功的服务端连接数
+    unsigned long long m_connect_failures;  // 失败或超时的服务端连接数
+    unsigned long long m_reconnects;        // 释放、失败或空闲过期后重新发起的服务端连接数
+    unsigned long long m_clt_buffer_full;   // 读客户端时缓冲区满的次数
+    unsigned long long m_srv_buffer_full;   // 读服务端时缓冲区满的次数
+    unsigned long long m_idle_timeouts;     // 因空闲超时关闭的客户端连接数
+    unsigned long long m_backend_reuses;    // keep-alive模式下客户端离开后直接放回连接池的服务端连接数
+    unsigned long long m_http_dispatches;   // PROXY_HTTP模式下为请求分配服务端连接的次数
+    unsigned long long m_http_waits;        // PROXY_HTTP模式下请求到达时没有空闲的服务端连接而排队的次数
+} __attribute__( ( aligned( 64 ) ) );
+
+// 计数器只有一个写者，relaxed的读与写就足够，不需要带lock前缀的原子加
+inline void metric_add( unsigned long long& counter, unsigned long long n = 1 )
+{
+    __atomic_store_n( &counter, __atomic_load_n( &counter, __ATOMIC_RELAXED ) + n, __ATOMIC_RELAXED );
+}
+
+/*
+对数-线性(HDR风格)的延迟直方图，单位微秒，只由所属的子进程写入
+小于32的值每个值一个桶，之后每个2的幂区间平均分成16个桶，相对误差不超过1/16
+桶数组大小固定，记录一次只是三次relaxed的加法，不分配内存也不加锁，可以一直开着
+*/
+class latency_histogram
+{
+public:
+    static const int SUB_BUCKETS = 16;  // 每个2的幂区间的桶数
+    static const int BUCKETS = 528;     // 覆盖到2^36微秒(约19小时)，更大的值计入最后一个桶
+
+    void record( long long usec )
+    {
+        unsigned long long value = usec > 0 ? usec : 0;
+        metric_add( m_buckets[ bucket_of( value ) ] );
+        metric_add( m_count );
+        metric_add( m_sum, value );
+    }
+
+    static int bucket_of( unsigned long long value )
+    {
+        if( value < 2 * SUB_BUCKETS )
+        {
+            return value;
+        }
+        int shift = 63 - __builtin_clzll( value ) - 4;     // 保留最高的5位
+        int idx = shift * SUB_BUCKETS + ( int )( value >> shift );
+        return idx < BUCKETS ? idx : BUCKETS - 1;
+    }
+    static unsigned long long bucket_upper( int idx );     // 桶idx中最大的值
+
+    void merge( const latency_histogram& other );     // 把other的计数加到自己身上(父进程汇总所有子进程时使用)
+    unsigned long long quantile( double q ) const;    // 分位数q(0~1)所在桶的上界，没有样本时返回0
+
+public:
+    unsigned long long m_count;     // 样本数
+    unsigned long long m_sum;       // 样本之和(微秒)
+    unsigned long long m_buckets[ BUCKETS ];
+};
+
+// 一个子进程中一个logical_host的延迟
+class backend_latency
+{
+public:
+    latency_histogram m_connect;    // 从发起连接到连接建立
+    latency_histogram m_first_byte; // 请求写入服务端到服务端响应的第一批数据到达
+    latency_histogram m_lifetime;   // 客户端从分配到服务端连接到关闭
+};
+
+/*
+父子进程共享的计数器表，与load_table一样在fork之前mmap(MAP_SHARED)
+子进程的事件循环中计数不需要任何系统调用，父进程在admin端口收到请求时才汇总
+*/
+class metrics_table
+{
+public:
+    metrics_table() : m_metrics( NULL ), m_latency( NULL ), m_number( 0 ), m_backends( 0 ){}
+    ~metrics_table();
+    bool init( int number, int backends );  // 在fork之前调用，number为子进程数量，backends为logical_host的数量
+
+    worker_metrics* get( int idx ) { return &m_metrics[idx]; }
+    backend_latency* latency( int idx ) { return &m_latency[ idx * m_backends ]; }   // 子进程idx的延迟，按logical_host的下标排列
+    void reset( int idx );      // 子进程重新启动前清零它的一项
+
+    /*
+    以Prometheus文本格式输出所有子进程的计数器与负载表中的gauge
+    alive[i]表示子进程i是否在运行，负载表中的活跃连接数不小于ejected_load时表示该子进程的服务端都被摘除了
+    延迟按logical_host汇总所有子进程后输出分位数，names为各logical_host的标签
+    */
+    void render( std::string& out, const load_table& load, const bool* alive, int ejected_load, const std::vector< std::string >& names ) const;
+
+    void dump_latency( const std::vector< std::string >& names ) const;    // 把各logical_host延迟的p50/p99/p999写入日志 (SIGUSR1)
+
+private:
+    void merge_latency( int backend, backend_latency& total ) const;   // 汇总所有子进程中logical_host backend的延迟
+
+private:
+    worker_metrics* m_metrics;
+    backend_latency* m_latency;     // m_number * m_backends项
+    int m_number;
+    int m_backends;
+};
+
+#endif
@@ -13,27 +13,71 @@
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #include <exception>
+#include <new>
 #include "log.h"
 #include "mgr.h"
 
-using std::pair;
-
 int mgr::m_epollfd = -1;
 
+void conn_list::push( conn* connection )
+{
+    connection->m_prev = NULL;
+    connection->m_next = m_head;
+    if( m_head )
+    {
+        m_head->m_prev = connection;
+    }
+    m_head = connection;
+    ++m_size;
+}
 
-//和服务端建立连接同时返回socket描述符
+void conn_list::erase( conn* connection )
+{
+    if( connection->m_prev )
+    {
+        connection->m_prev->m_next = connection->m_next;
+    }
+    else
+    {
+        m_head = connection->m_next;
+    }
+    if( connection->m_next )
+    {
+        connection->m_next->m_prev = connection->m_prev;
+    }
+    connection->m_prev = NULL;
+    connection->m_next = NULL;
+    --m_size;
+}
+
+conn* conn_list::pop()
+{
+    conn* connection = m_head;
+    if( connection )
+    {
+        erase( connection );
+    }
+    return connection;
+}
+
+
+/*
+向服务端发起非阻塞连接同时返回socket描述符，不等待连接完成
+连接的结果通过EPOLLOUT通知，由finish_connect处理
+*/
 int mgr::conn2srv( const sockaddr_in& address )
 {
-    int sockfd = socket( PF_INET, SOCK_STREAM, 0 );
+    int sockfd = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0 );
     if( sockfd < 0 )
     {
         return -1;
     }
 
     // 连接逻辑服务器即网易云服务器
-    if ( connect( sockfd, ( struct sockaddr* )&address, sizeof( address ) ) != 0  )  //同逻辑服务器相连接
+    if ( connect( sockfd, ( struct sockaddr* )&address, sizeof( address ) ) != 0 && errno != EINPROGRESS )  //同逻辑服务器相连接
     {
         close( sockfd );
         return -1;
@@ -41,129 +85,947 @@ int mgr::conn2srv( const sockaddr_in& address )
     return sockfd;
 }
 
-//在构造mgr的同时调用conn2srv和服务端建立连接
-mgr::mgr( int epollfd, const host& srv ) : m_logic_srv( srv )
+// 为connection发起到服务端的连接，发起成功后放入m_connecting并开始计算连接超时，否则等待退避后重试
+void mgr::start_connect( conn* connection )
 {
-    m_epollfd = epollfd;
-    int ret = 0;
-    struct sockaddr_in address;
-    bzero( &address, sizeof( address ) );
-    address.sin_family = AF_INET;
-    inet_pton( AF_INET, srv.m_hostname, &address.sin_addr );
-    address.sin_port = htons( srv.m_port );
-    log( LOG_INFO, __FILE__, __LINE__, "logcial srv host info: (%s, %d)", srv.m_hostname, srv.m_port );
+    m_wheel->del( &connection->m_timer );
+    int srvfd = conn2srv( connection->m_srv_address );
+    if( srvfd < 0 )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "connect to server failed: %s", strerror( errno ) );
+        metric_add( m_stats->m_connect_failures );
+        schedule_retry( connection );
+        return;
+    }
+    connection->init_srv( srvfd, connection->m_srv_address );
+    connection->m_state = CONN_CONNECTING;
+    connection->m_connect_start = monotonic_usec();
+    bind_fd( srvfd, connection );
+    add_write_fd( m_epollfd, srvfd );   // 连接完成(无论成功与否)时可写
+    connection->m_backend->m_connecting.push( connection );
+    m_wheel->add( &connection->m_timer, connection->m_backend->m_logic_srv.m_connect_timeout );
+}
+
+// 非阻塞连接有了结果，成功则放入m_conns，失败则关闭后等待退避重试
+RET_CODE mgr::finish_connect( conn* connection )
+{
+    backend* srv = connection->m_backend;
+    int srvfd = connection->m_srvfd;
+    int error = 0;
+    socklen_t len = sizeof( error );
+    if( getsockopt( srvfd, SOL_SOCKET, SO_ERROR, &error, &len ) < 0 )
+    {
+        error = errno;
+    }
+    sockaddr_in peer;
+    socklen_t peer_len = sizeof( peer );
+    if( error == 0 && getpeername( srvfd, ( struct sockaddr* )&peer, &peer_len ) < 0 && errno == ENOTCONN )
+    {
+        return NOTHING;     // 复用了旧fd编号的过期事件，连接其实还没有完成
+    }
+    m_wheel->del( &connection->m_timer );
+    srv->m_connecting.erase( connection );
+    bind_fd( srvfd, NULL );
+    if( error != 0 )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "build connection to server %s:%d failed: %s", srv->m_logic_srv.m_hostname, srv->m_logic_srv.m_port, strerror( error ) );
+        srv->m_health->on_failure();
+        metric_add( m_stats->m_connect_failures );
+        closefd( m_epollfd, srvfd );
+        schedule_retry( connection );
+        return IOERR;
+    }
+    log_debug( "build connection %d to server success", srvfd );
+    srv->m_health->on_success();
+    metric_add( m_stats->m_connects );
+    srv->m_latency->m_connect.record( monotonic_usec() - connection->m_connect_start );
+    removefd( m_epollfd, srvfd );   // 空闲的连接不在内核事件表中，pick_conn时再注册
+    connection->m_retry_delay = 0;
+    connection->m_state = CONN_READY;
+    srv->m_conns.push( connection );
+    if( srv->m_logic_srv.m_srv_idle_timeout > 0 )
+    {
+        m_wheel->add( &connection->m_timer, srv->m_logic_srv.m_srv_idle_timeout );
+    }
+    serve_waiting();
+    return NOTHING;
+}
+
+// 放入m_freed，按指数退避(RETRY_MIN_DELAY, 2倍, ..., RETRY_MAX_DELAY)安排下一次连接
+void mgr::schedule_retry( conn* connection )
+{
+    int delay = connection->m_retry_delay * 2;
+    if( delay < RETRY_MIN_DELAY )
+    {
+        delay = RETRY_MIN_DELAY;
+    }
+    else if( delay > RETRY_MAX_DELAY )
+    {
+        delay = RETRY_MAX_DELAY;
+    }
+    connection->m_retry_delay = delay;
+    connection->m_state = CONN_FREED;
+    connection->m_backend->m_freed.push( connection );
+    m_wheel->add( &connection->m_timer, delay );
+}
 
-    for( int i = 0; i < srv.m_conncnt; ++i )
+/*
+每个conn只有一个定时器，含义由conn当前的状态决定:
+CONN_CONNECTING: 连接超时   CONN_FREED: 退避结束，重新连接
+CONN_READY: 空闲的服务端连接太久没有使用，重新建立以免被服务端悄悄关闭
+CONN_USED: 客户端与服务端之间太久没有数据，关闭这一对连接
+*/
+void mgr::on_timer( timer* t )
+{
+    if( t == &m_drain_timer )
+    {
+        log( LOG_INFO, __FILE__, __LINE__, "drain deadline passed, cut %d clients", get_clt_cnt() );
+        m_drain_expired = true;
+        return;
+    }
+    conn* connection = ( conn* )t->m_data;
+    backend* srv = connection->m_backend;
+    switch( connection->m_state )
     {
-        int sockfd = conn2srv( address );   // 与逻辑服务器连接多次，比如5次
-        if( sockfd < 0 )
+        case CONN_CONNECTING:
         {
-            log( LOG_ERR, __FILE__, __LINE__, "build connection %d failed", i );
+            log( LOG_ERR, __FILE__, __LINE__, "connect to server %s:%d timeout, sock %d", srv->m_logic_srv.m_hostname, srv->m_logic_srv.m_port, connection->m_srvfd );
+            srv->m_health->on_failure();
+            metric_add( m_stats->m_connect_failures );
+            srv->m_connecting.erase( connection );
+            bind_fd( connection->m_srvfd, NULL );
+            closefd( m_epollfd, connection->m_srvfd );
+            schedule_retry( connection );
+            break;
         }
-        else
+        case CONN_FREED:
         {
-            log( LOG_INFO, __FILE__, __LINE__, "build connection %d to server success", i );
-            conn* tmp = NULL;
-            try
-            {
-                tmp = new conn;
-            }
-            catch( ... )
+            srv->m_freed.erase( connection );
+            metric_add( m_stats->m_reconnects );
+            start_connect( connection );
+            break;
+        }
+        case CONN_READY:
+        {
+            srv->m_conns.erase( connection );
+            close_queued( m_epollfd, connection->m_srvfd );
+            metric_add( m_stats->m_reconnects );
+            start_connect( connection );
+            break;
+        }
+        case CONN_USED:
+        {
+            // 有数据时只记录m_last_active，定时器到期时才判断是否真正空闲
+            int idle_ms = ( int )( m_wheel->now() - connection->m_last_active ) * timer_wheel::TICK_MS;
+            int timeout = srv->m_logic_srv.m_clt_idle_timeout;
+            if( idle_ms < timeout )
             {
-                close( sockfd );
-                continue;
+                m_wheel->add( t, timeout - idle_ms );
+                break;
             }
-            tmp->init_srv( sockfd, address );   // 初始化主机服务器
-            m_conns.insert( pair< int, conn* >( sockfd, tmp ) );    // 如果没有连接成功，就放入待连接序列
+            log_debug( "close idle client sock %d with server sock %d", connection->m_cltfd, connection->m_srvfd );
+            metric_add( m_stats->m_idle_timeouts );
+            free_conn( connection );
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+//在构造mgr的同时调用conn2srv和所有服务端建立连接
+mgr::mgr( int epollfd, const vector< host >& srvs, arena* pool, timer_wheel* wheel, int policy, worker_metrics* stats, backend_latency* latency,
+          int mode, int keepalive_timeout, http_cache* cache, const vector< int >* slots )
+    : m_latency( latency ), m_scheduler( scheduler::create( policy ) ), m_relayed_bytes( 0 ), m_arena( pool ), m_wheel( wheel ), m_stats( stats ),
+      m_mode( mode ), m_keepalive_timeout( keepalive_timeout ), m_serving( false ),
+      m_client_cnt( 0 ), m_draining( false ), m_drain_expired( false ), m_cache( mode == PROXY_HTTP ? cache : NULL )
+{
+    m_epollfd = epollfd;
+    log( LOG_INFO, __FILE__, __LINE__, "balance policy: %s, mode: %s", scheduler::policy_name( policy ), mode == PROXY_HTTP ? "http" : "tcp" );
+    for( int i = 0; i < ( int )srvs.size(); ++i )
+    {
+        add_backend( srvs[i], slots ? ( *slots )[i] : i );
+    }
+}
+
+backend* mgr::add_backend( const host& logic, int slot )
+{
+    backend* srv = new backend( m_backends.size(), logic, slot );
+    host& logic_srv = srv->m_logic_srv;
+    if( m_mode == PROXY_HTTP )
+    {
+        logic_srv.m_keepalive = true;   // 按请求转发需要知道每个响应在哪里结束
+    }
+    bzero( &srv->m_address, sizeof( srv->m_address ) );
+    srv->m_address.sin_family = AF_INET;
+    inet_pton( AF_INET, logic_srv.m_hostname, &srv->m_address.sin_addr );
+    srv->m_address.sin_port = htons( logic_srv.m_port );
+    log( LOG_INFO, __FILE__, __LINE__, "logcial srv host info: (%s, %d), relay: %s, bufsize: %d, weight: %d, keepalive: %s", logic_srv.m_hostname, logic_srv.m_port, logic_srv.m_splice ? "splice" : "buffer", logic_srv.m_bufsize, logic_srv.m_weight, logic_srv.m_keepalive ? "on" : "off" );
+    if( logic_srv.m_splice && logic_srv.m_keepalive )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "%s", "keepalive needs to see the relayed data, splice relay disabled" );
+    }
+    srv->m_health = new host_health( m_epollfd, m_wheel, logic_srv.m_health, logic_srv.m_hostname, srv->m_address );
+    srv->m_latency = &m_latency[ slot ];
+    m_backends.push_back( srv );
+    m_sched.push_back( sched_entry() );
+
+    // 与逻辑服务器连接多次，比如5次；所有连接同时发起，不逐个等待
+    add_conns( srv, logic_srv.m_conncnt );
+    return srv;
+}
+
+void mgr::add_conns( backend* srv, int cnt )
+{
+    const host& logic_srv = srv->m_logic_srv;
+    for( int j = 0; j < cnt; ++j )
+    {
+        conn* tmp = new_conn( srv );
+        if( !tmp )
+        {
+            log( LOG_ERR, __FILE__, __LINE__, "build connection %d failed", j );
+            continue;
+        }
+        tmp->init_srv( -1, srv->m_address );   // 初始化主机服务器
+        tmp->m_backend = srv;
+        tmp->m_timer.m_handler = this;
+        tmp->m_timer.m_data = tmp;
+        tmp->m_http = logic_srv.m_keepalive;
+        tmp->m_cache_limit = m_cache ? m_cache->max_object() : 0;
+        if( logic_srv.m_splice && !logic_srv.m_keepalive )
+        {
+            tmp->init_splice();             // 失败时该连接退回到缓冲区转发
+        }
+        start_connect( tmp );
+    }
+}
+
+/*
+新旧logical_host按slot对应(父进程按"ip:port"分配，同一个服务端在每次重新加载后slot不变)
+仍在配置中的服务端原地更新配置并调整连接池大小，正在转发的连接不受影响；bufsize、relay与keepalive只对之后新建的连接生效，健康检查的配置变化时重新开始检查
+不在新配置中的服务端进入draining：不再分配给客户端，空闲的连接立即关闭，正在使用的连接在客户端离开时关闭，全部关闭后删除
+*/
+void mgr::reload( const vector< host >& srvs, const vector< int >& slots )
+{
+    int old_cnt = m_backends.size();
+    vector< bool > kept( old_cnt, false );
+    for( int i = 0; i < ( int )srvs.size(); ++i )
+    {
+        int j = 0;
+        while( j < old_cnt && m_backends[j]->m_slot != slots[i] )
+        {
+            ++j;
+        }
+        if( j == old_cnt )
+        {
+            log( LOG_INFO, __FILE__, __LINE__, "reload: add logical host %s:%d", srvs[i].m_hostname, srvs[i].m_port );
+            add_backend( srvs[i], slots[i] );
+            continue;
+        }
+        kept[j] = true;
+        backend* srv = m_backends[j];
+        host& logic_srv = srv->m_logic_srv;
+        int old_conncnt = logic_srv.m_conncnt;
+        bool health_changed = !logic_srv.m_health.same( srvs[i].m_health );
+        logic_srv = srvs[i];
+        if( m_mode == PROXY_HTTP )
+        {
+            logic_srv.m_keepalive = true;
+        }
+        srv->m_draining = false;
+        if( health_changed )
+        {
+            delete srv->m_health;
+            srv->m_health = new host_health( m_epollfd, m_wheel, logic_srv.m_health, logic_srv.m_hostname, srv->m_address );
+        }
+        if( old_conncnt != logic_srv.m_conncnt )
+        {
+            log( LOG_INFO, __FILE__, __LINE__, "reload: logical host %s:%d conns %d -> %d", logic_srv.m_hostname, logic_srv.m_port, old_conncnt, logic_srv.m_conncnt );
+        }
+        if( srv->pool_size() < logic_srv.m_conncnt )
+        {
+            add_conns( srv, logic_srv.m_conncnt - srv->pool_size() );
+        }
+        else
+        {
+            trim_pool( srv );
+        }
+    }
+    for( int j = old_cnt - 1; j >= 0; --j )     // 从后往前，删除的服务端只会影响已经处理过的下标
+    {
+        backend* srv = m_backends[j];
+        if( !kept[j] && !srv->m_draining )
+        {
+            log( LOG_INFO, __FILE__, __LINE__, "reload: drain logical host %s:%d, %d connections in use", srv->m_logic_srv.m_hostname, srv->m_logic_srv.m_port, srv->m_used_cnt );
+            srv->m_draining = true;
+            trim_pool( srv );
         }
     }
 }
 
+void mgr::trim_pool( backend* srv )
+{
+    int target = srv->m_draining ? 0 : srv->m_logic_srv.m_conncnt;
+    conn* tmp = NULL;
+    while( srv->pool_size() > target && ( tmp = srv->m_freed.pop() ) )
+    {
+        delete_conn( tmp );
+    }
+    while( srv->pool_size() > target && ( tmp = srv->m_conns.pop() ) )
+    {
+        close_queued( m_epollfd, tmp->m_srvfd );    // 空闲的连接不在内核事件表中，但removefd的DEL可能还在排队
+        delete_conn( tmp );
+    }
+    while( srv->pool_size() > target && ( tmp = srv->m_connecting.pop() ) )
+    {
+        bind_fd( tmp->m_srvfd, NULL );
+        closefd( m_epollfd, tmp->m_srvfd );
+        delete_conn( tmp );
+    }
+    if( srv->m_draining && srv->pool_size() == 0 )
+    {
+        remove_backend( srv );
+    }
+}
+
+// connection已经离开m_used，不计入pool_size()
+bool mgr::retire_conn( conn* connection )
+{
+    backend* srv = connection->m_backend;
+    int target = srv->m_draining ? 0 : srv->m_logic_srv.m_conncnt;
+    if( srv->pool_size() < target )
+    {
+        return false;
+    }
+    log_debug( "retire server sock %d, pool of %s:%d shrinks", connection->m_srvfd, srv->m_logic_srv.m_hostname, srv->m_logic_srv.m_port );
+    closefd( m_epollfd, connection->m_srvfd );
+    delete_conn( connection );
+    if( srv->m_draining && srv->pool_size() == 0 )
+    {
+        remove_backend( srv );
+    }
+    return true;
+}
+
+void mgr::remove_backend( backend* srv )
+{
+    log( LOG_INFO, __FILE__, __LINE__, "reload: logical host %s:%d drained, removed", srv->m_logic_srv.m_hostname, srv->m_logic_srv.m_port );
+    int idx = srv->m_idx;
+    m_backends.erase( m_backends.begin() + idx );
+    m_sched.erase( m_sched.begin() + idx );
+    for( int i = idx; i < ( int )m_backends.size(); ++i )
+    {
+        m_backends[i]->m_idx = i;
+    }
+    delete srv->m_health;
+    delete srv;
+}
+
+// 子进程退出时关闭所有连接，并把conn归还给内存池
 mgr::~mgr()
 {
-    // 无析构
-    // 暂时没有考虑内存泄漏
+    conn* tmp = NULL;
+    while( ( tmp = m_used.pop() ) )
+    {
+        closefd( m_epollfd, tmp->m_cltfd );
+        drop_clt( tmp->m_cltfd );
+        closefd( m_epollfd, tmp->m_srvfd );
+        delete_conn( tmp );
+    }
+    for( int i = 0; i < ( int )m_clients.size(); ++i )     // 两次请求之间的客户端
+    {
+        if( m_clients[i] )
+        {
+            closefd( m_epollfd, i );
+            drop_clt( i );
+        }
+    }
+    for( int i = 0; i < ( int )m_backends.size(); ++i )
+    {
+        backend* srv = m_backends[i];
+        while( ( tmp = srv->m_conns.pop() ) )
+        {
+            close_queued( m_epollfd, tmp->m_srvfd );
+            delete_conn( tmp );
+        }
+        while( ( tmp = srv->m_connecting.pop() ) )
+        {
+            closefd( m_epollfd, tmp->m_srvfd );
+            delete_conn( tmp );
+        }
+        while( ( tmp = srv->m_freed.pop() ) )
+        {
+            delete_conn( tmp );
+        }
+        delete srv->m_health;
+        delete srv;
+    }
+    m_wheel->del( &m_drain_timer );
+    delete m_scheduler;
+}
+
+/*
+conn对象优先放在内存池中，使同一个子进程的conn在内存中连续排列
+内存池不可用或已用完时退回到堆
+*/
+conn* mgr::new_conn( backend* srv )
+{
+    void* mem = m_arena ? m_arena->alloc( sizeof( conn ) ) : NULL;
+    try
+    {
+        if( mem )
+        {
+            return new ( mem ) conn( srv->m_logic_srv.m_bufsize, m_arena );
+        }
+        return new conn( srv->m_logic_srv.m_bufsize, m_arena );
+    }
+    catch( ... )
+    {
+        if( mem )
+        {
+            m_arena->release( mem, sizeof( conn ) );
+        }
+        return NULL;
+    }
 }
 
-// 获取当前任务数 (被notify_parent_busy_ratio)调用
+void mgr::delete_conn( conn* connection )
+{
+    m_wheel->del( &connection->m_timer );
+    if( m_arena && m_arena->owns( connection ) )
+    {
+        connection->~conn();
+        m_arena->release( connection, sizeof( conn ) );
+    }
+    else
+    {
+        delete connection;
+    }
+}
+
+// 获取当前任务数
 int mgr::get_used_conn_cnt()
 {
     return m_used.size();
 }
 
-conn* mgr::pick_conn( int cltfd  )
+/*
+报告给父进程的负载 (由子进程写入负载表)
+正常时就是当前任务数；所有服务端都被摘除时为EJECTED_BUSY_RATIO，父进程不再分配新连接
+*/
+int mgr::get_busy_ratio()
+{
+    for( int i = 0; i < ( int )m_backends.size(); ++i )
+    {
+        if( !m_backends[i]->m_draining && m_backends[i]->m_health->is_up() )
+        {
+            return m_used.size();
+        }
+    }
+    return EJECTED_BUSY_RATIO;
+}
+
+int mgr::get_clt_cnt()
+{
+    return m_mode == PROXY_HTTP ? m_client_cnt : m_used.size();     // PROXY_HTTP模式下m_used中的客户端也在m_clients中
+}
+
+/*
+停止accept之后调用，正在转发的连接照常进行，直到客户端离开或者期限到达
+PROXY_HTTP模式下两次请求之间的客户端没有进行中的请求，立即关闭；请求已经到达socket的照常处理，响应写完后关闭，不再等待下一个请求
+排队的客户端已经发来了请求，仍然按顺序分配服务端连接
+*/
+void mgr::drain( int timeout )
+{
+    m_draining = true;
+    m_drain_timer.m_handler = this;
+    m_wheel->add( &m_drain_timer, timeout );
+    for( int fd = 0; fd < ( int )m_clients.size(); ++fd )
+    {
+        http_client* clt = m_clients[ fd ];
+        if( !clt || clt->m_waiting || !clt->m_out.empty() || find_conn( fd ) )
+        {
+            continue;
+        }
+        char c;
+        if( recv( fd, &c, 1, MSG_PEEK ) > 0 )
+        {
+            continue;       // 事件随后处理
+        }
+        closefd( m_epollfd, fd );
+        drop_clt( fd );
+    }
+    log( LOG_INFO, __FILE__, __LINE__, "drain %d clients, deadline %dms", get_clt_cnt(), timeout );
+}
+
+int mgr::get_ready_conn_cnt()
+{
+    int cnt = 0;
+    for( int i = 0; i < ( int )m_backends.size(); ++i )
+    {
+        cnt += m_backends[i]->m_conns.size();
+    }
+    return cnt;
+}
+
+/*
+每次选择前刷新调度信息：慢启动期间按流量比例缩小权重，使新恢复的服务端少分到客户端
+被摘除或没有空闲连接的服务端不参与调度
+*/
+backend* mgr::select_backend()
 {
-    if( m_conns.empty() )
+    int cnt = m_backends.size();
+    for( int i = 0; i < cnt; ++i )
+    {
+        backend* srv = m_backends[i];
+        int percent = srv->m_health->weight_percent();
+        m_sched[i].m_weight = srv->m_logic_srv.m_weight * percent;
+        m_sched[i].m_load = srv->m_used_cnt;
+        m_sched[i].m_available = !srv->m_draining && percent > 0 && !srv->m_conns.empty();
+    }
+    int idx = cnt > 0 ? m_scheduler->select( &m_sched[0], cnt ) : -1;
+    return idx >= 0 ? m_backends[idx] : NULL;
+}
+
+conn* mgr::find_conn( int fd )
+{
+    if( fd < 0 || fd >= ( int )m_fd_table.size() )
     {
-        log( LOG_ERR, __FILE__, __LINE__, "%s", "not enough srv connections to server" );
         return NULL;
     }
+    return m_fd_table[ fd ];
+}
 
-    map< int, conn* >::iterator iter =  m_conns.begin();
-    int srvfd = iter->first;
-    conn* tmp = iter->second;
+void mgr::bind_fd( int fd, conn* connection )
+{
+    if( fd >= ( int )m_fd_table.size() )
+    {
+        m_fd_table.resize( ( fd + 1 ) * 2, NULL );  // 按需翻倍扩容，均摊后不会频繁分配
+    }
+    m_fd_table[ fd ] = connection;
+}
+
+conn* mgr::pick_conn( int cltfd, bool registered )
+{
+    conn* tmp = take_conn( cltfd, registered );
     if( !tmp )
     {
-        log( LOG_ERR, __FILE__, __LINE__, "%s", "empty server connection object" );
+        log( LOG_ERR, __FILE__, __LINE__, "%s", "no healthy server with free connections, refuse client" );
+        metric_add( m_stats->m_pick_failures );
+    }
+    return tmp;
+}
+
+conn* mgr::take_conn( int cltfd, bool registered )
+{
+    backend* srv = select_backend();
+    if( !srv )
+    {
         return NULL;
     }
-    m_conns.erase( iter );
-    m_used.insert( pair< int, conn* >( cltfd, tmp ) );
-    m_used.insert( pair< int, conn* >( srvfd, tmp ) );
-    add_read_fd( m_epollfd, cltfd );
+    conn* tmp = srv->m_conns.pop();
+    m_wheel->del( &tmp->m_timer );
+    // 复用的空闲连接可能已被服务端的keep-alive超时关闭；刚放回连接池的不必检查，省去一次系统调用
+    if( tmp->m_http && ( int )( m_wheel->now() - tmp->m_last_active ) * timer_wheel::TICK_MS >= REUSE_CHECK_DELAY && !tmp->srv_reusable() )
+    {
+        log_debug( "idle server sock %d closed by server, reconnect", tmp->m_srvfd );
+        close_queued( m_epollfd, tmp->m_srvfd );
+        metric_add( m_stats->m_reconnects );
+        start_connect( tmp );
+        return take_conn( cltfd, registered );  // 每次都有一个连接离开m_conns，递归次数不超过空闲连接数
+    }
+    int srvfd = tmp->m_srvfd;
+    tmp->m_state = CONN_USED;
+    tmp->m_last_active = m_wheel->now();
+    tmp->m_clt_start = monotonic_usec();
+    m_used.push( tmp );
+    ++srv->m_used_cnt;
+    if( srv->m_logic_srv.m_clt_idle_timeout > 0 )
+    {
+        m_wheel->add( &tmp->m_timer, srv->m_logic_srv.m_clt_idle_timeout );
+    }
+    bind_fd( cltfd, tmp );
+    bind_fd( srvfd, tmp );
+    if( !registered )
+    {
+        add_read_fd( m_epollfd, cltfd );
+    }
     add_read_fd( m_epollfd, srvfd );
-    log( LOG_INFO, __FILE__, __LINE__, "bind client sock %d with server sock %d", cltfd, srvfd );
+    log_debug( "bind client sock %d with server sock %d", cltfd, srvfd );
     return tmp;
 }
 
-// 释放连接 (当连接关闭或者中断后，将其fd从内核事件表删除，并关闭fd)，并并将同srv进行连接的放入m_freed中
+/*
+释放连接 (当连接关闭或者中断后，将其fd从内核事件表删除，并关闭fd)
+keep-alive模式下服务端连接停在HTTP消息边界时直接放回m_conns，省去一次握手，也不在服务端留下TIME_WAIT
+否则关闭服务端连接并立即重新向服务端发起连接
+*/
 void mgr::free_conn( conn* connection )
 {
     int cltfd = connection->m_cltfd;
     int srvfd = connection->m_srvfd;
+    m_wheel->del( &connection->m_timer );
     closefd( m_epollfd, cltfd );
+    drop_clt( cltfd );
+    bind_fd( cltfd, NULL );
+    bind_fd( srvfd, NULL );
+    m_used.erase( connection );
+    --connection->m_backend->m_used_cnt;
+    connection->m_backend->m_latency->m_lifetime.record( monotonic_usec() - connection->m_clt_start );
+    if( retire_conn( connection ) )     // 重新加载后连接池变小或服务端已删除
+    {
+        return;
+    }
+    if( connection->srv_reusable() )
+    {
+        reuse_conn( connection );
+        return;
+    }
     closefd( m_epollfd, srvfd );
-    m_used.erase( cltfd );
-    m_used.erase( srvfd );
     connection->reset();
-    m_freed.insert( pair< int, conn* >( srvfd, connection ) );
+    connection->m_state = CONN_FREED;
+    connection->m_retry_delay = 0;
+    metric_add( m_stats->m_reconnects );
+    start_connect( connection );    // 不再等到事件循环空闲时才回收，连接池在高负载下也能及时补满
 }
 
-// 从m_freed中回收连接 (由于连接已经被关闭，因此还要调用conn2srv() )放到m_conn中
-void mgr::recycle_conns()
+void mgr::reuse_conn( conn* connection )
+{
+    backend* srv = connection->m_backend;
+    log_debug( "reuse server sock %d", connection->m_srvfd );
+    removefd( m_epollfd, connection->m_srvfd );     // 与新建立的连接一样，空闲时不在内核事件表中
+    connection->reset();
+    connection->m_state = CONN_READY;
+    connection->m_last_active = m_wheel->now();
+    srv->m_conns.push( connection );
+    metric_add( m_stats->m_backend_reuses );
+    if( srv->m_logic_srv.m_srv_idle_timeout > 0 )
+    {
+        m_wheel->add( &connection->m_timer, srv->m_logic_srv.m_srv_idle_timeout );
+    }
+    serve_waiting();
+}
+
+bool mgr::serve_clt( int cltfd, const sockaddr_in& address )
+{
+    if( m_mode == PROXY_TCP )
+    {
+        conn* connection = pick_conn( cltfd );    // 获取一个空闲的连接，同时把cltfd加入内核事件表
+        if( !connection )
+        {
+            return false;
+        }
+        connection->init_clt( cltfd, address );
+        return true;
+    }
+
+    // 第一个请求到来之前不占用服务端连接，请求可能已经到达，加入内核事件表时立即触发
+    if( cltfd >= ( int )m_clients.size() )
+    {
+        m_clients.resize( ( cltfd + 1 ) * 2, NULL );
+    }
+    http_client* clt = new http_client( this, cltfd, address, m_arena );
+    m_clients[ cltfd ] = clt;
+    ++m_client_cnt;
+    add_read_fd( m_epollfd, cltfd );
+    if( m_keepalive_timeout > 0 )
+    {
+        m_wheel->add( &clt->m_timer, m_keepalive_timeout );
+    }
+    return true;
+}
+
+/*
+一次交互结束：请求都有了完整的响应并且已经写给客户端，客户端也没有发来下一个请求的数据
+客户端留在内核事件表中等待下一个请求，服务端连接放回连接池，可以立即交给其它客户端的请求
+*/
+void mgr::park_clt( conn* connection )
 {
-    if( m_freed.empty() )
+    int cltfd = connection->m_cltfd;
+    m_wheel->del( &connection->m_timer );
+    bind_fd( cltfd, NULL );
+    bind_fd( connection->m_srvfd, NULL );
+    m_used.erase( connection );
+    --connection->m_backend->m_used_cnt;
+    connection->m_backend->m_latency->m_lifetime.record( monotonic_usec() - connection->m_clt_start );
+    if( m_draining )    // 子进程正在退出，不再等待下一个请求
+    {
+        closefd( m_epollfd, cltfd );
+        drop_clt( cltfd );
+    }
+    else
+    {
+        modfd( m_epollfd, cltfd, EPOLLIN );     // 之前可能在等待EPOLLOUT，已经到达的数据会立即触发
+        http_client* clt = find_clt( cltfd );
+        if( clt && m_keepalive_timeout > 0 )
+        {
+            m_wheel->add( &clt->m_timer, m_keepalive_timeout );
+        }
+    }
+    if( retire_conn( connection ) )
     {
         return;
     }
-    for( map< int, conn* >::iterator iter = m_freed.begin(); iter != m_freed.end(); iter++ )
+    log_debug( "client sock %d waits for the next request, server sock %d back to pool", cltfd, connection->m_srvfd );
+    reuse_conn( connection );
+}
+
+RET_CODE mgr::dispatch( http_client* clt )
+{
+    if( clt->m_waiting )
     {
-        //sleep( 1 );
-        int srvfd = iter->first;
-        conn* tmp = iter->second;
-        srvfd = conn2srv( tmp->m_srv_address );
-        if( srvfd < 0 )
+        return NOTHING;
+    }
+    if( m_cache )
+    {
+        if( !clt->m_out.empty() )   // 上一个命中的响应还没写完
         {
-            log( LOG_ERR, __FILE__, __LINE__, "%s", "fix connection failed");
+            RET_CODE res = flush_clt( clt );
+            if( res == BUFFER_EMPTY && m_draining )
+            {
+                int fd = clt->m_fd;
+                closefd( m_epollfd, fd );
+                drop_clt( fd );
+                return CLOSED;
+            }
+            if( res == BUFFER_EMPTY )
+            {
+                modfd( m_epollfd, clt->m_fd, EPOLLIN );     // 写的过程中到达的请求会立即触发
+                return NOTHING;
+            }
+            return res == TRY_AGAIN ? NOTHING : res;
         }
-        else
+        RET_CODE res = serve_cached( clt );
+        if( res != OK )
+        {
+            return res;
+        }
+    }
+    conn* connection = take_conn( clt->m_fd, true );
+    if( !connection )
+    {
+        log_debug( "no free server connection, client sock %d waits", clt->m_fd );
+        metric_add( m_stats->m_http_waits );
+        clt->m_waiting = true;
+        m_waiting.push_back( clt->m_fd );
+        return NOTHING;
+    }
+    return start_request( clt, connection );
+}
+
+// 客户端与服务端连接已经绑定，读入请求并开始转发 (ET模式下这次事件之后不会再通知已经到达的数据)
+RET_CODE mgr::start_request( http_client* clt, conn* connection )
+{
+    m_wheel->del( &clt->m_timer );
+    connection->init_clt( clt->m_fd, clt->m_address );
+    connection->m_cache_key.swap( clt->m_cache_key );
+    clt->m_cache_key.clear();
+    metric_add( m_stats->m_http_dispatches );
+    return process( clt->m_fd, READ );
+}
+
+/*
+MSG_PEEK看一下客户端已经到达的请求，不取走数据：没有命中时请求原样留在socket中，由分配到的conn照常读入转发
+只有完整的、可以缓存的GET请求才查缓存，命中时取走这个请求并把响应写给客户端，不调用pick_conn；后面pipeline的请求继续查
+*/
+RET_CODE mgr::serve_cached( http_client* clt )
+{
+    char buf[ PEEK_SIZE ];
+    while( true )
+    {
+        int len = recv( clt->m_fd, buf, sizeof( buf ), MSG_PEEK );
+        if( len < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) && !m_draining )
         {
-            log( LOG_INFO, __FILE__, __LINE__, "%s", "fix connection success" );
-            tmp->init_srv( srvfd, tmp->m_srv_address );
-            m_conns.insert( pair< int, conn* >( srvfd, tmp ) );
+            return NOTHING;
+        }
+        if( len <= 0 )      // 两次请求之间客户端关闭了连接，或者子进程正在退出
+        {
+            log_debug( "client sock %d closed between requests", clt->m_fd );
+            int fd = clt->m_fd;
+            closefd( m_epollfd, fd );
+            drop_clt( fd );
+            return CLOSED;
+        }
+
+        http_parser parser( HTTP_REQUEST );
+        parser.m_keys = true;
+        int used = parser.parse( buf, len );
+        if( !parser.m_done || parser.m_key_len < 0 || !parser.m_keepalive )
+        {
+            return OK;
+        }
+        if( parser.m_no_cache || !m_cache->lookup( parser.m_key, parser.m_key_len, clt->m_out ) )
+        {
+            clt->m_cache_key.assign( parser.m_key, parser.m_key_len );     // 服务端的响应可以存入缓存
+            return OK;
+        }
+
+        recv( clt->m_fd, buf, used, 0 );    // 取走这个请求，数据已经在socket缓冲区中，不会阻塞
+        log_debug( "client sock %d served from cache, %d bytes", clt->m_fd, ( int )clt->m_out.size() );
+        if( m_keepalive_timeout > 0 )
+        {
+            m_wheel->add( &clt->m_timer, m_keepalive_timeout );
+        }
+        clt->m_out_off = 0;
+        RET_CODE res = flush_clt( clt );
+        if( res != BUFFER_EMPTY )
+        {
+            return res == TRY_AGAIN ? NOTHING : res;
+        }
+    }
+}
+
+RET_CODE mgr::flush_clt( http_client* clt )
+{
+    while( clt->m_out_off < clt->m_out.size() )
+    {
+        ssize_t ret = send( clt->m_fd, clt->m_out.data() + clt->m_out_off, clt->m_out.size() - clt->m_out_off, MSG_NOSIGNAL );
+        if( ret < 0 )
+        {
+            if( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                modfd( m_epollfd, clt->m_fd, EPOLLOUT );
+                return TRY_AGAIN;
+            }
+            if( errno == EINTR )
+            {
+                continue;
+            }
+            log( LOG_ERR, __FILE__, __LINE__, "write client socket failed, %s", strerror( errno ) );
+            int fd = clt->m_fd;
+            closefd( m_epollfd, fd );
+            drop_clt( fd );
+            return CLOSED;
+        }
+        clt->m_out_off += ret;
+    }
+    clt->m_out.clear();
+    clt->m_out_off = 0;
+    return BUFFER_EMPTY;
+}
+
+/*
+只保存恰好一条响应的情况：期间有1xx中间响应、后面pipeline的响应已经到达、响应要求关闭连接时都不保存，
+这样m_cache_data就是这条响应完整的原始字节，命中时原样写给客户端
+*/
+void mgr::save_response( conn* connection )
+{
+    const http_tracker& state = connection->m_http_state;
+    if( state.m_responses == 1 && state.m_reusable && state.m_resp.at_start() && state.m_resp.m_ttl > 0 )
+    {
+        m_cache->store( connection->m_cache_key.data(), connection->m_cache_key.size(), connection->m_cache_data.data(),
+                        connection->m_cache_data.size(), state.m_resp.m_ttl );
+    }
+    connection->m_cache_key.clear();
+    connection->m_cache_data.clear();
+}
+
+void mgr::serve_waiting()
+{
+    if( m_serving )
+    {
+        return;     // 外层的循环会继续处理
+    }
+    m_serving = true;
+    while( !m_waiting.empty() )
+    {
+        http_client* clt = find_clt( m_waiting.front() );
+        if( !clt || !clt->m_waiting )
+        {
+            m_waiting.pop_front();
+            continue;
+        }
+        conn* connection = take_conn( clt->m_fd, true );
+        if( !connection )
+        {
+            break;
+        }
+        m_waiting.pop_front();
+        clt->m_waiting = false;
+        start_request( clt, connection );   // 客户端可能在其中关闭，之后不能再访问clt
+    }
+    m_serving = false;
+}
+
+http_client* mgr::find_clt( int fd )
+{
+    if( fd < 0 || fd >= ( int )m_clients.size() )
+    {
+        return NULL;
+    }
+    return m_clients[ fd ];
+}
+
+void mgr::drop_clt( int fd )
+{
+    http_client* clt = find_clt( fd );
+    if( clt )
+    {
+        m_wheel->del( &clt->m_timer );
+        m_clients[ fd ] = NULL;
+        --m_client_cnt;
+        delete clt;
+    }
+}
+
+void mgr::close_clt( http_client* clt )
+{
+    int fd = clt->m_fd;
+    log_debug( "close idle client sock %d", fd );
+    metric_add( m_stats->m_idle_timeouts );
+    closefd( m_epollfd, fd );
+    drop_clt( fd );
+}
+
+void http_client::on_timer( timer* t )
+{
+    m_mgr->close_clt( this );
+}
+
+// 立即为所有服务端m_freed中等待退避的连接重新发起连接
+void mgr::recycle_conns()
+{
+    for( int i = 0; i < ( int )m_backends.size(); ++i )
+    {
+        conn_list& freed = m_backends[i]->m_freed;
+        conn* tmp = freed.head();
+        while( tmp )
+        {
+            conn* next = tmp->m_next;   // 发起失败的连接会重新插入表头，不会在本轮再次处理
+            freed.erase( tmp );
+            metric_add( m_stats->m_reconnects );
+            start_connect( tmp );
+            tmp = next;
         }
     }
-    m_freed.clear();
 }
 
 // 通过fd和type来控制对服务端和客户端的读写，是整个负载均衡的核心功能
 RET_CODE mgr::process( int fd, OP_TYPE type )
 {
-    conn* connection = m_used[ fd ];    // 首先根据fd获取连接类，该类中保存有相对应的客户端和服务端的fd
+    conn* connection = find_conn( fd );    // 首先根据fd获取连接类，该类中保存有相对应的客户端和服务端的fd
     if( !connection )
     {
+        http_client* clt = find_clt( fd );
+        if( clt )   // 两次请求之间的客户端发来了数据或者关闭了连接
+        {
+            return dispatch( clt );
+        }
+        for( int i = 0; i < ( int )m_backends.size(); ++i )
+        {
+            if( m_backends[i]->m_health->owns( fd ) )     // 主动健康检查的socket
+            {
+                m_backends[i]->m_health->process( fd, type );
+                break;
+            }
+        }
         return NOTHING;
     }
+    if( connection->m_state == CONN_CONNECTING )      // 正在建立的服务端连接有了结果 (失败时可能同时带有EPOLLIN)
+    {
+        return finish_connect( connection );
+    }
+    connection->m_last_active = m_wheel->now();     // 供空闲超时判断
     if( connection->m_cltfd == fd )     // 如果是客户端fd
     {
         int srvfd = connection->m_srvfd;
@@ -172,11 +1034,18 @@ RET_CODE mgr::process( int fd, OP_TYPE type )
             case READ:                 // 读操作
             {
                 RET_CODE res = connection->read_clt();      //则调用conn的read_ckt方法
+                m_relayed_bytes += connection->m_bytes_read;
+                metric_add( m_stats->m_clt_bytes, connection->m_bytes_read );
+                connection->m_bytes_read = 0;
+                if( res == BUFFER_FULL )
+                {
+                    metric_add( m_stats->m_clt_buffer_full );
+                }
                 switch( res )
                 {
                     case OK:
                     {
-                        log( LOG_DEBUG, __FILE__, __LINE__, "content read from client: %s", connection->m_clt_buf );
+                        log_debug( "%d bytes read from client", connection->clt_pending() );
 
                     }
                     case BUFFER_FULL:
@@ -212,6 +1081,11 @@ RET_CODE mgr::process( int fd, OP_TYPE type )
                     }
                     case BUFFER_EMPTY:
                     {
+                        if( m_mode == PROXY_HTTP && connection->srv_reusable() )  // 响应已完整地写给客户端，服务端连接交给下一个请求
+                        {
+                            park_clt( connection );
+                            return OK;
+                        }
                         modfd( m_epollfd, srvfd, EPOLLIN );
                         modfd( m_epollfd, fd, EPOLLIN );
                         break;
@@ -247,11 +1121,29 @@ RET_CODE mgr::process( int fd, OP_TYPE type )
             case READ:
             {
                 RET_CODE res = connection->read_srv();
+                if( !connection->m_cache_key.empty() && connection->m_http_state.m_responses > 0 )
+                {
+                    save_response( connection );
+                }
+                m_relayed_bytes += connection->m_bytes_read;
+                metric_add( m_stats->m_srv_bytes, connection->m_bytes_read );
+                connection->m_bytes_read = 0;
+                if( res == BUFFER_FULL )
+                {
+                    metric_add( m_stats->m_srv_buffer_full );
+                }
                 switch( res )
                 {
                     case OK:
                     {
-                        log( LOG_DEBUG, __FILE__, __LINE__, "content read from server: %s", connection->m_srv_buf );  //此处的break不能加，在读完消息之后
+                        if( connection->m_req_start != 0 )     // 服务端响应的第一批数据到达
+                        {
+                            long long usec = monotonic_usec() - connection->m_req_start;
+                            m_sched[ connection->m_backend->m_idx ].update_latency( usec );
+                            connection->m_backend->m_latency->m_first_byte.record( usec );
+                            connection->m_req_start = 0;
+                        }
+                        log_debug( "%d bytes read from server", connection->srv_pending() );  //此处的break不能加，在读完消息之后
                                                                                                                       //应该继续去触发BUFFER_FULL从而通知可写
                     }
                     case BUFFER_FULL:
@@ -260,6 +1152,9 @@ RET_CODE mgr::process( int fd, OP_TYPE type )
                         break;
                     }
                     case IOERR:
+                    {
+                        connection->m_backend->m_health->on_failure();
+                    }
                     case CLOSED:
                     {
                         modfd( m_epollfd, cltfd, EPOLLOUT );
@@ -273,7 +1168,12 @@ RET_CODE mgr::process( int fd, OP_TYPE type )
             }
             case WRITE:
             {
+                int pending = connection->clt_pending();
                 RET_CODE res = connection->write_srv();
+                if( pending > connection->clt_pending() && connection->m_req_start == 0 )    // 从请求写入服务端开始计算响应时间
+                {
+                    connection->m_req_start = monotonic_usec();
+                }
                 switch( res )
                 {
                     case TRY_AGAIN:
@@ -288,6 +1188,9 @@ RET_CODE mgr::process( int fd, OP_TYPE type )
                         break;
                     }
                     case IOERR:
+                    {
+                        connection->m_backend->m_health->on_failure();
+                    }
                     case CLOSED:
                     {
                         /*
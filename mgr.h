@@ -1,39 +1,195 @@
 #ifndef SRVMGR_H
 #define SRVMGR_H
 
-#include <map>
+#include <vector>
+#include <deque>
 #include <arpa/inet.h>
 #include "fdwrapper.h"
 #include "conn.h"
+#include "arena.h"
+#include "timer.h"
+#include "health.h"
+#include "scheduler.h"
+#include "metrics.h"
+#include "cache.h"
 
-using std::map;
+using std::vector;
+using std::deque;
 
 class host
 {
 public:
+    host() : m_port( 0 ), m_conncnt( 0 ), m_weight( 1 ), m_splice( false ), m_bufsize( conn::BUF_SIZE ), m_connect_timeout( DEFAULT_CONNECT_TIMEOUT ),
+             m_clt_idle_timeout( 0 ), m_srv_idle_timeout( 0 ), m_keepalive( false ){}
+
+public:
+    static const int DEFAULT_CONNECT_TIMEOUT = 3000;
+
     char m_hostname[1024];  // 保存IP地址
     int m_port;             // 保存端口号
     int m_conncnt;          // 连接数   
+    int m_weight;           // 负载均衡的权重 (config.xml中 <weight>)
+    bool m_splice;          // 是否使用splice零拷贝转发 (config.xml中 <relay>splice</relay>)
+    int m_bufsize;          // 每个连接每个方向的缓冲区大小 (config.xml中 <bufsize>)
+    int m_connect_timeout;  // 连接服务端的超时时间(毫秒) (config.xml中 <connect_timeout>)
+    int m_clt_idle_timeout; // 客户端与服务端之间没有数据多久后关闭这一对连接(毫秒)，0表示不限制 (config.xml中 <idle_timeout>)
+    int m_srv_idle_timeout; // 连接池中的服务端连接空闲多久后重新建立(毫秒)，0表示不限制 (config.xml中 <backend_idle_timeout>)
+    bool m_keepalive;       // 客户端离开后，停在HTTP消息边界的服务端连接直接放回连接池，不再关闭重连 (config.xml中 <keepalive>on</keepalive>)
+    health_conf m_health;   // 健康检查配置
+};
+
+/*
+以conn自身的m_prev/m_next串起来的双向链表，一个conn同一时刻只会在一个链表中
+插入与删除都是O(1)，也不需要分配节点
+*/
+class conn_list
+{
+public:
+    conn_list() : m_head( NULL ), m_size( 0 ){}
+    void push( conn* connection );  // 插入到表头
+    void erase( conn* connection ); // 从链表中摘除
+    conn* pop();                    // 摘除并返回表头，链表为空时返回NULL
+    conn* head() const { return m_head; }
+    int size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+private:
+    conn* m_head;
+    int m_size;
+};
+
+/*
+子进程中一个逻辑服务器的连接池及其健康状态
+每个子进程为所有逻辑服务器各维护一个backend，客户端到来时由mgr从中选出一个
+*/
+class backend
+{
+public:
+    backend( int idx, const host& srv, int slot ) : m_idx( idx ), m_slot( slot ), m_logic_srv( srv ), m_used_cnt( 0 ), m_draining( false ), m_health( NULL ), m_latency( NULL ){}
+    int pool_size() const { return m_conns.size() + m_connecting.size() + m_freed.size() + m_used_cnt; }    // 该服务端现有的连接总数
+
+public:
+    int m_idx;                      // 在mgr::m_backends中的下标，也是调度表中的下标
+    int m_slot;                     // 在延迟表中的下标，由父进程分配，重新加载配置时据此认出同一个logical_host
+    host m_logic_srv;               // 保存服务端的信息
+    sockaddr_in m_address;          // 服务端地址
+    conn_list m_conns;              // 准备好的连接
+    conn_list m_connecting;         // 正在建立的服务端连接
+    conn_list m_freed;              // 使用后被释放的连接
+    int m_used_cnt;                 // 正在被客户端使用的连接数
+    bool m_draining;                // 已从配置中删除：不再分配给客户端，连接全部关闭后删除
+    host_health* m_health;          // 服务端的健康状态
+    backend_latency* m_latency;     // 本子进程中该服务端的延迟直方图 (共享内存)
+};
+
+class mgr;
+
+/*
+PROXY_HTTP模式下的一个客户端连接，从accept到关闭一直存在
+两次请求之间不占用服务端连接，只在内核事件表中等待下一个请求；没有空闲的服务端连接时在mgr::m_waiting中排队
+开启缓存时，命中的响应从m_out直接写给客户端，不经过服务端连接
+*/
+class http_client : public timer_handler
+{
+public:
+    http_client( mgr* manager, int fd, const sockaddr_in& address, arena* pool )
+        : m_mgr( manager ), m_fd( fd ), m_address( address ), m_waiting( false ), m_cache_key( pool ), m_out( pool ), m_out_off( 0 )
+    {
+        m_timer.m_handler = this;
+        m_timer.m_data = this;
+    }
+    void on_timer( timer* t );      // 两次请求之间空闲太久，关闭客户端
+
+public:
+    mgr* m_mgr;
+    int m_fd;
+    sockaddr_in m_address;
+    timer m_timer;                  // 两次请求之间的空闲超时
+    bool m_waiting;                 // 是否在排队等待服务端连接
+    arena_buf m_cache_key;          // 下一个请求没有命中但可以缓存时的key，分配服务端连接时交给conn
+    arena_buf m_out;                // 从缓存中取出、还没写完的响应 (都从mgr的内存池分配，写完即归还)
+    size_t m_out_off;               // m_out中已经写给客户端的字节数
 };
 
-class mgr
+class mgr : public timer_handler
 {
 public:
-    mgr( int epollfd, const host& srv );  //在构造mgr的同时调用conn2srv和服务端建立连接
+    mgr( int epollfd, const vector< host >& srvs, arena* pool, timer_wheel* wheel, int policy, worker_metrics* stats, backend_latency* latency,
+         int mode, int keepalive_timeout, http_cache* cache, const vector< int >* slots = NULL );  //在构造mgr的同时调用conn2srv和所有服务端建立连接，pool不为空时conn及其缓冲区从pool中分配，wheel为子进程的时间轮，policy为选择服务端的LB_POLICY，stats与latency为本子进程在共享计数器表中的计数与延迟表(srvs[i]使用第slots[i]项，slots为NULL时使用第i项)，mode为PROXY_MODE，keepalive_timeout为PROXY_HTTP模式下客户端两次请求之间的空闲超时(毫秒，0表示不限制)，cache为所有子进程共享的响应缓存(只在PROXY_HTTP模式下使用，可以为NULL)
     ~mgr();
-    int conn2srv( const sockaddr_in& address );  //和服务端建立连接同时返回socket描述符
-    conn* pick_conn( int cltfd );  //从连接好的连接中（m_conn中）拿出一个放入任务队列（m_used）中
-    void free_conn( conn* connection ); // 释放连接 (当连接关闭或者中断后，将其fd从内核事件表删除，并关闭fd)，并并将同srv进行连接的放入m_freed中
-    int get_used_conn_cnt();    // 获取当前任务数 (被notify_parent_busy_ratio)调用
-    void recycle_conns();       // 从m_freed中回收连接 (由于连接已经被关闭，因此还要调用conn2srv() )放到m_conn中
+    int conn2srv( const sockaddr_in& address );  //向服务端发起非阻塞连接同时返回socket描述符
+    bool serve_clt( int cltfd, const sockaddr_in& address );    //接管新accept的客户端，PROXY_TCP模式下立即分配服务端连接，PROXY_HTTP模式下等待第一个请求；失败时返回false，由调用者关闭cltfd
+    conn* pick_conn( int cltfd, bool registered = false );  //选出一个服务端，从其连接好的连接中（m_conns中）拿出一个放入任务队列（m_used）中，registered表示cltfd已在内核事件表中
+    void close_clt( http_client* clt );     //关闭两次请求之间的客户端
+    void free_conn( conn* connection ); // 释放连接 (当连接关闭或者中断后，将其fd从内核事件表删除，并关闭fd)，服务端连接可以复用时放回m_conns，否则重新连接
+    int get_used_conn_cnt();    // 获取当前任务数
+    int get_busy_ratio();       // 结合健康状态的负载 (写入负载表供父进程读取)
+    int get_ready_conn_cnt();   // 所有服务端连接池中空闲的连接数
+    int get_clt_cnt();          // 还没有关闭的客户端数 (PROXY_HTTP模式下包括两次请求之间的客户端)
+    unsigned long long get_relayed_bytes() const { return m_relayed_bytes; }    // 累计转发的字节数
+    void recycle_conns();       // 不等退避结束，立即为m_freed中的连接重新调用conn2srv()，连接完成后放到m_conn中
+    void reload( const vector< host >& srvs, const vector< int >& slots );   // 按重新加载的logical_host列表增加、删除服务端或调整连接池大小，slots为各服务端在延迟表中的下标，正在转发的连接不受影响
+    void drain( int timeout );  // 子进程停止accept后调用：不再等待新的请求，正在转发的连接照常进行，timeout毫秒后drained()返回true
+    bool drained() const { return m_draining && ( m_drain_expired || ( m_used.empty() && m_client_cnt == 0 ) ); }   // 所有客户端都已离开或超过了期限
+    void on_timer( timer* t );  // conn的定时器到期：连接超时、重连退避结束、空闲超时；drain的期限到达
     RET_CODE process( int fd, OP_TYPE type );   // 通过fd和type来控制对服务端和客户端的读写，是整个负载均衡的核心功能
 
 private:    
+    backend* select_backend();      // 按调度策略在健康且有空闲连接的服务端中选出一个，没有时返回NULL
+    backend* add_backend( const host& logic_srv, int slot );   // 创建服务端并发起m_conncnt个连接
+    void add_conns( backend* srv, int cnt );        // 为srv新建cnt个连接并发起连接
+    void trim_pool( backend* srv );                 // 关闭超出连接池大小的空闲连接，draining的服务端没有连接时删除
+    bool retire_conn( conn* connection );           // 客户端释放的连接超出连接池大小时关闭并删除，返回true
+    void remove_backend( backend* srv );
+    void start_connect( conn* connection );         // 发起非阻塞连接并放入m_connecting
+    RET_CODE finish_connect( conn* connection );    // 处理非阻塞连接的结果
+    void schedule_retry( conn* connection );        // 放入m_freed并按指数退避安排重连
+    void reuse_conn( conn* connection );            // 服务端连接不关闭，直接放回m_conns
+    conn* take_conn( int cltfd, bool registered );  // pick_conn的实现，没有可用的服务端连接时返回NULL，不记录错误
+    void park_clt( conn* connection );      // PROXY_HTTP模式下一次交互结束，客户端回到等待下一个请求的状态，服务端连接放回m_conns
+    RET_CODE dispatch( http_client* clt );  // 等待中的客户端发来了请求，为它分配服务端连接并开始转发，没有空闲连接时排队
+    RET_CODE start_request( http_client* clt, conn* connection );
+    RET_CODE serve_cached( http_client* clt );  // 用缓存回答客户端已经到达的请求，返回OK表示需要转发给服务端
+    RET_CODE flush_clt( http_client* clt );     // 把m_out写给客户端，写完返回BUFFER_EMPTY，需要等待EPOLLOUT时返回TRY_AGAIN
+    void save_response( conn* connection );     // 响应完整读入后存入缓存
+    void serve_waiting();           // 有服务端连接回到连接池时，按到达顺序服务排队的客户端
+    http_client* find_clt( int fd );
+    void drop_clt( int fd );        // 客户端连接关闭后释放对应的http_client
+    conn* new_conn( backend* srv ); // 为srv创建一个conn (优先使用内存池)
+    void delete_conn( conn* connection );   // 析构conn并归还内存
+    conn* find_conn( int fd );      // 根据fd查找正在使用的连接，没有时返回NULL
+    void bind_fd( int fd, conn* connection );   // 在m_fd_table中登记fd对应的连接
+
+public:
+    static const int EJECTED_BUSY_RATIO = 1 << 30;  // 所有服务端都被摘除时报告给父进程的负载
+
+private:    
+    static const int RETRY_MIN_DELAY = 100;     // 重连退避的初始时间(毫秒)
+    static const int RETRY_MAX_DELAY = 30000;   // 重连退避的上限(毫秒)
+    static const int REUSE_CHECK_DELAY = 1000;  // keep-alive连接空闲超过该时间(毫秒)后，取出前检查是否已被服务端关闭
+    static const int PEEK_SIZE = 4096;          // 查缓存前最多看客户端请求的多少字节，头部更长的请求直接转发
+
     static int m_epollfd;           // 内核时间表fd
-    map< int, conn* > m_conns;   //准备好的连接
-    map< int, conn* > m_used;       // 要被使用的连接
-    map< int, conn* > m_freed;      // 使用后被释放的连接
-    host m_logic_srv;               // 保存服务端的信息
+    vector< backend* > m_backends;  // 所有逻辑服务器
+    vector< sched_entry > m_sched;  // 与m_backends一一对应的调度信息
+    backend_latency* m_latency;     // 本子进程的延迟表，按backend::m_slot取用
+    scheduler* m_scheduler;         // 选择服务端的调度器
+    conn_list m_used;               // 要被使用的连接 (所有服务端共用)
+    unsigned long long m_relayed_bytes;     // 累计转发的字节数
+    vector< conn* > m_fd_table;     // 以fd为下标的连接表，客户端fd与服务端fd都指向同一个正在使用的conn
+    arena* m_arena;                 // 子进程的内存池，可以为NULL
+    timer_wheel* m_wheel;           // 子进程的时间轮
+    worker_metrics* m_stats;        // 本子进程的计数器 (父进程的admin端口读取)
+    int m_mode;                     // PROXY_MODE
+    int m_keepalive_timeout;        // PROXY_HTTP模式下客户端两次请求之间的空闲超时(毫秒)
+    vector< http_client* > m_clients;   // PROXY_HTTP模式下以fd为下标的客户端表
+    deque< int > m_waiting;         // 排队等待服务端连接的客户端fd，客户端关闭后留下的过期项在取出时跳过
+    bool m_serving;                 // 正在serve_waiting中，避免重入
+    int m_client_cnt;               // m_clients中的客户端数
+    bool m_draining;                // 子进程正在退出，处理完当前请求的客户端直接关闭
+    bool m_drain_expired;           // 超过了drain的期限
+    timer m_drain_timer;
+    http_cache* m_cache;            // 所有子进程共享的响应缓存，没有开启时为NULL
 };
 
 #endif
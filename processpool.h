@@ -16,70 +16,308 @@
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sched.h>
 #include <vector>
+#include <string>
+#include <algorithm>
 #include "log.h"
 #include "fdwrapper.h"
+#include "arena.h"
+#include "timer.h"
+#include "scheduler.h"
+#include "loadtable.h"
+#include "metrics.h"
+#include "http.h"
+#include "cache.h"
+#include "uring.h"
 
 using std::vector;
+using std::string;
+
+/*
+新连接的accept方式
+ACCEPT_PARENT: 父进程监听m_listenfd，选出最空闲的子进程后通知其accept (默认)
+ACCEPT_REUSEPORT: 每个子进程打开自己的SO_REUSEPORT监听socket直接accept，父进程只负责管理子进程
+ACCEPT_PASSFD: 父进程自己accept，再通过m_pipefd用SCM_RIGHTS把连接好的fd与客户端地址交给选中的子进程
+*/
+enum ACCEPT_MODE { ACCEPT_PARENT = 0, ACCEPT_REUSEPORT, ACCEPT_PASSFD };
+
+//进程池的全局配置 (config.xml中logical_host之外的部分)
+class pool_conf
+{
+public:
+    pool_conf() : m_accept_mode( ACCEPT_PARENT ), m_backlog( DEFAULT_BACKLOG ), m_accept_batch( DEFAULT_ACCEPT_BATCH ),
+                  m_arena_size( DEFAULT_ARENA_SIZE ), m_huge_pages( false ), m_balance( LB_WLC ), m_admin_port( 0 ), m_backends( 0 ),
+                  m_mode( PROXY_TCP ), m_keepalive_timeout( DEFAULT_KEEPALIVE_TIMEOUT ), m_cache_size( 0 ), m_cache_max_object( DEFAULT_CACHE_MAX_OBJECT ),
+                  m_engine( ENGINE_EPOLL ), m_drain_timeout( DEFAULT_DRAIN_TIMEOUT )
+    {
+        strcpy( m_admin_host, "127.0.0.1" );
+    }
+
+public:
+    static const size_t DEFAULT_ARENA_SIZE = 64 * 1024 * 1024;
+    static const int DEFAULT_BACKLOG = 1024;
+    static const int DEFAULT_ACCEPT_BATCH = 64;
+    static const int DEFAULT_KEEPALIVE_TIMEOUT = 60000;
+    static const int DEFAULT_CACHE_MAX_OBJECT = 1024 * 1024;
+    static const int DEFAULT_DRAIN_TIMEOUT = 10000;
+
+    int m_accept_mode;      //新连接的accept方式
+    int m_backlog;          //listen的backlog，实际上限还受net.core.somaxconn限制
+    int m_accept_batch;     //父进程一次最多让一个子进程accept多少个连接
+    size_t m_arena_size;    //每个子进程内存池的大小，为0时conn直接从堆分配
+    bool m_huge_pages;      //内存池是否尝试使用大页
+    int m_balance;          //负载均衡策略LB_POLICY，父进程选择子进程与子进程选择服务端都使用它
+    char m_admin_host[64];  //admin端口监听的地址
+    int m_admin_port;       //父进程在该端口提供/metrics，0表示不开启
+    int m_backends;         //logical_host的数量，fork之前据此为每个子进程分配各服务端的延迟直方图
+    int m_mode;             //转发的粒度PROXY_MODE
+    int m_keepalive_timeout;    //PROXY_HTTP模式下客户端两次请求之间的空闲超时(毫秒)，0表示不限制
+    size_t m_cache_size;    //所有子进程共享的响应缓存的大小，0表示不开启 (只在PROXY_HTTP模式下有效)
+    int m_cache_max_object; //可以缓存的单个响应的上限(字节)
+    int m_engine;           //事件引擎EVENT_ENGINE，父子进程都使用
+    int m_drain_timeout;    //SIGTERM后子进程等待正在转发的连接结束的最长时间(毫秒)，0表示立即退出
+};
 
 //子进程类
 class process
 {
 public:
-    process() : m_pid( -1 ){}
+    process() : m_pid( -1 ), m_pass_cnt( 0 ), m_blocked( false ), m_started( 0 ), m_respawn_at( 0 ), m_crashes( 0 ){}
 
 public:
-    int m_busy_ratio;						//给每台实际处理服务器（业务逻辑服务器）分配一个加权比例
+    static const int MAX_PASS_FDS = 32;     //一次sendmsg最多传递的fd数量
+
     pid_t m_pid;       //目标子进程的PID
     int m_pipefd[2];   //父进程和子进程通信用的管道 即 父进程是主机服务器，子进程是网易云服务器
+    int m_pass_fds[ MAX_PASS_FDS ];             //ACCEPT_PASSFD模式下等待传给该子进程的fd
+    sockaddr_in m_pass_addrs[ MAX_PASS_FDS ];   //对应的客户端地址
+    int m_pass_cnt;
+    bool m_blocked;         //ACCEPT_PASSFD模式下管道的发送缓冲区已满，攒下的一批留在m_pass_fds中，管道可写之前不再选择该子进程
+    long long m_started;    //最近一次fork的时刻(微秒)
+    long long m_respawn_at; //子进程退出后计划重新启动的时刻(微秒)
+    int m_crashes;          //连续运行不满RESPAWN_STABLE_TIME就退出的次数，决定重新启动的退避时间
 };
 
+//父进程admin端口上的一个连接，读完请求头后生成回复，可写时发送，都不阻塞父进程的事件循环
+class admin_client
+{
+public:
+    admin_client( int fd, long long expire ) : m_fd( fd ), m_sent( 0 ), m_expire( expire ){}
+
+public:
+    static const int MAX_REQUEST = 4096;    //请求头的上限(字节)，超过时回复400
+    static const int TIMEOUT = 5000;        //连接最多保留多久(毫秒)，请求读不完或回复发不完时关闭
+
+    int m_fd;
+    string m_request;       //已经读到的请求
+    string m_response;      //生成的回复，为空表示还在读取请求
+    size_t m_sent;          //回复已经发送的字节数
+    long long m_expire;     //到这个时刻(微秒)还没有处理完就关闭
+};
+
+/*
+父进程重新加载配置后发布的logical_host列表，与load_table一样在fork之前mmap(MAP_SHARED)
+父进程写入后向子进程发送SIGHUP，子进程在自己的事件循环中读取；用序号判断读到的是否是完整的一份(seqlock):
+写入前后序号各加1，读到奇数或读取前后序号不同时重读，序号与上次应用的相同时说明没有新的列表
+*/
+template< typename H >
+class host_table
+{
+public:
+    host_table() : m_header( NULL ), m_entries( NULL ), m_capacity( 0 ){}
+    ~host_table()
+    {
+        if( m_header )
+        {
+            munmap( m_header, sizeof( header ) + sizeof( entry ) * m_capacity );
+        }
+    }
+    bool init( int capacity );  // 在fork之前调用，capacity为一份列表最多的logical_host数
+    void publish( const vector< H >& srvs, const vector< int >& slots );     // 父进程调用
+    bool read( unsigned int& seq, vector< H >& srvs, vector< int >& slots ) const;    // 子进程调用，seq为上次应用的序号，没有新的列表时返回false
+
+private:
+    class header
+    {
+    public:
+        unsigned int m_seq;     // 写入期间为奇数
+        int m_count;
+    };
+    class entry
+    {
+    public:
+        H m_host;
+        int m_slot;             // 在延迟表中的下标
+    };
+
+    header* m_header;
+    entry* m_entries;
+    int m_capacity;
+};
+
+template< typename H >
+bool host_table< H >::init( int capacity )
+{
+    void* mem = mmap( NULL, sizeof( header ) + sizeof( entry ) * capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if( mem == MAP_FAILED )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "create host table failed: %s", strerror( errno ) );
+        return false;
+    }
+    m_header = ( header* )mem;     // 序号为0表示还没有重新加载过
+    m_entries = ( entry* )( m_header + 1 );
+    m_capacity = capacity;
+    return true;
+}
+
+template< typename H >
+void host_table< H >::publish( const vector< H >& srvs, const vector< int >& slots )
+{
+    unsigned int seq = m_header->m_seq;
+    __atomic_store_n( &m_header->m_seq, seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    int count = std::min( ( int )srvs.size(), m_capacity );
+    for( int i = 0; i < count; ++i )
+    {
+        memcpy( &m_entries[i].m_host, &srvs[i], sizeof( H ) );
+        m_entries[i].m_slot = slots[i];
+    }
+    m_header->m_count = count;
+    __atomic_store_n( &m_header->m_seq, seq + 2, __ATOMIC_RELEASE );
+}
+
+template< typename H >
+bool host_table< H >::read( unsigned int& seq, vector< H >& srvs, vector< int >& slots ) const
+{
+    while( true )
+    {
+        unsigned int begin = __atomic_load_n( &m_header->m_seq, __ATOMIC_ACQUIRE );
+        if( begin == seq )
+        {
+            return false;
+        }
+        if( begin & 1 )     // 父进程正在写入
+        {
+            sched_yield();
+            continue;
+        }
+        int count = std::min( m_header->m_count, m_capacity );
+        srvs.resize( count );
+        slots.resize( count );
+        for( int i = 0; i < count; ++i )
+        {
+            memcpy( &srvs[i], &m_entries[i].m_host, sizeof( H ) );
+            slots[i] = m_entries[i].m_slot;
+        }
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        if( __atomic_load_n( &m_header->m_seq, __ATOMIC_RELAXED ) == begin )
+        {
+            seq = begin;
+            return true;
+        }
+    }
+}
+
 template< typename C, typename H, typename M >
 class processpool
 {
 private:
-    processpool( int listenfd, int process_number = 8 );
+    processpool( int listenfd, int process_number, const pool_conf& conf );
 public:
-    // process_number是网易云网站的服务器 IP+Port+connect次数
+    // process_number是子进程数量，每个子进程都连接网易云网站的所有服务器
     // static可以保证创建的实例唯一
-    static processpool< C, H, M >* create( int listenfd, int process_number = 8 )
+    static processpool< C, H, M >* create( int listenfd, int process_number = 8, const pool_conf& conf = pool_conf() )
     {
         if( !m_instance )  //单例模式
         {
-            m_instance = new processpool< C, H, M >( listenfd, process_number );
+            m_instance = new processpool< C, H, M >( listenfd, process_number, conf );
         }
         return m_instance;
     }
     ~processpool()
     {
         delete [] m_sub_process;
+        delete [] m_sched;
+        delete m_scheduler;
     }
-    //启动进程池
-    void run( const vector<H>& arg );
+    typedef bool ( *reload_func )( vector< H >& srvs );    // 重新解析配置文件中的logical_host
+
+    //启动进程池，reload不为NULL时父进程收到SIGHUP后调用它重新加载logical_host
+    void run( const vector<H>& arg, reload_func reload = NULL );
+
+public:
+    static const int MAX_PROCESS_NUMBER = 256;  //进程池允许最大进程数量
+    static const int SPARE_BACKENDS = 16;       //延迟表为重新加载时新增的logical_host预留的项数
+    static const int DRAIN_KILL_GRACE = 2000;   //drain期限过后再等多久(毫秒)，仍未退出的子进程被SIGKILL
+    static const int RESPAWN_MIN_DELAY = 100;       //子进程退出后第一次重新启动前等待的时间(毫秒)，连续退出时每次加倍
+    static const int RESPAWN_MAX_DELAY = 30000;     //重新启动的退避上限(毫秒)，崩溃循环时每个子进程最多30秒重启一次
+    static const int RESPAWN_STABLE_TIME = 10000;   //子进程运行超过这么久(毫秒)再退出时，退避从头开始
+    static const int READY_TIMEOUT = 3000;      //子进程建立第一个服务端连接之前不参与调度，最多等待这么久(毫秒)，之后由子进程自己拒绝客户端
 
 private:
-    void notify_parent_busy_ratio( int pipefd, M* manager );  //获取目前连接数量，将其发送给父进程
-    int get_most_free_srv();  //找出最空闲的服务器
+    int get_most_free_srv();  //按调度策略选出一个子进程，没有就绪的子进程时返回-1
+    bool is_running( int idx );   //子进程idx已经进入事件循环，可以分配连接
+    int running_children();   //可以分配连接的子进程数
+    void dispatch_accept();   //把m_listenfd上等待的连接批量分配给一个子进程
+    void dispatch_passfd();   //父进程accept所有等待的连接，按子进程分批传递
+    void queue_passfd( int idx, int connfd, const sockaddr_in& client_address );    //把连接攒入子进程idx的一批
+    void flush_passfd( int idx );   //把攒下的fd一次sendmsg传给子进程idx，管道写满时留着这一批等EPOLLOUT
+    void resume_passfd( int idx );  //子进程idx的管道可以继续写了：发出留下的一批，重新触发backlog中的连接
+    void requeue_passfd( int idx ); //子进程idx已经退出：把攒下的一批交给其它子进程
+    void recv_passfd( int pipefd, M* manager );  //子进程接收父进程传来的fd
     void setup_sig_pipe(); //统一事件源
-    void run_parent();
+    int open_reuseport_listenfd();  //子进程打开自己的SO_REUSEPORT监听socket
+    int open_admin_listenfd();  //父进程打开admin端口的监听socket，失败时返回-1
+    void accept_admin( int adminfd, vector< admin_client >& clts );  //accept所有等待的admin连接
+    bool serve_admin( admin_client& clt );  //读取admin请求、发送回复，返回false时连接已处理完或出错，由调用者关闭
+    bool accept_conn( int listenfd, M* manager );  //accept一个客户端并为其分配服务端连接，没有新连接时返回false
+    void serve_conn( int connfd, const sockaddr_in& client_address, M* manager );  //为已连接的客户端分配服务端连接
+    void reload_hosts();    //SIGHUP: 重新加载logical_host并通知所有子进程
+    void drain_parent();    //SIGTERM: 父进程停止accept，子进程各自drain
+    void report_drain();    //drain期间把子进程剩余的连接数写入日志，超过期限时SIGKILL仍未退出的子进程
+    void schedule_respawn( int idx, int stat );  //子进程意外退出，按退避时间安排重新启动
+    bool spawn_child( int idx );    //重新fork子进程idx，返回true时当前进程是新的子进程
+    bool supervise();   //重新启动到期的子进程、恢复暂停的accept，返回true时当前进程是新的子进程
+    void run_parent( const vector<H>& arg );
     void run_child( const vector<H>& arg );
 
 private:
-    static const int MAX_PROCESS_NUMBER = 16;   //进程池允许最大进程数量
     static const int USER_PER_PROCESS = 65536;  //每个子进程最多能处理的客户数量
     static const int MAX_EVENT_NUMBER = 10000;  //EPOLL最多能处理的的事件数
     int m_process_number;  //进程池中的进程总数
     int m_idx;  //子进程在池中的序号（从0开始）
     int m_epollfd;  //当前进程的epoll内核事件表fd
     int m_listenfd;  //监听socket
+    sockaddr_in m_listen_address;  //m_listenfd绑定的地址，子进程据此打开SO_REUSEPORT监听socket
+    pool_conf m_conf;  //全局配置
     int m_stop;      //子进程通过m_stop来决定是否停止运行
+    bool m_draining;    //收到SIGTERM后正在等待连接结束
+    bool m_exiting;     //父进程收到SIGTERM或SIGINT，子进程退出后不再重新启动
+    bool m_accept_stalled;  //没有就绪的子进程，m_listenfd上的连接留在backlog中，等子进程就绪后重新触发
+    long long m_drain_start;    //父进程开始drain的时刻(微秒)
+    long long m_drain_report;   //父进程上一次报告剩余连接数的时刻(微秒)
     process* m_sub_process;  //保存所有子进程的描述信息
+    load_table m_load;      //父子进程共享的负载表，子进程写入自己的负载，父进程据此选择子进程
+    metrics_table m_metrics;    //父子进程共享的计数器表，子进程计数，父进程在admin端口汇总输出
+    http_cache m_cache;     //所有子进程共享的HTTP响应缓存，没有开启时enabled()为false
+    vector< string > m_backend_names;   //延迟表各项对应的logical_host的"ip:port"，父进程输出延迟时作为标签，已删除的服务端仍保留它的项
+    int m_backend_slots;    //延迟表的项数
+    host_table< H > m_hosts;    //父进程重新加载后发布的logical_host列表
+    unsigned int m_hosts_seq;   //子进程已经应用的列表序号
+    reload_func m_reload;   //父进程重新加载配置的函数
+    sched_entry* m_sched;   //与m_sub_process一一对应的调度信息，只在父进程中使用
+    scheduler* m_scheduler;  //父进程选择子进程的调度器
     static processpool< C, H, M >* m_instance;  //进程池静态实例
 };
 template< typename C, typename H, typename M >
 processpool< C, H, M >* processpool< C, H, M >::m_instance = NULL;
 
 static int EPOLL_WAIT_TIME = 5000;
+static int DRAIN_REPORT_TIME = 1000;   // drain期间父进程报告剩余连接数的间隔(毫秒)
+static int SUPERVISE_TIME = 100;       // 有子进程等待重新启动或还没有就绪时父进程检查的间隔(毫秒)
 static int sig_pipefd[2];  //用于处理信号的管道，以实现统一事件源,后面称之为信号管道
 static void sig_handler( int sig )  // 时间处理函数，将捕获的信号通过sig_pipefd发送给调用的进程
 {
@@ -110,11 +348,16 @@ static void addsig( int sig, void( handler )(int), bool restart = true )    // 
 创建m_instance对象时的构造函数
 */
 template< typename C, typename H, typename M >
-processpool< C, H, M >::processpool( int listenfd, int process_number ) 
-    : m_listenfd( listenfd ), m_process_number( process_number ), m_idx( -1 ), m_stop( false )
+processpool< C, H, M >::processpool( int listenfd, int process_number, const pool_conf& conf ) 
+    : m_process_number( process_number ), m_idx( -1 ), m_listenfd( listenfd ), m_conf( conf ), m_stop( false ), m_draining( false ), m_exiting( false ), m_accept_stalled( false ), m_drain_start( 0 ), m_drain_report( 0 ),
+      m_backend_slots( conf.m_backends + SPARE_BACKENDS ), m_hosts_seq( 0 ), m_reload( NULL )
 {
     assert( ( process_number > 0 ) && ( process_number <= MAX_PROCESS_NUMBER ) );
 
+    socklen_t addrlen = sizeof( m_listen_address );
+    int ret = getsockname( listenfd, ( struct sockaddr* )&m_listen_address, &addrlen );
+    assert( ret == 0 );
+
     /*
     根据网易云服务器的数量创建了两个process
 
@@ -124,13 +367,31 @@ processpool< C, H, M >::processpool( int listenfd, int process_number )
         process() : m_pid( -1 ){}   // 构造函数
 
     public:
-        int m_busy_ratio;  // 给每台实际处理服务器（业务逻辑服务器）分配一个加权比例                             
         pid_t m_pid;       // 目标子进程的PID
         int m_pipefd[2];   // 父进程和子进程通信用的管道
     };
     */
     m_sub_process = new process[ process_number ];
     assert( m_sub_process );
+    m_sched = new sched_entry[ process_number ];
+    m_scheduler = scheduler::create( conf.m_balance );
+    ret = m_load.init( process_number );    // 必须在fork之前创建，父子进程才能共享
+    assert( ret );
+    ret = m_metrics.init( process_number, m_backend_slots );
+    assert( ret );
+    ret = m_hosts.init( m_backend_slots );
+    assert( ret );
+    if( conf.m_cache_size > 0 )
+    {
+        if( conf.m_mode != PROXY_HTTP )
+        {
+            log( LOG_ERR, __FILE__, __LINE__, "%s", "the response cache needs <mode>http</mode>, cache disabled" );
+        }
+        else if( m_cache.init( conf.m_cache_size, conf.m_cache_max_object ) )   // 同样在fork之前，所有子进程共享命中
+        {
+            log( LOG_INFO, __FILE__, __LINE__, "response cache: %luMB, max object %d bytes", ( unsigned long )( conf.m_cache_size >> 20 ), conf.m_cache_max_object );
+        }
+    }
 
     for( int i = 0; i < process_number; ++i )
     {
@@ -139,7 +400,7 @@ processpool< C, H, M >::processpool( int listenfd, int process_number )
         既可以从sv[0]写入sv[1]读出，又可以从sv[1]读入sv[0]写出，
         如果没有写入就读出则会生阻塞。用途：用来创建全双工通道，不过只局限于父子进程之间。
         */
-        int ret = socketpair( PF_UNIX, SOCK_STREAM, 0, m_sub_process[i].m_pipefd );
+        ret = socketpair( PF_UNIX, SOCK_STREAM, 0, m_sub_process[i].m_pipefd );
         assert( ret == 0 );
 
         /*
@@ -152,7 +413,7 @@ processpool< C, H, M >::processpool( int listenfd, int process_number )
         if( m_sub_process[i].m_pid > 0 )  //父进程，其实就是整个大的进程与两个网易云服务器进程之间的通信
         {
             close( m_sub_process[i].m_pipefd[1] );
-            m_sub_process[i].m_busy_ratio = 0;
+            m_sub_process[i].m_started = monotonic_usec();
             continue;
         }
         else   //子进程的执行过程
@@ -170,19 +431,77 @@ processpool< C, H, M >::processpool( int listenfd, int process_number )
 template< typename C, typename H, typename M >
 int processpool< C, H, M >::get_most_free_srv()
 {
-    // m_busy_ratio：每台实际处理服务器的一个加权比例
-    int ratio = m_sub_process[0].m_busy_ratio;
-    int idx = 0;
+    /*
+    负载 = 正在转发的客户端数 + 已分配但子进程还没有accept的连接数，后者使一批同时到来的连接不会都分给同一个子进程
+    已退出、正在重新启动(还没有进入事件循环)、所有服务端都被摘除或连接池已用完的子进程不参与调度
+    已退出的子进程在负载表中留下的负载可能是0，不能因此被选中
+    */
+    bool found = false;
+    for( int i = 0; i < m_process_number; ++i )
+    {
+        int active = m_load.active( i );
+        int pending = m_load.pending( i );
+        m_sched[i].m_load = active + pending;
+        m_sched[i].m_available = is_running( i ) && !m_sub_process[i].m_blocked && active < M::EJECTED_BUSY_RATIO && m_load.ready( i ) > pending;
+        found = found || m_sched[i].m_available;
+    }
+    if( !found )    // 所有子进程的连接池都用完时退回到只看负载，由选中的子进程拒绝客户端
+    {
+        for( int i = 0; i < m_process_number; ++i )
+        {
+            m_sched[i].m_available = is_running( i ) && !m_sub_process[i].m_blocked;
+        }
+    }
+    return m_scheduler->select( m_sched, m_process_number );
+}
+
+// 负载表中的标记由上一个子进程留下时，重新启动前会被清零，因此还要看子进程是否存在
+template< typename C, typename H, typename M >
+bool processpool< C, H, M >::is_running( int idx )
+{
+    return m_sub_process[idx].m_pid != -1 && m_load.running( idx );
+}
+
+template< typename C, typename H, typename M >
+int processpool< C, H, M >::running_children()
+{
+    int cnt = 0;
     for( int i = 0; i < m_process_number; ++i )
     {
-        // 谁的任务数少 (多个客户端需要连接网易云服务器，因此考虑负载) ，那谁比较空闲
-        if( m_sub_process[i].m_busy_ratio < ratio )
+        if( is_running( i ) )
         {
-            idx = i;
-            ratio = m_sub_process[i].m_busy_ratio;  // 这里的idx与ratio都是父进程中的变量
+            ++cnt;
         }
     }
-    return idx;
+    return cnt;
+}
+
+/*
+m_listenfd是ET模式，每次可读只通知一次，而此时等待的连接可能有很多个
+因此不再一个连接一个通知，而是给选中的子进程发送一个配额，子进程一次accept到EAGAIN或配额用完
+配额用完时子进程回复父进程，父进程重新设置m_listenfd，若还有连接在等待就会再次触发，分配给下一个子进程
+*/
+template< typename C, typename H, typename M >
+void processpool< C, H, M >::dispatch_accept()
+{
+    int idx = get_most_free_srv();
+    if( idx < 0 )   // 所有子进程都在重新启动，连接留在backlog中
+    {
+        m_accept_stalled = true;
+        return;
+    }
+    int quota = m_load.ready( idx ) - m_load.pending( idx );    // 不超过子进程空闲的服务端连接数
+    if( quota > m_conf.m_accept_batch )
+    {
+        quota = m_conf.m_accept_batch;
+    }
+    if( quota < 1 )
+    {
+        quota = 1;
+    }
+    m_load.add_pending( idx, quota );
+    send( m_sub_process[idx].m_pipefd[0], ( char* )&quota, sizeof( quota ), 0 );
+    log_debug( "send request to child %d, quota %d", idx, quota );     //通知子进程客户的连接请求
 }
 
 template< typename C, typename H, typename M >
@@ -190,6 +509,10 @@ void processpool< C, H, M >::setup_sig_pipe()  //统一事件源
 {
     m_epollfd = epoll_create( 5 );
     assert( m_epollfd != -1 );
+    if( m_conf.m_engine == ENGINE_URING && !attach_uring( m_epollfd ) )  // 每个进程在fork之后各自创建，io_uring不能跨进程共享
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "%s", "io_uring engine unavailable, fall back to epoll" );
+    }
 
     int ret = socketpair( PF_UNIX, SOCK_STREAM, 0, sig_pipefd );   //全双工管道
     assert( ret != -1 );
@@ -198,32 +521,437 @@ void processpool< C, H, M >::setup_sig_pipe()  //统一事件源
     add_read_fd( m_epollfd, sig_pipefd[0] ); //监听管道读端并设置为非阻塞
 
     addsig( SIGCHLD, sig_handler );  //子进程状态发生变化（退出或暂停）
-    addsig( SIGTERM, sig_handler );  //终止进程,kill命令默认发送的即为SIGTERM
-    addsig( SIGINT, sig_handler );   //键盘输入中断进程（Ctrl + C）
+    addsig( SIGTERM, sig_handler );  //终止进程,kill命令默认发送的即为SIGTERM，等正在转发的连接结束后退出(drain)
+    addsig( SIGINT, sig_handler );   //键盘输入中断进程（Ctrl + C），立即退出
+    addsig( SIGUSR1, sig_handler );  //父进程把各服务端延迟的分位数写入日志，子进程忽略
+    addsig( SIGHUP, sig_handler );   //父进程重新加载logical_host，子进程应用父进程发布的列表
     addsig( SIGPIPE, SIG_IGN );      /*往被关闭的文件描述符中写数据时触发会使程序退出
                                        SIG_IGN可以忽略，在write的时候返回-1,
                                        errno设置为SIGPIPE*/
+
+    sigset_t mask;      // 重新启动的子进程从fork开始屏蔽了所有信号，信号管道建好之后再接收
+    sigemptyset( &mask );
+    sigprocmask( SIG_SETMASK, &mask, NULL );
+}
+
+/*
+SO_REUSEPORT模式下每个子进程绑定与m_listenfd相同的地址，由内核在这些监听socket之间分配新连接
+*/
+template< typename C, typename H, typename M >
+int processpool< C, H, M >::open_reuseport_listenfd()
+{
+    int listenfd = socket( PF_INET, SOCK_STREAM, 0 );
+    if( listenfd < 0 )
+    {
+        return -1;
+    }
+
+    int reuse = 1;
+    setsockopt( listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
+    if( setsockopt( listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof( reuse ) ) < 0
+        || bind( listenfd, ( struct sockaddr* )&m_listen_address, sizeof( m_listen_address ) ) < 0
+        || listen( listenfd, m_conf.m_backlog ) < 0 )
+    {
+        close( listenfd );
+        return -1;
+    }
+    return listenfd;
+}
+
+// admin端口只在父进程中打开，子进程不会继承
+template< typename C, typename H, typename M >
+int processpool< C, H, M >::open_admin_listenfd()
+{
+    struct sockaddr_in address;
+    bzero( &address, sizeof( address ) );
+    address.sin_family = AF_INET;
+    address.sin_port = htons( m_conf.m_admin_port );
+    if( inet_pton( AF_INET, m_conf.m_admin_host, &address.sin_addr ) != 1 )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int adminfd = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if( adminfd < 0 )
+    {
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt( adminfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
+    if( bind( adminfd, ( struct sockaddr* )&address, sizeof( address ) ) < 0 || listen( adminfd, 16 ) < 0 )
+    {
+        close( adminfd );
+        return -1;
+    }
+    return adminfd;
+}
+
+template< typename C, typename H, typename M >
+void processpool< C, H, M >::accept_admin( int adminfd, vector< admin_client >& clts )
+{
+    while( true )
+    {
+        int fd = accept4( adminfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if( fd < 0 )
+        {
+            if( errno == ECONNABORTED || errno == EINTR )
+            {
+                continue;
+            }
+            break;
+        }
+        add_read_fd( m_epollfd, fd );   // 等请求到达后再回复
+        clts.push_back( admin_client( fd, monotonic_usec() + admin_client::TIMEOUT * 1000LL ) );
+    }
+}
+
+/*
+只支持 GET /metrics，以Prometheus文本格式输出所有子进程的计数器与负载
+计数器由子进程以relaxed原子操作写入共享内存，这里直接读取，不需要与子进程通信
+请求可能分几次到达，读到空行后才生成回复；回复发不完时等EPOLLOUT继续发送，抓取方再慢也不会阻塞父进程
+*/
+template< typename C, typename H, typename M >
+bool processpool< C, H, M >::serve_admin( admin_client& clt )
+{
+    if( clt.m_response.empty() )
+    {
+        bool closed = false;
+        char buf[1024];
+        while( clt.m_request.size() <= ( size_t )admin_client::MAX_REQUEST )
+        {
+            int len = recv( clt.m_fd, buf, sizeof( buf ), 0 );
+            if( len > 0 )
+            {
+                clt.m_request.append( buf, len );
+                continue;
+            }
+            if( len < 0 && errno == EINTR )
+            {
+                continue;
+            }
+            closed = len == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK );
+            break;
+        }
+
+        string body;
+        const char* status = "200 OK";
+        if( clt.m_request.find( "\r\n\r\n" ) == string::npos )
+        {
+            if( clt.m_request.size() <= ( size_t )admin_client::MAX_REQUEST )
+            {
+                return !closed;     // 等请求的剩余部分
+            }
+            status = "400 Bad Request";
+            body = "bad request\n";
+        }
+        else if( clt.m_request.compare( 0, 12, "GET /metrics" ) == 0
+                 && clt.m_request.size() > 12 && ( clt.m_request[12] == ' ' || clt.m_request[12] == '?' ) )
+        {
+            bool alive[ MAX_PROCESS_NUMBER ];
+            for( int i = 0; i < m_process_number; ++i )
+            {
+                alive[i] = m_sub_process[i].m_pid != -1;
+            }
+            m_metrics.render( body, m_load, alive, M::EJECTED_BUSY_RATIO, m_backend_names );
+            if( m_cache.enabled() )
+            {
+                m_cache.render( body );
+            }
+        }
+        else
+        {
+            status = "404 Not Found";
+            body = "not found\n";
+        }
+
+        char header[256];
+        int header_len = snprintf( header, sizeof( header ), "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                   "Content-Length: %d\r\nConnection: close\r\n\r\n", status, ( int )body.size() );
+        clt.m_response.assign( header, header_len );
+        clt.m_response += body;
+    }
+
+    while( clt.m_sent < clt.m_response.size() )
+    {
+        ssize_t ret = send( clt.m_fd, clt.m_response.data() + clt.m_sent, clt.m_response.size() - clt.m_sent, MSG_NOSIGNAL );
+        if( ret < 0 && errno == EINTR )
+        {
+            continue;
+        }
+        if( ret < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+        {
+            modfd( m_epollfd, clt.m_fd, EPOLLOUT );     // 发送缓冲区满了，可写时再继续
+            return true;
+        }
+        if( ret <= 0 )
+        {
+            break;
+        }
+        clt.m_sent += ret;
+    }
+    return false;
+}
+
+/*
+从listenfd上accept一个客户端，并从manager中取出一个服务端连接与之绑定
+*/
+template< typename C, typename H, typename M >
+bool processpool< C, H, M >::accept_conn( int listenfd, M* manager )
+{
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof( client_address );
+    
+    /*
+    listenfd 是主机服务器socket 即 127.0.0.1 8080负载均衡的服务器
+    */
+    int connfd = accept4( listenfd, ( struct sockaddr* )&client_address, &client_addrlength, SOCK_NONBLOCK | SOCK_CLOEXEC );
+    if ( connfd < 0 )
+    {
+        if( errno == ECONNABORTED || errno == EINTR )   // 该连接已被客户端放弃，继续accept下一个
+        {
+            return true;
+        }
+        if( errno != EAGAIN && errno != EWOULDBLOCK )
+        {
+            log( LOG_ERR, __FILE__, __LINE__, "errno: %s", strerror( errno ) );
+        }
+        return false;
+    }
+    serve_conn( connfd, client_address, manager );
+    return true;
+}
+
+template< typename C, typename H, typename M >
+void processpool< C, H, M >::serve_conn( int connfd, const sockaddr_in& client_address, M* manager )
+{
+    metric_add( m_metrics.get( m_idx )->m_accepts );
+    if( !manager->serve_clt( connfd, client_address ) )    // 没有可用的服务端连接
+    {
+        closefd( m_epollfd, connfd );
+    }
+}
+
+/*
+ACCEPT_PASSFD模式下父进程自己accept到EAGAIN，每个连接单独选择子进程，这样选择的结果一定生效
+同一个子进程的fd攒成一批，用一次sendmsg传递：正文是客户端地址数组，fd放在SCM_RIGHTS控制消息中
+先选子进程再accept：所有子进程的管道都写满时不再accept，连接留在backlog中，直到有管道可写
+*/
+template< typename C, typename H, typename M >
+void processpool< C, H, M >::dispatch_passfd()
+{
+    if( running_children() == 0 )   // 所有子进程都在重新启动，先不accept，连接留在backlog中
+    {
+        m_accept_stalled = true;
+        return;
+    }
+    while( true )
+    {
+        int idx = get_most_free_srv();
+        if( idx < 0 )   // 所有子进程的管道都写满了，resume_passfd会重新触发
+        {
+            break;
+        }
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof( client_address );
+        int connfd = accept4( m_listenfd, ( struct sockaddr* )&client_address, &client_addrlength, SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if( connfd < 0 )
+        {
+            if( errno == ECONNABORTED || errno == EINTR )
+            {
+                continue;
+            }
+            if( errno != EAGAIN && errno != EWOULDBLOCK )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "errno: %s", strerror( errno ) );
+            }
+            break;
+        }
+        queue_passfd( idx, connfd, client_address );
+    }
+    bool flushed = true;
+    while( flushed )    // 已退出子进程的一批会转给其它子进程，可能落在已经检查过的子进程中
+    {
+        flushed = false;
+        for( int i = 0; i < m_process_number; ++i )
+        {
+            if( m_sub_process[i].m_pass_cnt > 0 && !m_sub_process[i].m_blocked )
+            {
+                flush_passfd( i );
+                flushed = true;
+            }
+        }
+    }
+}
+
+template< typename C, typename H, typename M >
+void processpool< C, H, M >::queue_passfd( int idx, int connfd, const sockaddr_in& client_address )
+{
+    process& child = m_sub_process[idx];
+    child.m_pass_fds[ child.m_pass_cnt ] = connfd;
+    child.m_pass_addrs[ child.m_pass_cnt ] = client_address;
+    ++child.m_pass_cnt;
+    m_load.add_pending( idx, 1 );
+    if( child.m_pass_cnt == process::MAX_PASS_FDS )
+    {
+        flush_passfd( idx );
+    }
+}
+
+template< typename C, typename H, typename M >
+void processpool< C, H, M >::flush_passfd( int idx )
+{
+    process& child = m_sub_process[idx];
+    int cnt = child.m_pass_cnt;
+    struct iovec iov;
+    iov.iov_base = child.m_pass_addrs;
+    iov.iov_len = sizeof( sockaddr_in ) * cnt;
+    char control[ CMSG_SPACE( sizeof( int ) * process::MAX_PASS_FDS ) ];
+    struct msghdr msg;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE( sizeof( int ) * cnt );
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR( &msg );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN( sizeof( int ) * cnt );
+    memcpy( CMSG_DATA( cmsg ), child.m_pass_fds, sizeof( int ) * cnt );
+
+    if( sendmsg( child.m_pipefd[0], &msg, 0 ) < 0 )
+    {
+        if( errno == EAGAIN || errno == EWOULDBLOCK )   // 子进程没有及时读走，这一批仍然算作它的，等管道可写时再发
+        {
+            log_debug( "pipe to child %d is full, hold %d clients", idx, cnt );
+            child.m_blocked = true;
+            add_write_fd( m_epollfd, child.m_pipefd[0] );
+            return;
+        }
+        log( LOG_ERR, __FILE__, __LINE__, "pass %d fds to child %d failed: %s", cnt, idx, strerror( errno ) );
+        if( errno == EPIPE || errno == ECONNRESET )     // 子进程已经退出，父进程还没有处理SIGCHLD：不再参与调度，这一批连接交给其它子进程
+        {
+            m_load.reset( idx );
+            requeue_passfd( idx );
+            return;
+        }
+        m_load.add_pending( idx, -cnt );
+    }
+    else
+    {
+        log_debug( "send %d clients to child %d", cnt, idx );
+    }
+    for( int i = 0; i < cnt; ++i )
+    {
+        close( child.m_pass_fds[i] );   // 子进程已经持有自己的副本
+    }
+    child.m_pass_cnt = 0;
+}
+
+template< typename C, typename H, typename M >
+void processpool< C, H, M >::resume_passfd( int idx )
+{
+    process& child = m_sub_process[idx];
+    removefd( m_epollfd, child.m_pipefd[0] );
+    child.m_blocked = false;
+    if( child.m_pass_cnt > 0 )
+    {
+        flush_passfd( idx );    // 仍然写不下时重新注册EPOLLOUT
+    }
+    if( !child.m_blocked && m_listenfd >= 0 )
+    {
+        modfd( m_epollfd, m_listenfd, EPOLLIN );    // 重新设置ET事件，管道写满期间留在backlog中的连接会立即再次触发
+    }
+}
+
+// 没有其它就绪的子进程时关闭连接
+template< typename C, typename H, typename M >
+void processpool< C, H, M >::requeue_passfd( int idx )
+{
+    process& child = m_sub_process[idx];
+    int cnt = child.m_pass_cnt;
+    m_load.add_pending( idx, -cnt );
+    child.m_pass_cnt = 0;
+    for( int i = 0; i < cnt; ++i )
+    {
+        int to = get_most_free_srv();
+        if( to < 0 )
+        {
+            close( child.m_pass_fds[i] );
+            continue;
+        }
+        queue_passfd( to, child.m_pass_fds[i], child.m_pass_addrs[i] );
+    }
+}
+
+/*
+每条消息的正文长度与其中的fd数量对应；读到EAGAIN为止
+父进程一端是非阻塞的，一条消息最多几百字节，发送缓冲区不足时整条返回EAGAIN，不会只发出一部分
+Unix域流式socket不会把两条带SCM_RIGHTS的消息合并到一次recvmsg中
+*/
+template< typename C, typename H, typename M >
+void processpool< C, H, M >::recv_passfd( int pipefd, M* manager )
+{
+    sockaddr_in addrs[ process::MAX_PASS_FDS ];
+    char control[ CMSG_SPACE( sizeof( int ) * process::MAX_PASS_FDS ) ];
+    while( true )
+    {
+        struct iovec iov;
+        iov.iov_base = addrs;
+        iov.iov_len = sizeof( addrs );
+        struct msghdr msg;
+        memset( &msg, 0, sizeof( msg ) );
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof( control );
+        int ret = recvmsg( pipefd, &msg, MSG_CMSG_CLOEXEC );
+        if( ret <= 0 )
+        {
+            break;
+        }
+        int cnt = 0;
+        int* fds = NULL;
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR( &msg );
+        if( cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS )
+        {
+            cnt = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+            fds = ( int* )CMSG_DATA( cmsg );
+        }
+        m_load.add_pending( m_idx, -cnt );
+        for( int i = 0; i < cnt; ++i )
+        {
+            if( i < ret / ( int )sizeof( sockaddr_in ) )
+            {
+                serve_conn( fds[i], addrs[i], manager );
+            }
+            else
+            {
+                close( fds[i] );    // 不应该发生：地址不完整
+            }
+        }
+    }
 }
 
 /*
 arg = logical_src即网易云网站的两个服务器
 */
 template< typename C, typename H, typename M >
-void processpool< C, H, M >::run( const vector<H>& arg )
+void processpool< C, H, M >::run( const vector<H>& arg, reload_func reload )
 {
     if( m_idx != -1 )
     {
         run_child( arg );
         return;
     }
-    run_parent();
-}
-
-template< typename C, typename H, typename M >
-void processpool< C, H, M >::notify_parent_busy_ratio( int pipefd, M* manager )
-{
-    int msg = manager->get_used_conn_cnt();
-    send( pipefd, ( char* )&msg, 1, 0 );    
+    m_reload = reload;
+    for( int i = 0; i < ( int )arg.size(); ++i )
+    {
+        char name[1100];
+        snprintf( name, sizeof( name ), "%s:%d", arg[i].m_hostname, arg[i].m_port );
+        m_backend_names.push_back( name );
+    }
+    run_parent( arg );
 }
 
 /*
@@ -237,80 +965,125 @@ void processpool< C, H, M >::run_child( const vector<H>& arg )
     int pipefd_read = m_sub_process[m_idx].m_pipefd[1]; // 网易云的第 m_idx 个服务器
     add_read_fd( m_epollfd, pipefd_read );  // 监听管道读端并设置为非阻塞
 
+    int listenfd = -1;     // SO_REUSEPORT模式下子进程自己的监听socket
+    if( m_conf.m_accept_mode == ACCEPT_REUSEPORT )
+    {
+        listenfd = open_reuseport_listenfd();
+        if( listenfd < 0 )
+        {
+            log( LOG_ERR, __FILE__, __LINE__, "child %d open reuseport listen socket failed: %s", m_idx, strerror( errno ) );
+            close( pipefd_read );
+            close( m_epollfd );
+            return;
+        }
+        close( m_listenfd );    // 继承来的共享监听socket不再使用，所有副本关闭后它才会退出SO_REUSEPORT组
+        add_read_fd( m_epollfd, listenfd );
+    }
+    else if( m_conf.m_accept_mode == ACCEPT_PASSFD )
+    {
+        close( m_listenfd );    // 只由父进程accept
+    }
+
     epoll_event events[ MAX_EVENT_NUMBER ]; 
 
     /*
     和网易云服务端建立连接同时返回socket描述符
     此处实例化一个mgr类的对象
 
-    一个子进程一个manager负责关闭连接
+    一个子进程一个manager，管理到所有服务端的连接并负责关闭连接
     */
-    M* manager = new M( m_epollfd, arg[m_idx] ); 
+    arena* pool = NULL;
+    if( m_conf.m_arena_size > 0 )
+    {
+        pool = new arena( m_conf.m_arena_size, m_conf.m_huge_pages );
+    }
+    timer_wheel* wheel = new timer_wheel;   // 由加入m_epollfd的timerfd驱动
+    int timerfd = wheel->init( m_epollfd );
+    assert( timerfd >= 0 );
+    assert( ( int )arg.size() == m_conf.m_backends );
+    // 重新启动的子进程直接按父进程最近一次重新加载的列表建立连接池，不先连接已经删除的服务端；还没有重新加载过时使用启动时的列表
+    vector< H > srvs;
+    vector< int > slots;
+    if( !m_hosts.read( m_hosts_seq, srvs, slots ) )
+    {
+        srvs = arg;
+        for( int i = 0; i < ( int )arg.size(); ++i )
+        {
+            slots.push_back( i );
+        }
+    }
+    M* manager = new M( m_epollfd, srvs, pool, wheel, m_conf.m_balance, m_metrics.get( m_idx ), m_metrics.latency( m_idx ),
+                        m_conf.m_mode, m_conf.m_keepalive_timeout, m_cache.enabled() ? &m_cache : NULL, &slots );
     assert( manager );
 
     int number = 0;
     int ret = -1;
+    bool running = false;   // 已经在负载表中标记为就绪
+    unsigned long long start_tick = wheel->now();
+    unsigned long long rate_tick = wheel->now();        // 上一次统计转发速率的时刻(时间轮tick)
+    unsigned long long rate_bytes = manager->get_relayed_bytes();
 
     // 子进程通过m_stop来决定是否停止运行
     while( ! m_stop )
     {
-        number = epoll_wait( m_epollfd, events, MAX_EVENT_NUMBER, EPOLL_WAIT_TIME );    // 监听m_epollfd上是否有事件
+        number = wait_events( m_epollfd, events, MAX_EVENT_NUMBER, EPOLL_WAIT_TIME );    // 监听m_epollfd上是否有事件
         if ( ( number < 0 ) && ( errno != EINTR ) ) // 错误处理
         {
             log( LOG_ERR, __FILE__, __LINE__, "%s", "epoll failure" );
             break;
         }
 
-        if( number == 0 )           // 在Epoll_Wait_Time指定事件内没有事件到达时返回0
-        {
-            // 从m_freed中回收连接 (由于连接已经被关闭，因此还要调用conn2srv() )放到m_conn中
-            manager->recycle_conns();
-            continue;
-        }
+        // 连接的回收、超时都由时间轮驱动，不再依赖epoll_wait超时返回
 
         for ( int i = 0; i < number; i++ )
         {
             int sockfd = events[i].data.fd;
 
-            if( ( sockfd == pipefd_read ) && ( events[i].events & EPOLLIN ) )  //是父进程发送的消息（通知有新的客户连接到来）
+            if( ( sockfd == pipefd_read ) && ( events[i].events & EPOLLIN ) && m_conf.m_accept_mode == ACCEPT_PASSFD )    //父进程传来了连接好的fd
             {
-                // run->parent 有新的连接会往 m_pipefd写连接
+                recv_passfd( sockfd, manager );
+            }
+            else if( ( sockfd == pipefd_read ) && ( events[i].events & EPOLLIN ) )  //是父进程发送的消息（通知有新的客户连接到来）
+            {
+                // run->parent 有新的连接会往 m_pipefd写入配额，ET模式下读空管道，把多个配额合并后一起accept
+                int quota = 0;
                 int client = 0;
-                ret = recv( sockfd, ( char* )&client, sizeof( client ), 0 );
-                if( ( ( ret < 0 ) && ( errno != EAGAIN ) ) || ret == 0 ) // recv失败
+                while( ( ret = recv( sockfd, ( char* )&client, sizeof( client ), 0 ) ) == sizeof( client ) )
+                {
+                    quota += client;
+                }
+                if( quota <= 0 )
                 {
                     continue;
                 }
-                else
+                m_load.add_pending( m_idx, -quota );
+                if( m_listenfd < 0 )    // 正在drain，监听socket已关闭
+                {
+                    continue;
+                }
+                int accepted = 0;
+                while( accepted < quota && accept_conn( m_listenfd, manager ) )
+                {
+                    ++accepted;
+                }
+                if( accepted == quota )     // 配额用完，可能还有连接在等待，请父进程重新分配
+                {
+                    send( sockfd, ( char* )&accepted, sizeof( accepted ), 0 );
+                }
+            }
+            else if( ( sockfd == timerfd ) && ( events[i].events & EPOLLIN ) )  // 推进时间轮，执行到期的定时器
+            {
+                wheel->tick();
+            }
+            else if( ( sockfd == listenfd ) && ( events[i].events & EPOLLIN ) )    // SO_REUSEPORT模式下直接accept，ET模式需要一直accept到EAGAIN
+            {
+                while( accept_conn( listenfd, manager ) )
                 {
-                    // 接受到了数据
-                    struct sockaddr_in client_address;
-                    socklen_t client_addrlength = sizeof( client_address );
-                    
-                    /*
-                    listenfd 是主机服务器socket 即 127.0.0.1 8080负载均衡的服务器
-                    */
-                    int connfd = accept( m_listenfd, ( struct sockaddr* )&client_address, &client_addrlength );
-                    if ( connfd < 0 )
-                    {
-                        log( LOG_ERR, __FILE__, __LINE__, "errno: %s", strerror( errno ) );
-                        continue;
-                    }
-                    add_read_fd( m_epollfd, connfd );   // 将客户端文件描述符connfd上的可读事件加入内核时间表
-                    C* conn = manager->pick_conn( connfd ); // 获取一个空闲的连接
-                    if( !conn )
-                    {
-                        closefd( m_epollfd, connfd );
-                        continue;
-                    }
-                    conn->init_clt( connfd, client_address );   // 初始化客户端信息
-                    notify_parent_busy_ratio( pipefd_read, manager );
                 }
             }
             //处理自身进程接收到的信号
             else if( ( sockfd == sig_pipefd[0] ) && ( events[i].events & EPOLLIN ) )
             {
-                int sig;
                 char signals[1024];
                 ret = recv( sig_pipefd[0], signals, sizeof( signals ), 0 );
                 if( ret <= 0 )
@@ -333,12 +1106,44 @@ void processpool< C, H, M >::run_child( const vector<H>& arg )
                                 }
                                 break;
                             }
-                            case SIGTERM:  //退出该进程
-                            case SIGINT:
+                            case SIGTERM:  //停止accept，正在转发的连接结束或超过期限后退出
+                            {
+                                if( m_conf.m_drain_timeout <= 0 )
+                                {
+                                    m_stop = true;
+                                }
+                                else if( !m_draining )
+                                {
+                                    m_draining = true;
+                                    if( listenfd >= 0 )
+                                    {
+                                        closefd( m_epollfd, listenfd );
+                                        listenfd = -1;
+                                    }
+                                    if( m_conf.m_accept_mode == ACCEPT_PARENT )
+                                    {
+                                        close( m_listenfd );    // 所有进程的副本都关闭后，新的连接不再进入backlog
+                                        m_listenfd = -1;
+                                    }
+                                    manager->drain( m_conf.m_drain_timeout );
+                                }
+                                break;
+                            }
+                            case SIGINT:   //立即退出
                             {
                                 m_stop = true;
                                 break;
                             }
+                            case SIGHUP:    //父进程发布了新的logical_host列表，正在转发的连接不受影响
+                            {
+                                vector< H > srvs;
+                                vector< int > slots;
+                                if( m_hosts.read( m_hosts_seq, srvs, slots ) )
+                                {
+                                    manager->reload( srvs, slots );
+                                }
+                                break;
+                            }
                             default:
                             {
                                 break;
@@ -349,117 +1154,401 @@ void processpool< C, H, M >::run_child( const vector<H>& arg )
             }
             else if( events[i].events & EPOLLIN )   // 有sockfd上有数据可读
             {
-                 RET_CODE result = manager->process( sockfd, READ );
-                 switch( result )
-                 {
-                     case CLOSED:
-                     {
-                        // 修改ratio，msg为当前任务数
-                        notify_parent_busy_ratio( pipefd_read, manager );
-                        break;
-                     }
-                     default:
-                         break;
-                 }
+                 manager->process( sockfd, READ );
             }
             else if( events[i].events & EPOLLOUT )  // 有事件可写 (只有sockfd写缓冲满了或者某个sockfd注册了EPOLLOUT才会触发)
             {
-                 RET_CODE result = manager->process( sockfd, WRITE );
-                 switch( result )   // 根据返回的状态进行处理
-                 {
-                     case CLOSED:
-                     {
-                         notify_parent_busy_ratio( pipefd_read, manager );
-                         break;
-                     }
-                     default:
-                         break;
-                 }
+                 manager->process( sockfd, WRITE );
             }
             else
             {
                 continue;
             }
         }
+
+        // 连接数、健康状态都可能在本轮变化(包括定时器触发的关闭与摘除)，直接写入共享的负载表；drain期间报告剩余的客户端数
+        m_load.publish( m_idx, m_draining ? manager->get_clt_cnt() : manager->get_busy_ratio(), manager->get_ready_conn_cnt() );
+        if( !running && ( manager->get_ready_conn_cnt() > 0 || wheel->now() - start_tick >= ( unsigned long long )( READY_TIMEOUT / timer_wheel::TICK_MS ) ) )
+        {
+            m_load.mark_running( m_idx );   // 父进程从此开始给该子进程分配连接
+            running = true;
+        }
+        if( m_draining && manager->drained() )
+        {
+            log( LOG_INFO, __FILE__, __LINE__, "child %d drained, %d clients left", m_idx, manager->get_clt_cnt() );
+            m_stop = true;
+        }
+        if( wheel->now() - rate_tick >= ( unsigned long long )( 1000 / timer_wheel::TICK_MS ) )
+        {
+            unsigned long long bytes = manager->get_relayed_bytes();
+            unsigned long long elapsed_ms = ( wheel->now() - rate_tick ) * timer_wheel::TICK_MS;
+            m_load.publish_rate( m_idx, ( bytes - rate_bytes ) * 1000 / elapsed_ms );
+            rate_tick = wheel->now();
+            rate_bytes = bytes;
+        }
     }
 
+    delete manager;     // 关闭所有连接并把conn归还给内存池
+    delete wheel;
+    delete pool;
+    if( listenfd >= 0 )
+    {
+        close( listenfd );
+    }
     close( pipefd_read );
     close( m_epollfd );
 }
 
+/*
+只重新加载logical_host：同一个"ip:port"始终对应延迟表中的同一项(slot)，子进程据此区分保留、新增与删除的服务端
+列表写入共享的host_table后再向子进程发送SIGHUP；配置文件解析失败时保持原来的服务端不变
+*/
+template< typename C, typename H, typename M >
+void processpool< C, H, M >::reload_hosts()
+{
+    vector< H > parsed;
+    if( !m_reload || !m_reload( parsed ) )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "%s", "reload config failed, keep the running logical hosts" );
+        return;
+    }
+
+    vector< H > srvs;
+    vector< int > slots;
+    vector< bool > taken( m_backend_names.size(), false );     // 配置中重复的服务端各自占一项
+    for( int i = 0; i < ( int )parsed.size(); ++i )
+    {
+        char name[1100];
+        snprintf( name, sizeof( name ), "%s:%d", parsed[i].m_hostname, parsed[i].m_port );
+        int slot = 0;
+        while( slot < ( int )m_backend_names.size() && ( taken[slot] || m_backend_names[slot] != name ) )
+        {
+            ++slot;
+        }
+        if( slot == ( int )m_backend_names.size() )
+        {
+            if( slot >= m_backend_slots )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "no room for new logical host %s, restart to add it", name );
+                continue;
+            }
+            m_backend_names.push_back( name );
+            taken.push_back( false );
+        }
+        taken[slot] = true;
+        srvs.push_back( parsed[i] );
+        slots.push_back( slot );
+    }
+    if( srvs.empty() )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "%s", "no logical host left after reload, keep the running logical hosts" );
+        return;
+    }
+
+    m_hosts.publish( srvs, slots );
+    for( int i = 0; i < m_process_number; ++i )
+    {
+        if( m_sub_process[i].m_pid != -1 )
+        {
+            kill( m_sub_process[i].m_pid, SIGHUP );
+        }
+    }
+    log( LOG_INFO, __FILE__, __LINE__, "reload %d logical hosts", ( int )srvs.size() );
+}
+
+/*
+父进程关闭监听socket，新的连接不再进入backlog (ACCEPT_PARENT模式下子进程在drain时关闭各自继承的副本)
+之后父进程继续运行，admin端口仍然可用，所有子进程退出后结束事件循环，不再重新启动子进程
+*/
+template< typename C, typename H, typename M >
+void processpool< C, H, M >::drain_parent()
+{
+    if( m_draining )
+    {
+        return;
+    }
+    m_draining = true;
+    m_drain_start = monotonic_usec();
+    m_drain_report = m_drain_start;
+    if( m_listenfd >= 0 )
+    {
+        closefd( m_epollfd, m_listenfd );
+        m_listenfd = -1;
+    }
+    log( LOG_INFO, __FILE__, __LINE__, "drain all the child, deadline %dms", m_conf.m_drain_timeout );
+}
+
+// 子进程在负载表中报告剩余的客户端数
+template< typename C, typename H, typename M >
+void processpool< C, H, M >::report_drain()
+{
+    long long now = monotonic_usec();
+    if( now - m_drain_report < DRAIN_REPORT_TIME * 1000LL )    // 子进程退出等事件也会唤醒父进程
+    {
+        return;
+    }
+    m_drain_report = now;
+    int clients = 0;
+    int children = 0;
+    for( int i = 0; i < m_process_number; ++i )
+    {
+        if( m_sub_process[i].m_pid != -1 )
+        {
+            clients += m_load.active( i );
+            ++children;
+        }
+    }
+    long long elapsed = ( now - m_drain_start ) / 1000;
+    log( LOG_INFO, __FILE__, __LINE__, "draining: %d clients left in %d children, %lldms elapsed", clients, children, elapsed );
+    if( elapsed < m_conf.m_drain_timeout + DRAIN_KILL_GRACE )
+    {
+        return;
+    }
+    for( int i = 0; i < m_process_number; ++i )
+    {
+        if( m_sub_process[i].m_pid != -1 )
+        {
+            log( LOG_ERR, __FILE__, __LINE__, "child %d did not exit after the drain deadline, kill it", i );
+            kill( m_sub_process[i].m_pid, SIGKILL );
+        }
+    }
+}
+
+/*
+子进程意外退出(崩溃、被杀死或自己退出)，连续退出时退避时间加倍，崩溃循环时每个子进程最多RESPAWN_MAX_DELAY重启一次
+运行超过RESPAWN_STABLE_TIME后才退出的子进程视为偶发故障，退避从头开始
+*/
+template< typename C, typename H, typename M >
+void processpool< C, H, M >::schedule_respawn( int idx, int stat )
+{
+    process& child = m_sub_process[idx];
+    long long now = monotonic_usec();
+    if( now - child.m_started >= RESPAWN_STABLE_TIME * 1000LL )
+    {
+        child.m_crashes = 0;
+    }
+    long long delay = ( long long )RESPAWN_MIN_DELAY << std::min( child.m_crashes, 16 );
+    if( delay > RESPAWN_MAX_DELAY )
+    {
+        delay = RESPAWN_MAX_DELAY;
+    }
+    ++child.m_crashes;
+    child.m_respawn_at = now + delay * 1000;
+
+    if( WIFSIGNALED( stat ) )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "child %d killed by signal %d, respawn in %lldms (%d quick exits in a row)",
+             idx, WTERMSIG( stat ), delay, child.m_crashes );
+    }
+    else
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "child %d exited with status %d, respawn in %lldms (%d quick exits in a row)",
+             idx, WEXITSTATUS( stat ), delay, child.m_crashes );
+    }
+}
+
+/*
+与构造函数中一样建立管道后fork，父进程与其它子进程不受影响
+fork前后屏蔽所有信号：子进程建好自己的信号管道之前收到的信号(例如SIGTERM)不会丢失，也不会写进父进程的信号管道
+新的子进程离开父进程的事件循环后关闭继承来的fd，再执行run_child
+*/
+template< typename C, typename H, typename M >
+bool processpool< C, H, M >::spawn_child( int idx )
+{
+    process& child = m_sub_process[idx];
+    child.m_respawn_at = 0;
+    m_load.reset( idx );    // 清掉上一个子进程留下的负载，新的子进程进入事件循环之前不参与调度
+    m_metrics.reset( idx );
+    if( socketpair( PF_UNIX, SOCK_STREAM, 0, child.m_pipefd ) < 0 )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "respawn child %d failed: %s", idx, strerror( errno ) );
+        child.m_respawn_at = monotonic_usec() + RESPAWN_MAX_DELAY * 1000LL;
+        return false;
+    }
+
+    sigset_t all, old;
+    sigfillset( &all );
+    sigprocmask( SIG_BLOCK, &all, &old );
+    pid_t pid = fork();
+    if( pid == 0 )
+    {
+        m_idx = idx;
+        return true;
+    }
+    sigprocmask( SIG_SETMASK, &old, NULL );
+    if( pid < 0 )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "respawn child %d failed: %s", idx, strerror( errno ) );
+        close( child.m_pipefd[0] );
+        close( child.m_pipefd[1] );
+        child.m_pipefd[0] = -1;
+        child.m_respawn_at = monotonic_usec() + RESPAWN_MAX_DELAY * 1000LL;
+        return false;
+    }
+
+    close( child.m_pipefd[1] );
+    child.m_pid = pid;
+    child.m_started = monotonic_usec();
+    if( m_conf.m_accept_mode == ACCEPT_PARENT )
+    {
+        add_read_fd( m_epollfd, child.m_pipefd[0] );    // 子进程用完配额时的回复
+    }
+    else if( m_conf.m_accept_mode == ACCEPT_PASSFD )
+    {
+        setnonblocking( child.m_pipefd[0] );
+    }
+    log( LOG_INFO, __FILE__, __LINE__, "respawn child %d, pid %d", idx, pid );
+    return false;
+}
+
+/*
+父进程每轮事件循环之后执行
+收到SIGTERM或SIGINT后不再重新启动子进程，所有子进程退出后结束事件循环
+*/
+template< typename C, typename H, typename M >
+bool processpool< C, H, M >::supervise()
+{
+    long long now = monotonic_usec();
+    int alive = 0;
+    for( int i = 0; i < m_process_number; ++i )
+    {
+        process& child = m_sub_process[i];
+        if( child.m_pid == -1 && !m_exiting && child.m_respawn_at > 0 && child.m_respawn_at <= now && spawn_child( i ) )
+        {
+            return true;
+        }
+        if( child.m_pid != -1 )
+        {
+            ++alive;
+        }
+    }
+    if( m_exiting && alive == 0 )
+    {
+        m_stop = true;
+        return false;
+    }
+    if( m_accept_stalled && m_listenfd >= 0 && running_children() > 0 )
+    {
+        m_accept_stalled = false;
+        modfd( m_epollfd, m_listenfd, EPOLLIN );    // 重新触发ET事件，backlog中等待的连接分给已经就绪的子进程
+    }
+    return false;
+}
+
 /*
 父进程执行 run
 */
 template< typename C, typename H, typename M >
-void processpool< C, H, M >::run_parent()
+void processpool< C, H, M >::run_parent( const vector<H>& arg )
 {
     setup_sig_pipe();
 
     /*
     父进程与子进程的m_epollfd是读共享，写复制，因此它们的m_epollfd是不同的
     */
-    for( int i = 0; i < m_process_number; ++i )
+    if( m_conf.m_accept_mode == ACCEPT_REUSEPORT )
+    {
+        close( m_listenfd );    // 由子进程各自accept，父进程只负责管理子进程
+        m_listenfd = -1;
+    }
+    else
     {
-        add_read_fd( m_epollfd, m_sub_process[i].m_pipefd[ 0 ] );
+        add_read_fd( m_epollfd, m_listenfd );   // m_listenfd是主机服务器即balance_srv服务器的socket
+        for( int i = 0; m_conf.m_accept_mode == ACCEPT_PARENT && i < m_process_number; ++i )
+        {
+            add_read_fd( m_epollfd, m_sub_process[i].m_pipefd[ 0 ] );   // 子进程用完配额时的回复
+        }
+        for( int i = 0; m_conf.m_accept_mode == ACCEPT_PASSFD && i < m_process_number; ++i )
+        {
+            setnonblocking( m_sub_process[i].m_pipefd[ 0 ] );   // 子进程没有及时读走时sendmsg不能阻塞父进程的事件循环
+        }
     }
 
-    add_read_fd( m_epollfd, m_listenfd );   // m_listenfd是主机服务器即balance_srv服务器的socket
+    int adminfd = -1;      // admin端口，只在父进程的事件循环中处理
+    vector< admin_client > admin_clts;
+    if( m_conf.m_admin_port > 0 )
+    {
+        adminfd = open_admin_listenfd();
+        if( adminfd < 0 )
+        {
+            log( LOG_ERR, __FILE__, __LINE__, "open admin port %s:%d failed: %s", m_conf.m_admin_host, m_conf.m_admin_port, strerror( errno ) );
+        }
+        else
+        {
+            add_read_fd( m_epollfd, adminfd );
+            log( LOG_INFO, __FILE__, __LINE__, "serve metrics on %s:%d", m_conf.m_admin_host, m_conf.m_admin_port );
+        }
+    }
 
     epoll_event events[ MAX_EVENT_NUMBER ];
-    int sub_process_counter = 0;
-    int new_conn = 1;
     int number = 0;
     int ret = -1;
 
     while( ! m_stop )
     {
-        number = epoll_wait( m_epollfd, events, MAX_EVENT_NUMBER, EPOLL_WAIT_TIME );
+        int timeout = EPOLL_WAIT_TIME;
+        if( m_draining )
+        {
+            timeout = DRAIN_REPORT_TIME;
+        }
+        else if( running_children() < m_process_number )  // 有子进程等待重新启动或还没有就绪
+        {
+            timeout = SUPERVISE_TIME;
+        }
+        number = wait_events( m_epollfd, events, MAX_EVENT_NUMBER, timeout );
         if ( ( number < 0 ) && ( errno != EINTR ) )
         {
             log( LOG_ERR, __FILE__, __LINE__, "%s", "epoll failure" );
             break;
         }
+        if( m_draining )
+        {
+            report_drain();
+        }
 
         for ( int i = 0; i < number; i++ )
         {
             int sockfd = events[i].data.fd;
 
+            // admin端口要先判断：REUSEPORT模式下m_listenfd已关闭，它的fd编号可能被admin连接复用
+            int admin_clt = ( int )admin_clts.size() - 1;
+            while( admin_clt >= 0 && admin_clts[ admin_clt ].m_fd != sockfd )
+            {
+                --admin_clt;
+            }
+            if( adminfd >= 0 && sockfd == adminfd )
+            {
+                accept_admin( adminfd, admin_clts );
+            }
+            else if( admin_clt >= 0 )
+            {
+                if( ! serve_admin( admin_clts[ admin_clt ] ) )
+                {
+                    closefd( m_epollfd, sockfd );
+                    admin_clts.erase( admin_clts.begin() + admin_clt );
+                }
+            }
             /*
             有新的客户端需要连接了 nc localhost 8080 创建客户端
             */
-            if( sockfd == m_listenfd )
+            else if( sockfd == m_listenfd )
             {
                 /*
-                int i =  sub_process_counter;
-                do
+                在 run->child中
+                将一个客户端与网易云服务器进行连接，主机服务器即blance_srv只是负责中转
+                */
+                if( m_conf.m_accept_mode == ACCEPT_PASSFD )
                 {
-                    if( m_sub_process[i].m_pid != -1 )
-                    {
-                        break;
-                    }
-                    i = (i+1)%m_process_number;
+                    dispatch_passfd();
                 }
-                while( i != sub_process_counter );
-                
-                if( m_sub_process[i].m_pid == -1 )
+                else
                 {
-                    m_stop = true;
-                    break;
+                    dispatch_accept();
                 }
-                sub_process_counter = (i+1)%m_process_number;
-                */
-                int idx = get_most_free_srv();  //获取空闲的连接（该连接在run->child()内，初始化mgr的时候已经创建好）
-                /*
-                在 run->child中
-                将一个客户端与网易云服务器进行连接，主机服务器即blance_srv只是负责中转
-                */
-                send( m_sub_process[idx].m_pipefd[0], ( char* )&new_conn, sizeof( new_conn ), 0 ); 
-                log( LOG_INFO, __FILE__, __LINE__, "send request to child %d", idx );     //通知子进程客户的连接请求
             }
             else if( ( sockfd == sig_pipefd[0] ) && ( events[i].events & EPOLLIN ) )
             {
                 // 主机服务器即blance_srv收到信号通知
-                int sig;
                 char signals[1024];
                 ret = recv( sig_pipefd[0], signals, sizeof( signals ), 0 );
                 if( ret <= 0 )
@@ -483,43 +1572,70 @@ void processpool< C, H, M >::run_parent()
                                 */
                                 while ( ( pid = waitpid( -1, &stat, WNOHANG ) ) > 0 )
                                 {
-                                    for( int i = 0; i < m_process_number; ++i )
+                                    for( int j = 0; j < m_process_number; ++j )
                                     {
-                                        if( m_sub_process[i].m_pid == pid )
+                                        if( m_sub_process[j].m_pid == pid )
                                         {
                                             /*
                                             针对某一个子进程关闭它的 m_pid 与 通信读管道
                                             */
-                                            log( LOG_INFO, __FILE__, __LINE__, "child %d join", i );
-                                            close( m_sub_process[i].m_pipefd[0] );
-                                            m_sub_process[i].m_pid = -1;
+                                            closefd( m_epollfd, m_sub_process[j].m_pipefd[0] );   // 管道可能注册在epoll中
+                                            m_sub_process[j].m_pipefd[0] = -1;
+                                            m_sub_process[j].m_pid = -1;
+                                            m_sub_process[j].m_blocked = false;
+                                            if( m_sub_process[j].m_pass_cnt > 0 )   // 管道写满时留下的一批
+                                            {
+                                                requeue_passfd( j );
+                                            }
+                                            if( m_exiting )
+                                            {
+                                                log( LOG_INFO, __FILE__, __LINE__, "child %d join", j );
+                                            }
+                                            else
+                                            {
+                                                schedule_respawn( j, stat );
+                                            }
                                         }
                                     }
                                 }
-                                m_stop = true;  // 子进程通过m_stop来决定是否停止运行
-                                for( int i = 0; i < m_process_number; ++i )
+                                if( m_listenfd >= 0 )
                                 {
-                                    if( m_sub_process[i].m_pid != -1 )
-                                    {
-                                        m_stop = false;
-                                    }
+                                    modfd( m_epollfd, m_listenfd, EPOLLIN );    // 分给已退出子进程的配额可能还没有accept完，重新触发后交给其它子进程
                                 }
                                 break;
                             }
-                            case SIGTERM:   // 终止进程,kill命令默认发送的即为SIGTERM
-                            case SIGINT:    // 键盘输入 (ctrl + c) 中断进程
+                            case SIGTERM:   // 终止进程,kill命令默认发送的即为SIGTERM，子进程等正在转发的连接结束后退出
+                            case SIGINT:    // 键盘输入 (ctrl + c) 中断进程，子进程立即退出
                             {
-                                log( LOG_INFO, __FILE__, __LINE__, "%s", "kill all the clild now" );
-                                for( int i = 0; i < m_process_number; ++i )
+                                m_exiting = true;   // 所有子进程退出后由supervise结束事件循环
+                                if( signals[i] == SIGTERM && m_conf.m_drain_timeout > 0 )
+                                {
+                                    drain_parent();
+                                }
+                                else
                                 {
-                                    int pid = m_sub_process[i].m_pid;
+                                    log( LOG_INFO, __FILE__, __LINE__, "%s", "kill all the clild now" );
+                                }
+                                for( int j = 0; j < m_process_number; ++j )
+                                {
+                                    int pid = m_sub_process[j].m_pid;
                                     if( pid != -1 )
                                     {
-                                        kill( pid, SIGTERM );   // 使用kill 杀死进程
+                                        kill( pid, signals[i] );   // 使用kill 杀死进程
                                     }
                                 }
                                 break;
                             }
+                            case SIGUSR1:   // 汇总所有子进程的延迟直方图，把分位数写入日志
+                            {
+                                m_metrics.dump_latency( m_backend_names );
+                                break;
+                            }
+                            case SIGHUP:    // 重新加载配置文件中的logical_host
+                            {
+                                reload_hosts();
+                                break;
+                            }
                             default:
                             {
                                 break;
@@ -528,36 +1644,70 @@ void processpool< C, H, M >::run_parent()
                     }
                 }
             }
-            else if( events[i].events & EPOLLIN )   // 这里是什么信息的读
+            else if( m_conf.m_accept_mode == ACCEPT_PASSFD )    // 写满的管道可以继续写了
             {
-                /*
-                父进程和子进程通信用的管道 即 父进程是主机服务器，子进程是网易云服务器
-                修改busy_ratio
-                */
-                int busy_ratio = 0;
-                ret = recv( sockfd, ( char* )&busy_ratio, sizeof( busy_ratio ), 0 );
-                if( ( ( ret < 0 ) && ( errno != EAGAIN ) ) || ret == 0 )
-                {
-                    continue;
-                }
-                for( int i = 0; i < m_process_number; ++i )
+                for( int j = 0; j < m_process_number; ++j )
                 {
-                    if( sockfd == m_sub_process[i].m_pipefd[0] )
+                    if( m_sub_process[j].m_pipefd[0] == sockfd && m_sub_process[j].m_blocked )
                     {
-                        m_sub_process[i].m_busy_ratio = busy_ratio;
-                        break;
+                        resume_passfd( j );
                     }
                 }
-                continue;
             }
+            else if( events[i].events & EPOLLIN )   // 子进程用完了配额
+            {
+                int accepted = 0;
+                while( recv( sockfd, ( char* )&accepted, sizeof( accepted ), 0 ) > 0 )
+                {
+                }
+                if( m_listenfd >= 0 )
+                {
+                    modfd( m_epollfd, m_listenfd, EPOLLIN );    // 重新设置ET事件，还有连接在等待时会立即再次触发
+                }
+            }
+        }
+
+        // 请求一直没有读完或回复一直发不完的admin连接到期后关闭
+        long long now = monotonic_usec();
+        for( int i = ( int )admin_clts.size() - 1; i >= 0; --i )
+        {
+            if( admin_clts[i].m_expire <= now )
+            {
+                closefd( m_epollfd, admin_clts[i].m_fd );
+                admin_clts.erase( admin_clts.begin() + i );
+            }
+        }
+
+        if( supervise() )   // 当前进程是刚刚重新启动的子进程，离开父进程的事件循环
+        {
+            break;
         }
     }
 
+    // 重新启动的子进程同样关闭从父进程继承来的这些fd (包括所有子进程管道的父进程一端)
     for( int i = 0; i < m_process_number; ++i )
     {
-        closefd( m_epollfd, m_sub_process[i].m_pipefd[ 0 ] );
+        if( m_sub_process[i].m_pipefd[ 0 ] >= 0 )
+        {
+            close( m_sub_process[i].m_pipefd[ 0 ] );
+        }
+    }
+    for( int i = 0; i < ( int )admin_clts.size(); ++i )
+    {
+        close( admin_clts[i].m_fd );
+    }
+    if( adminfd >= 0 )
+    {
+        close( adminfd );
     }
     close( m_epollfd );
+
+    if( m_idx != -1 )
+    {
+        close( sig_pipefd[0] );     // run_child重新创建自己的信号管道
+        close( sig_pipefd[1] );
+        run_child( arg );
+    }
 }
 
 #endif
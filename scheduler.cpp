@@ -0,0 +1,230 @@
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "scheduler.h"
+
+static const double EWMA_DECAY = 0.2;   // 新采样所占的比例
+
+long long monotonic_usec()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( long long )ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 响应变慢时立即采用新的采样，变快时才按EWMA_DECAY慢慢下降，避免慢的目标在恢复前继续承担流量
+void sched_entry::update_latency( long long usec )
+{
+    if( usec < 1 )
+    {
+        usec = 1;
+    }
+    if( m_ewma == 0 || usec > m_ewma )
+    {
+        m_ewma = usec;
+    }
+    else
+    {
+        m_ewma += ( usec - m_ewma ) * EWMA_DECAY;
+    }
+}
+
+scheduler* scheduler::create( int policy )
+{
+    switch( policy )
+    {
+        case LB_WRR:
+            return new wrr_scheduler;
+        case LB_P2C:
+            return new p2c_scheduler;
+        case LB_EWMA:
+            return new ewma_scheduler;
+        case LB_WLC:
+        default:
+            return new wlc_scheduler;
+    }
+}
+
+int scheduler::parse_policy( const char* name )
+{
+    static const char* names[] = { "wlc", "wrr", "p2c", "ewma" };
+    for( int i = 0; i < ( int )( sizeof( names ) / sizeof( names[0] ) ); ++i )
+    {
+        if( strcmp( name, names[i] ) == 0 )
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char* scheduler::policy_name( int policy )
+{
+    switch( policy )
+    {
+        case LB_WRR:
+            return "wrr";
+        case LB_P2C:
+            return "p2c";
+        case LB_EWMA:
+            return "ewma";
+        default:
+            return "wlc";
+    }
+}
+
+// 交叉相乘比较 (load+1)/weight，负载都为0时权重大的优先
+bool scheduler::less_loaded( const sched_entry& a, const sched_entry& b ) const
+{
+    return ( long long )( a.m_load + 1 ) * b.m_weight < ( long long )( b.m_load + 1 ) * a.m_weight;
+}
+
+unsigned int scheduler::random()
+{
+    if( m_seed == 0 )
+    {
+        m_seed = ( unsigned int )( getpid() ^ monotonic_usec() ) | 1;
+    }
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+int wlc_scheduler::select( sched_entry* entries, int cnt )
+{
+    if( cnt <= 0 )
+    {
+        return -1;
+    }
+    int best = -1;
+    for( int i = 0; i < cnt; ++i )
+    {
+        int idx = ( m_next + i ) % cnt;
+        if( !usable( entries[idx] ) )
+        {
+            continue;
+        }
+        if( best < 0 || less_loaded( entries[idx], entries[best] ) )
+        {
+            best = idx;
+        }
+    }
+    m_next = ( m_next + 1 ) % cnt;
+    return best;
+}
+
+/*
+平滑加权轮询 (与nginx相同)：每次所有目标的m_current加上各自的权重，选m_current最大的，再减去权重总和
+权重为5,1,1时的顺序是 a a b a c a a，而不是 a a a a a b c
+*/
+int wrr_scheduler::select( sched_entry* entries, int cnt )
+{
+    int best = -1;
+    int total = 0;
+    for( int i = 0; i < cnt; ++i )
+    {
+        if( !usable( entries[i] ) )
+        {
+            continue;
+        }
+        entries[i].m_current += entries[i].m_weight;
+        total += entries[i].m_weight;
+        if( best < 0 || entries[i].m_current > entries[best].m_current )
+        {
+            best = i;
+        }
+    }
+    if( best >= 0 )
+    {
+        entries[best].m_current -= total;
+    }
+    return best;
+}
+
+int p2c_scheduler::select( sched_entry* entries, int cnt )
+{
+    int usable_cnt = 0;
+    for( int i = 0; i < cnt; ++i )
+    {
+        if( usable( entries[i] ) )
+        {
+            ++usable_cnt;
+        }
+    }
+    if( usable_cnt == 0 )
+    {
+        return -1;
+    }
+
+    // 在可用的目标中随机取两个不同的序号，再换算成下标
+    int first = random() % usable_cnt;
+    int second = first;
+    if( usable_cnt > 1 )
+    {
+        second = random() % ( usable_cnt - 1 );
+        if( second >= first )
+        {
+            ++second;
+        }
+    }
+    int a = -1;
+    int b = -1;
+    for( int i = 0, rank = 0; i < cnt; ++i )
+    {
+        if( !usable( entries[i] ) )
+        {
+            continue;
+        }
+        if( rank == first )
+        {
+            a = i;
+        }
+        if( rank == second )
+        {
+            b = i;
+        }
+        ++rank;
+    }
+    return less_loaded( entries[b], entries[a] ) ? b : a;
+}
+
+// 还没有采样的目标按已有采样的平均值计算，都没有采样时退化为加权最少连接
+int ewma_scheduler::select( sched_entry* entries, int cnt )
+{
+    if( cnt <= 0 )
+    {
+        return -1;
+    }
+    double sum = 0;
+    int sampled = 0;
+    for( int i = 0; i < cnt; ++i )
+    {
+        if( usable( entries[i] ) && entries[i].m_ewma > 0 )
+        {
+            sum += entries[i].m_ewma;
+            ++sampled;
+        }
+    }
+    double fallback = sampled > 0 ? sum / sampled : 1;
+
+    int best = -1;
+    double best_score = 0;
+    for( int i = 0; i < cnt; ++i )
+    {
+        int idx = ( m_next + i ) % cnt;
+        if( !usable( entries[idx] ) )
+        {
+            continue;
+        }
+        double latency = entries[idx].m_ewma > 0 ? entries[idx].m_ewma : fallback;
+        double score = latency * ( entries[idx].m_load + 1 ) / entries[idx].m_weight;
+        if( best < 0 || score < best_score )
+        {
+            best = idx;
+            best_score = score;
+        }
+    }
+    m_next = ( m_next + 1 ) % cnt;
+    return best;
+}
@@ -0,0 +1,76 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+/*
+负载均衡策略 (config.xml中的 <balance>)
+LB_WLC: 加权最少连接，负载/权重最小者优先
+LB_WRR: 平滑加权轮询，不看负载，按权重比例轮流分配
+LB_P2C: 随机取两个候选，选负载/权重较小的一个，避免过时的负载信息让突发流量都涌向同一个目标
+LB_EWMA: 负载乘以响应时间的指数加权平均，再除以权重，响应变慢的目标自动少分流量
+*/
+enum LB_POLICY { LB_WLC = 0, LB_WRR, LB_P2C, LB_EWMA };
+
+/*
+参与调度的一个目标 (子进程或逻辑服务器)，由使用者在每次调度前更新m_weight/m_load/m_available
+*/
+class sched_entry
+{
+public:
+    sched_entry() : m_weight( 1 ), m_load( 0 ), m_available( true ), m_current( 0 ), m_ewma( 0 ){}
+    void update_latency( long long usec );     // 加入一次响应时间的采样(微秒)
+
+public:
+    int m_weight;           // 权重，<=0时视为不可用
+    int m_load;             // 当前负载(连接数)
+    bool m_available;       // 是否可以分配
+    int m_current;          // 平滑加权轮询的当前权重
+    double m_ewma;          // 响应时间的指数加权平均(微秒)，0表示还没有采样
+};
+
+class scheduler
+{
+public:
+    scheduler() : m_next( 0 ), m_seed( 0 ){}
+    virtual ~scheduler(){}
+    static scheduler* create( int policy );     // 根据LB_POLICY创建调度器
+    static int parse_policy( const char* name );    // "wlc"/"wrr"/"p2c"/"ewma" -> LB_POLICY，未知时返回-1
+    static const char* policy_name( int policy );
+    virtual int select( sched_entry* entries, int cnt ) = 0;  // 返回选中的下标，没有可用目标时返回-1
+
+protected:
+    bool usable( const sched_entry& entry ) const { return entry.m_available && entry.m_weight > 0; }
+    bool less_loaded( const sched_entry& a, const sched_entry& b ) const;  // a的负载/权重是否小于b
+    unsigned int random();      // xorshift，每个进程独立的序列
+
+protected:
+    int m_next;             // 负载相同时从m_next开始比较，避免总是偏向下标小的目标
+    unsigned int m_seed;
+};
+
+class wlc_scheduler : public scheduler
+{
+public:
+    int select( sched_entry* entries, int cnt );
+};
+
+class wrr_scheduler : public scheduler
+{
+public:
+    int select( sched_entry* entries, int cnt );
+};
+
+class p2c_scheduler : public scheduler
+{
+public:
+    int select( sched_entry* entries, int cnt );
+};
+
+class ewma_scheduler : public scheduler
+{
+public:
+    int select( sched_entry* entries, int cnt );
+};
+
+long long monotonic_usec();     // 单调时钟(微秒)，用于响应时间采样
+
+#endif
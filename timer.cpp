@@ -0,0 +1,170 @@
+#include <sys/timerfd.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include "timer.h"
+#include "fdwrapper.h"
+#include "log.h"
+
+static long long monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( long long )ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+timer_wheel::timer_wheel() : m_now( 0 ), m_start_ms( 0 ), m_timerfd( -1 )
+{
+    memset( m_slots, 0, sizeof( m_slots ) );
+}
+
+timer_wheel::~timer_wheel()
+{
+    if( m_timerfd >= 0 )
+    {
+        close( m_timerfd );
+    }
+}
+
+int timer_wheel::init( int epollfd )
+{
+    m_timerfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+    if( m_timerfd < 0 )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "create timerfd failed: %s", strerror( errno ) );
+        return -1;
+    }
+    struct itimerspec its;
+    memset( &its, 0, sizeof( its ) );
+    its.it_value.tv_nsec = TICK_MS * 1000000;
+    its.it_interval.tv_nsec = TICK_MS * 1000000;
+    timerfd_settime( m_timerfd, 0, &its, NULL );
+    m_start_ms = monotonic_ms();
+    add_read_fd( epollfd, m_timerfd );
+    return m_timerfd;
+}
+
+long long timer_wheel::elapsed_ticks() const
+{
+    return ( monotonic_ms() - m_start_ms ) / TICK_MS;
+}
+
+void timer_wheel::place( timer* t )
+{
+    unsigned long long delta = t->m_expire - m_now;
+    int level = 0;
+    while( level < LEVEL_NUMBER - 1 && delta >= ( 1ULL << ( ( level + 1 ) * LEVEL_BITS ) ) )
+    {
+        ++level;
+    }
+    int slot = ( t->m_expire >> ( level * LEVEL_BITS ) ) & LEVEL_MASK;
+
+    t->m_prev = NULL;
+    t->m_next = m_slots[ level ][ slot ];
+    if( t->m_next )
+    {
+        t->m_next->m_prev = t;
+    }
+    m_slots[ level ][ slot ] = t;
+    t->m_pending = true;
+}
+
+void timer_wheel::add( timer* t, int timeout_ms )
+{
+    if( t->m_pending )
+    {
+        del( t );
+    }
+    unsigned long long ticks = ( timeout_ms + TICK_MS - 1 ) / TICK_MS;
+    unsigned long long max_ticks = ( 1ULL << ( LEVEL_NUMBER * LEVEL_BITS ) ) - 1;
+    if( ticks == 0 )
+    {
+        ticks = 1;
+    }
+    else if( ticks > max_ticks )
+    {
+        ticks = max_ticks;
+    }
+    t->m_expire = m_now + ticks;
+    place( t );
+}
+
+void timer_wheel::del( timer* t )
+{
+    if( !t->m_pending )
+    {
+        return;
+    }
+    if( t->m_prev )
+    {
+        t->m_prev->m_next = t->m_next;
+    }
+    else
+    {
+        // 表头所在的槽由到期时刻与当前时刻共同决定，直接在各层查找
+        for( int level = 0; level < LEVEL_NUMBER; ++level )
+        {
+            int slot = ( t->m_expire >> ( level * LEVEL_BITS ) ) & LEVEL_MASK;
+            if( m_slots[ level ][ slot ] == t )
+            {
+                m_slots[ level ][ slot ] = t->m_next;
+                break;
+            }
+        }
+    }
+    if( t->m_next )
+    {
+        t->m_next->m_prev = t->m_prev;
+    }
+    t->m_prev = NULL;
+    t->m_next = NULL;
+    t->m_pending = false;
+}
+
+void timer_wheel::cascade( int level )
+{
+    int slot = ( m_now >> ( level * LEVEL_BITS ) ) & LEVEL_MASK;
+    timer* t = m_slots[ level ][ slot ];
+    m_slots[ level ][ slot ] = NULL;
+    while( t )
+    {
+        timer* next = t->m_next;
+        place( t );
+        t = next;
+    }
+}
+
+void timer_wheel::tick()
+{
+    unsigned long long expirations = 0;
+    while( read( m_timerfd, &expirations, sizeof( expirations ) ) > 0 )   // 读空timerfd，实际推进的tick数以单调时钟为准
+    {
+    }
+
+    long long target = elapsed_ticks();
+    while( ( long long )m_now < target )
+    {
+        ++m_now;
+
+        // 低层转完一圈时从高层往低层依次重新分配，高层落下来的定时器可能还要继续落到更低层
+        int top = 0;
+        while( top < LEVEL_NUMBER - 1 && ( ( m_now >> ( top * LEVEL_BITS ) ) & LEVEL_MASK ) == 0 )
+        {
+            ++top;
+        }
+        for( int level = top; level >= 1; --level )
+        {
+            cascade( level );
+        }
+
+        // 逐个摘下到期的定时器再回调，回调中可以安全地加入或删除其他定时器
+        int slot = m_now & LEVEL_MASK;
+        timer* t = NULL;
+        while( ( t = m_slots[ 0 ][ slot ] ) )
+        {
+            del( t );
+            t->m_handler->on_timer( t );
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stddef.h>
+
+class timer;
+
+// 定时器到期时的回调接口
+class timer_handler
+{
+public:
+    virtual ~timer_handler(){}
+    virtual void on_timer( timer* t ) = 0;
+};
+
+/*
+定时器节点，通常直接嵌入到使用者(如conn)中，加入与删除都不需要分配内存
+*/
+class timer
+{
+public:
+    timer() : m_expire( 0 ), m_handler( NULL ), m_data( NULL ), m_prev( NULL ), m_next( NULL ), m_pending( false ){}
+
+public:
+    unsigned long long m_expire;    // 到期时刻(tick)
+    timer_handler* m_handler;       // 到期时调用m_handler->on_timer
+    void* m_data;                   // 使用者自定义的数据
+    timer* m_prev;                  // 所在槽位链表的前一个节点
+    timer* m_next;                  // 所在槽位链表的后一个节点
+    bool m_pending;                 // 是否已加入时间轮
+};
+
+/*
+分层时间轮：每层64个槽，共4层，tick为TICK_MS毫秒
+加入、删除为O(1)，低层转完一圈时把上一层对应槽中的定时器重新分配到低层
+由加入子进程epoll的timerfd周期性驱动
+*/
+class timer_wheel
+{
+public:
+    timer_wheel();
+    ~timer_wheel();
+    int init( int epollfd );        // 创建timerfd并加入epollfd，返回timerfd，失败返回-1
+    int get_fd() const { return m_timerfd; }
+    unsigned long long now() const { return m_now; }   // 当前时刻(tick)
+    void add( timer* t, int timeout_ms );   // timeout_ms毫秒后到期，已加入的定时器会被重新调度
+    void del( timer* t );                   // 删除尚未到期的定时器
+    void tick();                    // timerfd可读时调用，推进时间轮并执行到期的定时器
+
+public:
+    static const int TICK_MS = 10;
+
+private:
+    void place( timer* t );         // 根据到期时刻把定时器放入对应的层与槽
+    void cascade( int level );      // 把level层当前槽中的定时器重新分配到低层
+    long long elapsed_ticks() const;    // 从init起经过的tick数
+
+private:
+    static const int LEVEL_BITS = 6;
+    static const int LEVEL_SIZE = 1 << LEVEL_BITS;
+    static const int LEVEL_MASK = LEVEL_SIZE - 1;
+    static const int LEVEL_NUMBER = 4;
+
+    timer* m_slots[ LEVEL_NUMBER ][ LEVEL_SIZE ];
+    unsigned long long m_now;       // 时间轮已经推进到的tick
+    long long m_start_ms;           // init时的单调时钟(毫秒)
+    int m_timerfd;
+};
+
+#endif
@@ -0,0 +1,298 @@
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "uring.h"
+#include "log.h"
+
+static int sys_io_uring_setup( unsigned int entries, io_uring_params* params )
+{
+    return syscall( __NR_io_uring_setup, entries, params );
+}
+
+static int sys_io_uring_register( int fd, unsigned int opcode, void* arg, unsigned int nr_args )
+{
+    return syscall( __NR_io_uring_register, fd, opcode, arg, nr_args );
+}
+
+uring::uring() : m_fd( -1 ), m_epollfd( -1 ), m_ring( MAP_FAILED ), m_ring_size( 0 ), m_cq_ring( MAP_FAILED ), m_cq_ring_size( 0 ),
+                 m_sqes( ( io_uring_sqe* )MAP_FAILED ), m_sqes_size( 0 ), m_ctl_events( NULL ), m_events( NULL ),
+                 m_epoll_wait( false ), m_skip_success( false ), m_waiting( false )
+{
+}
+
+uring::~uring()
+{
+    if( m_sqes != MAP_FAILED )
+    {
+        munmap( m_sqes, m_sqes_size );
+    }
+    if( m_cq_ring != MAP_FAILED && m_cq_ring != m_ring )
+    {
+        munmap( m_cq_ring, m_cq_ring_size );
+    }
+    if( m_ring != MAP_FAILED )
+    {
+        munmap( m_ring, m_ring_size );
+    }
+    if( m_fd >= 0 )
+    {
+        close( m_fd );     // 还在等待的IORING_OP_EPOLL_WAIT随之取消
+    }
+    delete [] m_ctl_events;
+    delete [] m_events;
+}
+
+uring* uring::create( int epollfd )
+{
+    uring* ring = new uring;
+    if( !ring->setup( epollfd ) )
+    {
+        delete ring;
+        return NULL;
+    }
+    return ring;
+}
+
+bool uring::setup( int epollfd )
+{
+    io_uring_params params;
+    memset( &params, 0, sizeof( params ) );
+    m_fd = sys_io_uring_setup( ENTRIES, &params );
+    if( m_fd < 0 )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "io_uring_setup failed: %s", strerror( errno ) );
+        return false;
+    }
+
+    // 探测需要的操作，IORING_OP_EPOLL_CTL是必须的
+    int probe_size = sizeof( io_uring_probe ) + 256 * sizeof( io_uring_probe_op );
+    io_uring_probe* probe = ( io_uring_probe* )calloc( 1, probe_size );
+    bool ctl = false;
+    if( sys_io_uring_register( m_fd, IORING_REGISTER_PROBE, probe, 256 ) == 0 )
+    {
+        ctl = probe->last_op >= IORING_OP_EPOLL_CTL && ( probe->ops[ IORING_OP_EPOLL_CTL ].flags & IO_URING_OP_SUPPORTED )
+              && ( probe->ops[ IORING_OP_CLOSE ].flags & IO_URING_OP_SUPPORTED );
+        m_epoll_wait = probe->last_op >= OP_EPOLL_WAIT && ( probe->ops[ OP_EPOLL_WAIT ].flags & IO_URING_OP_SUPPORTED )
+                       && ( params.features & IORING_FEAT_EXT_ARG );
+    }
+    free( probe );
+    if( !ctl )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "%s", "io_uring does not support IORING_OP_EPOLL_CTL or IORING_OP_CLOSE" );
+        return false;
+    }
+    m_skip_success = ( params.features & IORING_FEAT_CQE_SKIP ) != 0;
+
+    m_ring_size = params.sq_off.array + params.sq_entries * sizeof( unsigned int );
+    m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+    if( params.features & IORING_FEAT_SINGLE_MMAP )
+    {
+        if( m_cq_ring_size > m_ring_size )
+        {
+            m_ring_size = m_cq_ring_size;
+        }
+    }
+    m_ring = mmap( NULL, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING );
+    if( m_ring == MAP_FAILED )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "mmap io_uring sq failed: %s", strerror( errno ) );
+        return false;
+    }
+    if( params.features & IORING_FEAT_SINGLE_MMAP )
+    {
+        m_cq_ring = m_ring;
+    }
+    else
+    {
+        m_cq_ring = mmap( NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING );
+        if( m_cq_ring == MAP_FAILED )
+        {
+            log( LOG_ERR, __FILE__, __LINE__, "mmap io_uring cq failed: %s", strerror( errno ) );
+            return false;
+        }
+    }
+    m_sqes_size = params.sq_entries * sizeof( io_uring_sqe );
+    m_sqes = ( io_uring_sqe* )mmap( NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES );
+    if( m_sqes == MAP_FAILED )
+    {
+        log( LOG_ERR, __FILE__, __LINE__, "mmap io_uring sqes failed: %s", strerror( errno ) );
+        return false;
+    }
+
+    char* sq = ( char* )m_ring;
+    m_sq_head = ( unsigned int* )( sq + params.sq_off.head );
+    m_sq_tail = ( unsigned int* )( sq + params.sq_off.tail );
+    m_sq_mask = *( unsigned int* )( sq + params.sq_off.ring_mask );
+    m_sq_array = ( unsigned int* )( sq + params.sq_off.array );
+    m_sq_entries = params.sq_entries;
+    char* cq = ( char* )m_cq_ring;
+    m_cq_head = ( unsigned int* )( cq + params.cq_off.head );
+    m_cq_tail = ( unsigned int* )( cq + params.cq_off.tail );
+    m_cq_mask = *( unsigned int* )( cq + params.cq_off.ring_mask );
+    m_cqes = ( io_uring_cqe* )( cq + params.cq_off.cqes );
+
+    m_ctl_events = new epoll_event[ m_sq_entries ];
+    m_events = new epoll_event[ MAX_EVENTS ];
+    m_epollfd = epollfd;
+    log( LOG_INFO, __FILE__, __LINE__, "io_uring engine: %u entries, wait: %s", m_sq_entries, m_epoll_wait ? "io_uring" : "epoll_wait" );
+    return true;
+}
+
+unsigned int uring::pending() const
+{
+    return *m_sq_tail - __atomic_load_n( m_sq_head, __ATOMIC_ACQUIRE );
+}
+
+io_uring_sqe* uring::get_sqe()
+{
+    if( pending() >= m_sq_entries )
+    {
+        enter( pending(), 0, -1 );
+    }
+    unsigned int tail = *m_sq_tail;
+    unsigned int idx = tail & m_sq_mask;
+    io_uring_sqe* sqe = &m_sqes[ idx ];
+    memset( sqe, 0, sizeof( *sqe ) );
+    m_sq_array[ idx ] = idx;
+    __atomic_store_n( m_sq_tail, tail + 1, __ATOMIC_RELEASE );     // SQE在调用者返回后、提交前填好即可
+    return sqe;
+}
+
+void uring::ctl( int op, int fd, unsigned int events )
+{
+    io_uring_sqe* sqe = get_sqe();
+    unsigned int idx = sqe - m_sqes;
+    m_ctl_events[ idx ].events = events;
+    m_ctl_events[ idx ].data.fd = fd;
+    sqe->opcode = IORING_OP_EPOLL_CTL;
+    sqe->fd = m_epollfd;
+    sqe->off = fd;
+    sqe->len = op;
+    sqe->addr = ( unsigned long )&m_ctl_events[ idx ];
+    sqe->user_data = fd;
+    sqe->flags = IOSQE_IO_HARDLINK;     // 前一个操作失败(例如fd已经关闭)也不影响后面的操作
+    if( m_skip_success )
+    {
+        sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+    }
+}
+
+/*
+DEL排队而fd立即close时，DEL执行时fd已经无效(EBADF)，若其它进程仍持有同一个打开的文件(例如fork出的子进程继承的fd)，注册会一直留在epoll中
+因此close也排在同一条链上，在DEL之后执行；fd号在此之前不会被重新分配
+*/
+void uring::del_close( int fd )
+{
+    ctl( EPOLL_CTL_DEL, fd, 0 );
+    queue_close( fd );
+}
+
+void uring::queue_close( int fd )
+{
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = fd;
+    sqe->flags = IOSQE_IO_HARDLINK;
+    if( m_skip_success )
+    {
+        sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+    }
+}
+
+int uring::enter( unsigned int to_submit, unsigned int min_complete, int timeout )
+{
+    if( to_submit > 0 )     // 链在这一批的最后一个SQE处结束
+    {
+        m_sqes[ ( *m_sq_tail - 1 ) & m_sq_mask ].flags &= ~IOSQE_IO_HARDLINK;
+    }
+    unsigned int flags = 0;
+    io_uring_getevents_arg arg;
+    __kernel_timespec ts;
+    void* argp = NULL;
+    size_t argsz = 0;
+    if( min_complete > 0 )
+    {
+        flags |= IORING_ENTER_GETEVENTS;
+        if( timeout >= 0 )
+        {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = ( timeout % 1000 ) * 1000000LL;
+            memset( &arg, 0, sizeof( arg ) );
+            arg.ts = ( unsigned long )&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            argsz = sizeof( arg );
+        }
+    }
+    return syscall( __NR_io_uring_enter, m_fd, to_submit, min_complete, flags, argp, argsz );
+}
+
+int uring::reap( epoll_event* events )
+{
+    int number = 0;
+    unsigned int head = *m_cq_head;
+    unsigned int tail = __atomic_load_n( m_cq_tail, __ATOMIC_ACQUIRE );
+    for( ; head != tail; ++head )
+    {
+        const io_uring_cqe& cqe = m_cqes[ head & m_cq_mask ];
+        if( cqe.user_data == ( unsigned long long )-1 )   // IORING_OP_EPOLL_WAIT
+        {
+            m_waiting = false;
+            if( cqe.res > 0 )
+            {
+                number = cqe.res;
+                memcpy( events, m_events, sizeof( epoll_event ) * number );
+            }
+            else if( cqe.res < 0 && cqe.res != -EINTR )
+            {
+                log( LOG_ERR, __FILE__, __LINE__, "io_uring epoll wait failed: %s", strerror( -cqe.res ) );
+            }
+        }
+        else if( cqe.res < 0 && cqe.res != -ENOENT && cqe.res != -EBADF && cqe.res != -EEXIST )
+        {
+            // fd被重新注册或没有注册过是正常的，与直接调用epoll_ctl时忽略返回值一致
+            log( LOG_ERR, __FILE__, __LINE__, "io_uring epoll_ctl/close on fd %llu failed: %s", cqe.user_data, strerror( -cqe.res ) );
+        }
+    }
+    __atomic_store_n( m_cq_head, head, __ATOMIC_RELEASE );
+    return number;
+}
+
+int uring::wait( epoll_event* events, int max, int timeout )
+{
+    if( !m_epoll_wait )
+    {
+        if( pending() > 0 )
+        {
+            enter( pending(), 0, -1 );
+        }
+        reap( events );
+        return epoll_wait( m_epollfd, events, max, timeout );
+    }
+
+    if( !m_waiting )    // 上一次超时返回时等待仍在进行，不再重复提交
+    {
+        io_uring_sqe* sqe = get_sqe();
+        sqe->opcode = OP_EPOLL_WAIT;
+        sqe->fd = m_epollfd;
+        sqe->addr = ( unsigned long )m_events;
+        sqe->len = max < MAX_EVENTS ? max : MAX_EVENTS;   // 内核取走的事件必须都能交给调用者
+        sqe->user_data = ( unsigned long long )-1;
+        m_waiting = true;
+    }
+    int ret = enter( pending(), 1, timeout );
+    if( ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY )
+    {
+        return -1;
+    }
+    int number = reap( events );
+    if( number == 0 && ret < 0 && errno == EINTR )
+    {
+        return -1;      // 与epoll_wait一样让调用者处理信号
+    }
+    return number;
+}
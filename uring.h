@@ -0,0 +1,69 @@
+#ifndef URING_H
+#define URING_H
+
+#include <sys/epoll.h>
+#include <linux/io_uring.h>
+
+/*
+事件引擎 (config.xml中 <engine>)
+ENGINE_EPOLL: 每次注册状态变化(modfd等)调用一次epoll_ctl，再由epoll_wait等待
+ENGINE_URING: epoll_ctl作为IORING_OP_EPOLL_CTL排队，在下一次等待时与IORING_OP_EPOLL_WAIT一起由一次io_uring_enter提交
+*/
+enum EVENT_ENGINE { ENGINE_EPOLL = 0, ENGINE_URING };
+
+/*
+一个epoll实例前面的io_uring提交队列，不依赖liburing，直接mmap内核的环
+conn/mgr的状态机仍然是基于就绪通知的，事件的语义与epoll完全相同(包括ET)，只是省去了每次状态变化的系统调用：
+一轮事件循环中的所有epoll_ctl以IOSQE_IO_HARDLINK串成一条链，保证按调用顺序执行；成功的epoll_ctl不产生CQE
+内核不支持IORING_OP_EPOLL_WAIT(6.15之前)时，仍然批量提交epoll_ctl，等待退回epoll_wait
+*/
+class uring
+{
+public:
+    static uring* create( int epollfd );    // 内核不支持io_uring或IORING_OP_EPOLL_CTL时返回NULL
+    ~uring();
+    void ctl( int op, int fd, unsigned int events );    // 排队一个epoll_ctl，在下一次wait时执行
+    void del_close( int fd );   // 排队EPOLL_CTL_DEL与close，fd在DEL执行之后才关闭
+    void queue_close( int fd ); // 排队close，在之前排队的操作(例如removefd的DEL)之后执行
+    int wait( epoll_event* events, int max, int timeout );  // 提交排队的操作并等待，返回值与epoll_wait相同
+    int epollfd() const { return m_epollfd; }
+
+private:
+    uring();
+    bool setup( int epollfd );
+    io_uring_sqe* get_sqe();    // 提交队列满时先提交已排队的操作
+    unsigned int pending() const;   // 已排队、内核还没有取走的SQE个数
+    int enter( unsigned int to_submit, unsigned int min_complete, int timeout );
+    int reap( epoll_event* events );    // 处理所有CQE，返回IORING_OP_EPOLL_WAIT复制到events中的事件数，没有完成时返回0
+
+public:
+    static const unsigned int ENTRIES = 1024;   // 提交队列的大小，一轮事件循环的epoll_ctl超过时提前提交
+    static const int MAX_EVENTS = 1024;         // 一次等待最多返回的事件数
+    static const int OP_EPOLL_WAIT = 59;        // IORING_OP_EPOLL_WAIT，6.15之前的uapi头文件中没有
+
+private:
+    int m_fd;                   // io_uring的fd
+    int m_epollfd;
+    void* m_ring;               // SQ与CQ的环 (IORING_FEAT_SINGLE_MMAP时是同一块映射)
+    size_t m_ring_size;
+    void* m_cq_ring;
+    size_t m_cq_ring_size;
+    io_uring_sqe* m_sqes;
+    size_t m_sqes_size;
+    unsigned int* m_sq_head;
+    unsigned int* m_sq_tail;
+    unsigned int m_sq_mask;
+    unsigned int* m_sq_array;
+    unsigned int m_sq_entries;
+    unsigned int* m_cq_head;
+    unsigned int* m_cq_tail;
+    unsigned int m_cq_mask;
+    io_uring_cqe* m_cqes;
+    epoll_event* m_ctl_events;  // 与SQE一一对应，IORING_OP_EPOLL_CTL在提交时才从这里读取事件
+    epoll_event* m_events;      // IORING_OP_EPOLL_WAIT写入事件的缓冲区，等待可能跨越多次wait调用，不能使用调用者的数组
+    bool m_epoll_wait;          // 内核支持IORING_OP_EPOLL_WAIT
+    bool m_skip_success;        // 内核支持IOSQE_CQE_SKIP_SUCCESS
+    bool m_waiting;             // IORING_OP_EPOLL_WAIT已提交，还没有完成
+};
+
+#endif